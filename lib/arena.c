@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN	sizeof(max_align_t)
+
+static struct arena_chunk *chunk_new(size_t size)
+{
+	struct arena_chunk *chunk;
+
+	chunk = malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+struct arena *arena_new(size_t chunk_size)
+{
+	struct arena *arena;
+
+	arena = malloc(sizeof(*arena));
+	if (!arena)
+		return NULL;
+
+	arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_SIZE;
+	arena->chunks = chunk_new(arena->chunk_size);
+	if (!arena->chunks) {
+		free(arena);
+		return NULL;
+	}
+
+	return arena;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	free(arena);
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (size > chunk->size - chunk->used) {
+		chunk = chunk_new(size > arena->chunk_size ? size :
+				  arena->chunk_size);
+		if (!chunk)
+			return NULL;
+
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	ptr = (unsigned char *)chunk->data + chunk->used;
+	chunk->used += size;
+
+	return ptr;
+}
+
+void arena_reset(struct arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	while (arena->chunks->next) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+
+	arena->chunks->used = 0;
+}
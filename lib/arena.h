@@ -0,0 +1,30 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_SIZE	65536
+
+/* Bump allocator for short-lived scratch memory, released all at once by
+ * arena_reset(). An allocation that does not fit in the current chunk
+ * starts a new one, at least as large as the allocation. The reset keeps
+ * the first chunk for the next use. Not thread-safe.
+ */
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+struct arena {
+	struct arena_chunk *chunks; /* most recent first */
+	size_t chunk_size;
+};
+
+struct arena *arena_new(size_t chunk_size);
+void arena_destroy(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+
+#endif
@@ -0,0 +1,363 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "executor.h"
+
+#define DEQUE_INIT_SIZE	64
+
+/* worker running the current thread, NULL outside of the pools */
+static __thread struct exec_worker *current;
+
+static int deque_init(struct exec_deque *dq)
+{
+	dq->tasks = malloc(DEQUE_INIT_SIZE * sizeof(*dq->tasks));
+	if (!dq->tasks)
+		return -1;
+
+	pthread_mutex_init(&dq->lock, NULL);
+	dq->size = DEQUE_INIT_SIZE;
+	dq->head = 0;
+	dq->tail = 0;
+
+	return 0;
+}
+
+static void deque_destroy(struct exec_deque *dq)
+{
+	pthread_mutex_destroy(&dq->lock);
+	free(dq->tasks);
+}
+
+/* called with the deque lock */
+static int deque_grow(struct exec_deque *dq)
+{
+	struct exec_task *tasks;
+	unsigned int i;
+
+	tasks = malloc(2 * dq->size * sizeof(*tasks));
+	if (!tasks)
+		return -1;
+
+	for (i = 0; i < dq->size; i++)
+		tasks[i] = dq->tasks[(dq->head + i) & (dq->size - 1)];
+
+	free(dq->tasks);
+	dq->tasks = tasks;
+	__atomic_store_n(&dq->head, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&dq->tail, dq->size, __ATOMIC_RELAXED);
+	dq->size *= 2;
+
+	return 0;
+}
+
+static int deque_push(struct exec_deque *dq, struct exec_task *task)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&dq->lock);
+
+	if (dq->tail - dq->head == dq->size && deque_grow(dq) < 0) {
+		ret = -1;
+		goto out_unlock;
+	}
+
+	dq->tasks[dq->tail & (dq->size - 1)] = *task;
+	__atomic_store_n(&dq->tail, dq->tail + 1, __ATOMIC_RELAXED);
+
+out_unlock:
+	pthread_mutex_unlock(&dq->lock);
+	return ret;
+}
+
+/* Newest task for the owner (@steal false), oldest one for the others */
+static bool deque_pop(struct exec_deque *dq, struct exec_task *task,
+		      bool steal)
+{
+	bool found = false;
+
+	/* unlocked peek, a task pushed meanwhile is found by the next scan */
+	if (__atomic_load_n(&dq->head, __ATOMIC_RELAXED) ==
+	    __atomic_load_n(&dq->tail, __ATOMIC_RELAXED))
+		return false;
+
+	pthread_mutex_lock(&dq->lock);
+
+	if (dq->head != dq->tail) {
+		if (steal) {
+			*task = dq->tasks[dq->head & (dq->size - 1)];
+			__atomic_store_n(&dq->head, dq->head + 1,
+					 __ATOMIC_RELAXED);
+		} else {
+			__atomic_store_n(&dq->tail, dq->tail - 1,
+					 __ATOMIC_RELAXED);
+			*task = dq->tasks[dq->tail & (dq->size - 1)];
+		}
+		found = true;
+	}
+
+	pthread_mutex_unlock(&dq->lock);
+
+	return found;
+}
+
+static bool take_task(struct executor *ex, struct exec_worker *w,
+		      struct exec_task *task)
+{
+	unsigned int prio, i, v;
+
+	for (prio = 0; prio < ex->nprios; prio++) {
+		if (w && deque_pop(&w->deques[prio], task, false))
+			return true;
+
+		v = w ? w->victim : 0;
+		for (i = 0; i < ex->nworkers; i++, v++) {
+			if (v >= ex->nworkers)
+				v = 0;
+
+			if (&ex->workers[v] == w)
+				continue;
+
+			if (deque_pop(&ex->workers[v].deques[prio], task,
+				      true)) {
+				if (w)
+					w->victim = v;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/* The group lock is held until the last access to @group, which its
+ * waiter may release as soon as it can take the lock.
+ */
+static void task_complete(struct task_group *group)
+{
+	pthread_mutex_lock(&group->lock);
+	if (!__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL))
+		pthread_cond_broadcast(&group->done);
+	pthread_mutex_unlock(&group->lock);
+}
+
+static bool run_one(struct executor *ex, struct exec_worker *w)
+{
+	struct exec_task task;
+
+	if (!take_task(ex, w, &task))
+		return false;
+
+	__atomic_sub_fetch(&ex->pending, 1, __ATOMIC_RELAXED);
+
+	task.fn(task.arg);
+
+	if (task.group)
+		task_complete(task.group);
+
+	return true;
+}
+
+static void *exec_worker(void *arg)
+{
+	struct exec_worker *w = arg;
+	struct executor *ex = w->ex;
+
+	current = w;
+
+	for (;;) {
+		if (run_one(ex, w))
+			continue;
+
+		pthread_mutex_lock(&ex->lock);
+
+		/* pairs with the submitter, which increments pending before
+		 * looking for sleepers
+		 */
+		__atomic_add_fetch(&ex->sleepers, 1, __ATOMIC_SEQ_CST);
+		while (!__atomic_load_n(&ex->pending, __ATOMIC_SEQ_CST) &&
+		       !ex->stop)
+			pthread_cond_wait(&ex->cond, &ex->lock);
+		__atomic_sub_fetch(&ex->sleepers, 1, __ATOMIC_SEQ_CST);
+
+		if (ex->stop && !__atomic_load_n(&ex->pending,
+						 __ATOMIC_SEQ_CST)) {
+			pthread_mutex_unlock(&ex->lock);
+			break;
+		}
+
+		pthread_mutex_unlock(&ex->lock);
+	}
+
+	return NULL;
+}
+
+static void executor_stop(struct executor *ex, unsigned int nthreads)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&ex->lock);
+	ex->stop = true;
+	pthread_cond_broadcast(&ex->cond);
+	pthread_mutex_unlock(&ex->lock);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(ex->workers[i].thread, NULL);
+}
+
+static void executor_free(struct executor *ex, unsigned int nworkers)
+{
+	unsigned int i, p;
+
+	for (i = 0; i < nworkers; i++) {
+		for (p = 0; p < ex->nprios; p++)
+			deque_destroy(&ex->workers[i].deques[p]);
+	}
+
+	pthread_mutex_destroy(&ex->lock);
+	pthread_cond_destroy(&ex->cond);
+	free(ex->workers);
+	free(ex);
+}
+
+struct executor *executor_new(unsigned int nworkers, unsigned int nprios)
+{
+	struct exec_worker *w;
+	struct executor *ex;
+	unsigned int i, p;
+
+	if (!nworkers || !nprios || nprios > EXEC_MAX_PRIOS)
+		return NULL;
+
+	ex = calloc(1, sizeof(*ex));
+	if (!ex)
+		return NULL;
+
+	ex->workers = calloc(nworkers, sizeof(*ex->workers));
+	if (!ex->workers) {
+		free(ex);
+		return NULL;
+	}
+
+	ex->nworkers = nworkers;
+	ex->nprios = nprios;
+	pthread_mutex_init(&ex->lock, NULL);
+	pthread_cond_init(&ex->cond, NULL);
+
+	for (i = 0; i < nworkers; i++) {
+		w = &ex->workers[i];
+		w->ex = ex;
+		w->id = i;
+		w->victim = (i + 1) % nworkers;
+
+		for (p = 0; p < nprios; p++) {
+			if (deque_init(&w->deques[p]) < 0)
+				goto out_deques;
+		}
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		if (pthread_create(&ex->workers[i].thread, NULL, exec_worker,
+				   &ex->workers[i])) {
+			executor_stop(ex, i);
+			executor_free(ex, nworkers);
+			return NULL;
+		}
+	}
+
+	return ex;
+
+out_deques:
+	while (p--)
+		deque_destroy(&ex->workers[i].deques[p]);
+	executor_free(ex, i);
+	return NULL;
+}
+
+/* The tasks still queued are run before the workers exit */
+void executor_destroy(struct executor *ex)
+{
+	executor_stop(ex, ex->nworkers);
+	executor_free(ex, ex->nworkers);
+}
+
+/* Queue @fn(@arg) in the class @prio, 0 being served first. Tasks
+ * submitted by a worker go to its own deque, the others are spread over
+ * the workers.
+ */
+int executor_submit(struct executor *ex, unsigned int prio, task_fn_t fn,
+		    void *arg, struct task_group *group)
+{
+	struct exec_task task = { .fn = fn, .arg = arg, .group = group };
+	struct exec_worker *w = current;
+	unsigned int i;
+
+	if (prio >= ex->nprios)
+		prio = ex->nprios - 1;
+
+	if (!w || w->ex != ex) {
+		i = __atomic_fetch_add(&ex->next, 1, __ATOMIC_RELAXED);
+		w = &ex->workers[i % ex->nworkers];
+	}
+
+	if (group)
+		__atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+
+	/* counted before being visible, so that it never goes negative */
+	__atomic_add_fetch(&ex->pending, 1, __ATOMIC_SEQ_CST);
+
+	if (deque_push(&w->deques[prio], &task) < 0) {
+		__atomic_sub_fetch(&ex->pending, 1, __ATOMIC_SEQ_CST);
+		if (group)
+			__atomic_sub_fetch(&group->pending, 1,
+					   __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	if (__atomic_load_n(&ex->sleepers, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&ex->lock);
+		pthread_cond_signal(&ex->cond);
+		pthread_mutex_unlock(&ex->lock);
+	}
+
+	return 0;
+}
+
+void task_group_init(struct task_group *group)
+{
+	group->pending = 0;
+	pthread_mutex_init(&group->lock, NULL);
+	pthread_cond_init(&group->done, NULL);
+}
+
+void task_group_destroy(struct task_group *group)
+{
+	pthread_mutex_destroy(&group->lock);
+	pthread_cond_destroy(&group->done);
+}
+
+bool task_group_done(struct task_group *group)
+{
+	return !__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE);
+}
+
+/* Wait for the tasks of @group. A worker keeps running tasks meanwhile,
+ * so that waiting from a task cannot starve the pool.
+ */
+void task_group_wait(struct executor *ex, struct task_group *group)
+{
+	struct exec_worker *w = current;
+
+	if (w && w->ex == ex) {
+		while (!task_group_done(group)) {
+			if (!run_one(ex, w))
+				break;
+		}
+	}
+
+	/* even when done, to wait for task_complete() to release @group */
+	pthread_mutex_lock(&group->lock);
+	while (!task_group_done(group))
+		pthread_cond_wait(&group->done, &group->lock);
+	pthread_mutex_unlock(&group->lock);
+}
@@ -0,0 +1,75 @@
+#ifndef _EXECUTOR_H
+#define _EXECUTOR_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "atomic.h"
+
+/* Work-stealing thread pool. Every worker owns one deque per priority
+ * class: it runs its own tasks newest first and, once they are exhausted,
+ * steals the oldest tasks of the other workers. Lower classes are served
+ * first, by every worker.
+ */
+
+#define EXEC_MAX_PRIOS	8
+
+typedef void (*task_fn_t)(void *arg);
+
+struct task_group;
+
+struct exec_task {
+	task_fn_t fn;
+	void *arg;
+	struct task_group *group;
+};
+
+struct exec_deque {
+	pthread_mutex_t lock;
+	struct exec_task *tasks;
+	unsigned int size; /* power of two */
+	unsigned int head; /* stolen from */
+	unsigned int tail; /* pushed to and popped from by the owner */
+};
+
+struct executor;
+
+struct exec_worker {
+	struct executor *ex;
+	pthread_t thread;
+	unsigned int id;
+	unsigned int victim; /* where to start stealing */
+	struct exec_deque deques[EXEC_MAX_PRIOS];
+} ____cacheline_aligned;
+
+struct executor {
+	struct exec_worker *workers;
+	unsigned int nworkers;
+	unsigned int nprios;
+	unsigned int next; /* worker receiving the next outside submission */
+
+	unsigned long pending; /* queued tasks */
+	unsigned int sleepers;
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Completion tracking of a set of tasks */
+struct task_group {
+	unsigned int pending;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+};
+
+struct executor *executor_new(unsigned int nworkers, unsigned int nprios);
+void executor_destroy(struct executor *ex);
+int executor_submit(struct executor *ex, unsigned int prio, task_fn_t fn,
+		    void *arg, struct task_group *group);
+
+void task_group_init(struct task_group *group);
+void task_group_destroy(struct task_group *group);
+bool task_group_done(struct task_group *group);
+void task_group_wait(struct executor *ex, struct task_group *group);
+
+#endif
@@ -4,6 +4,18 @@
 #include <string.h>
 
 #include "hashmap.h"
+#include "slab.h"
+
+#define ENTRY_CHUNK_OBJS	256
+
+static struct slab *entry_slab;
+static pthread_once_t entry_slab_once = PTHREAD_ONCE_INIT;
+
+static void entry_slab_init(void)
+{
+	entry_slab = slab_new_cached(sizeof(struct hmap_entry),
+				     ENTRY_CHUNK_OBJS);
+}
 
 struct hashmap *hmap_new(unsigned int (*hash)(void *key),
 			 int (*compare)(void *k1, void *k2))
@@ -11,6 +23,10 @@ struct hashmap *hmap_new(unsigned int (*hash)(void *key),
 	struct hashmap *hm;
 	unsigned int i;
 
+	pthread_once(&entry_slab_once, entry_slab_init);
+	if (!entry_slab)
+		return NULL;
+
 	hm = malloc(sizeof(*hm));
 	if (!hm)
 		return NULL;
@@ -105,7 +121,7 @@ int hmap_set(struct hashmap *hm, void *key, void *elem)
 		idx = hmap_hash(hm, key);
 	}
 
-	he = malloc(sizeof(*he));
+	he = slab_alloc(entry_slab);
 	if (!he)
 		return -1;
 
@@ -147,7 +163,7 @@ void hmap_delete(struct hashmap *hm, void *key)
 			llist_remove(&he->map_head);
 			llist_remove(&he->key_head);
 			hm->elems--;
-			free(he);
+			slab_free(entry_slab, he);
 			return;
 		}
 	}
@@ -162,6 +178,6 @@ void hmap_flush(struct hashmap *hm)
 		llist_remove(&he->key_head);
 		llist_remove(&he->map_head);
 		hm->elems--;
-		free(he);
+		slab_free(entry_slab, he);
 	}
 }
@@ -1,7 +1,20 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "llist.h"
+#include "slab.h"
+
+#define NODE_CHUNK_OBJS	256
+
+/* list cells, heads included */
+static struct slab *node_slab;
+static pthread_once_t node_slab_once = PTHREAD_ONCE_INIT;
+
+static void node_slab_init(void)
+{
+	node_slab = slab_new_cached(sizeof(struct llist_node), NODE_CHUNK_OBJS);
+}
 
 static void inc_size(struct llist_node *nhead)
 {
@@ -17,7 +30,11 @@ static struct llist_node *llist_new_node(void *data)
 {
 	struct llist_node *node;
 
-	node = malloc(sizeof(*node));
+	pthread_once(&node_slab_once, node_slab_init);
+	if (!node_slab)
+		return NULL;
+
+	node = slab_alloc(node_slab);
 	if (!node)
 		return NULL;
 
@@ -65,7 +82,7 @@ struct llist_node *llist_node_insert_head(struct llist_node *nhead, void *data)
 void llist_node_remove(struct llist_node *nhead, struct llist_node *node)
 {
 	llist_remove(&node->head);
-	free(node);
+	slab_free(node_slab, node);
 
 	dec_size(nhead);
 }
@@ -107,7 +124,7 @@ void llist_node_flush(struct llist_node *nhead)
 void llist_node_destroy(struct llist_node *nhead)
 {
 	llist_node_flush(nhead);
-	free(nhead);
+	slab_free(node_slab, nhead);
 }
 
 static struct llist_node *__llist_node_copy(struct llist_node *nhead, bool rev)
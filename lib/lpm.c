@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <endian.h>
 
 #include "lpm.h"
 
@@ -42,38 +43,58 @@ static struct lpm_node *lpm_create_node(struct in6_addr *prefix, uint8_t plen,
 	return node;
 }
 
-static void addr_to_binary(struct in6_addr *addr, char *res)
+/* Bits are numbered from the most significant one of the address. */
+
+static inline uint64_t addr_word(const struct in6_addr *addr, int w)
 {
-	int i, j, k = 0;
+	uint64_t word;
 
-	for (i = 0; i < 16; i++) {
-		int val = addr->s6_addr[i];
+	memcpy(&word, &addr->s6_addr[w * 8], sizeof(word));
 
-		for (j = 0; j < 8; j++) {
-			int bit = (val >> (7-j)) & 0x1;
-			res[k++] = bit ? '1' : '0';
-		}
-	}
+	return be64toh(word);
+}
 
-	res[k] = 0;
+static inline int addr_bit(const struct in6_addr *addr, unsigned int bit)
+{
+	return (addr->s6_addr[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* bits [@from, @to) of the 128, restricted to the word @w */
+static inline uint64_t word_mask(unsigned int from, unsigned int to, int w)
+{
+	unsigned int lo = w * 64, hi = lo + 64;
+	uint64_t mask = ~0ULL;
+
+	if (from < lo)
+		from = lo;
+	if (to > hi)
+		to = hi;
+	if (from >= to)
+		return 0;
+
+	if (to < hi)
+		mask &= ~(~0ULL >> (to - lo));
+	if (from > lo)
+		mask &= ~0ULL >> (from - lo);
+
+	return mask;
 }
 
 static bool match_node(struct lpm_node *node, struct in6_addr *addr,
 		       uint8_t cur_plen)
 {
-	char prefix_bin[129], addr_bin[129];
+	int w;
 
 	if (node->plen == 0)
 		return true;
 
-	addr_to_binary(&node->prefix, prefix_bin);
-	addr_to_binary(addr, addr_bin);
-
-	if (memcmp(&prefix_bin[cur_plen], &addr_bin[cur_plen],
-		   node->plen - cur_plen) == 0)
-		return true;
+	for (w = 0; w < 2; w++) {
+		if ((addr_word(&node->prefix, w) ^ addr_word(addr, w)) &
+		    word_mask(cur_plen, node->plen, w))
+			return false;
+	}
 
-	return false;
+	return true;
 }
 
 static struct lpm_node *__lpm_lookup(struct lpm_tree *tree,
@@ -119,6 +140,9 @@ void *lpm_lookup(struct lpm_tree *tree, struct in6_addr *addr)
 {
 	struct lpm_node *node;
 
+	if (tree->mbt)
+		return lpm_mbt_lookup(tree->mbt, addr);
+
 	node = __lpm_lookup(tree, addr, NULL);
 
 	if (node->data == (void *)-1)
@@ -127,6 +151,14 @@ void *lpm_lookup(struct lpm_tree *tree, struct in6_addr *addr)
 	return node->data;
 }
 
+/* Deepest entry matching @addr, or the head of the tree. The other
+ * matching entries are its ancestors holding data.
+ */
+struct lpm_node *lpm_lookup_node(struct lpm_tree *tree, struct in6_addr *addr)
+{
+	return __lpm_lookup(tree, addr, NULL);
+}
+
 static struct lpm_node *__lpm_lookup_exact(struct lpm_tree *tree,
 					   struct in6_addr *prefix,
 					   uint8_t plen,
@@ -172,28 +204,34 @@ static struct lpm_node *__lpm_lookup_exact(struct lpm_tree *tree,
 static uint8_t common_prefix_len(struct in6_addr *p1, struct in6_addr *p2,
 				 uint8_t maxplen)
 {
-	char p1_bin[129];
-	char p2_bin[129];
-	uint8_t i;
+	unsigned int len;
+	uint64_t diff;
 
-	addr_to_binary(p1, p1_bin);
-	addr_to_binary(p2, p2_bin);
-
-	for (i = 0; i < maxplen; i++) {
-		if (p1_bin[i] != p2_bin[i])
-			break;
+	diff = addr_word(p1, 0) ^ addr_word(p2, 0);
+	if (diff) {
+		len = __builtin_clzll(diff);
+	} else {
+		diff = addr_word(p1, 1) ^ addr_word(p2, 1);
+		len = diff ? 64 + __builtin_clzll(diff) : 128;
 	}
 
-	return i;
+	return MIN(len, maxplen);
+}
+
+static void lpm_drop_compiled(struct lpm_tree *tree)
+{
+	lpm_mbt_free(tree->mbt);
+	tree->mbt = NULL;
 }
 
 struct lpm_node *lpm_insert(struct lpm_tree *tree, struct in6_addr *prefix,
 			    uint8_t plen, void *data)
 {
 	struct lpm_node *match, *save, *new_node, *vnode, *child_node;
-	char prefix_bin[129];
 	int child, cplen, child2;
 
+	lpm_drop_compiled(tree);
+
 	match = __lpm_lookup_exact(tree, prefix, plen, &save);
 
 	/* replace existing entry */
@@ -209,8 +247,7 @@ struct lpm_node *lpm_insert(struct lpm_tree *tree, struct in6_addr *prefix,
 		return save;
 	}
 
-	addr_to_binary(prefix, prefix_bin);
-	child = prefix_bin[save->plen] == '0' ? 0 : 1;
+	child = addr_bit(prefix, save->plen);
 	child_node = save->children[child];
 
 	new_node = lpm_create_node(prefix, plen, data);
@@ -225,11 +262,9 @@ struct lpm_node *lpm_insert(struct lpm_tree *tree, struct in6_addr *prefix,
 	cplen = common_prefix_len(&child_node->prefix, prefix, plen);
 	assert(cplen > 0);
 
-	/* get child entry for new node */
-	child2 = prefix_bin[cplen] == '0' ? 0 : 1;
-
 	/* prefix to add fully matches child prefix, insert in place */
 	if (cplen == plen) {
+		child2 = addr_bit(&child_node->prefix, plen);
 		new_node->children[child2] = child_node;
 		child_node->parent = new_node;
 		save->children[child] = new_node;
@@ -239,6 +274,7 @@ struct lpm_node *lpm_insert(struct lpm_tree *tree, struct in6_addr *prefix,
 
 	/* virtual node creation */
 	assert(cplen < plen);
+	child2 = addr_bit(prefix, cplen);
 	vnode = lpm_create_node(prefix, cplen, (void *)-1);
 
 	/* set child entry in vnode for new node and original child node
@@ -361,6 +397,8 @@ void *lpm_delete(struct lpm_tree *tree, struct in6_addr *prefix, uint8_t plen)
 	if (!node)
 		return NULL;
 
+	lpm_drop_compiled(tree);
+
 	return lpm_delete_node(node);
 }
 
@@ -391,9 +429,291 @@ void lpm_destroy(struct lpm_tree *tree)
 	while (head->children[1])
 		lpm_destroy_node(head->children[1]);
 
+	lpm_mbt_free(tree->mbt);
 	free(tree);
 }
 
+#define MBT_STRIDE	8
+#define MBT_FANOUT	(1 << MBT_STRIDE)
+#define MBT_DEPTH	(128 / MBT_STRIDE)
+
+struct mbt_prefix {
+	struct in6_addr addr; /* host bits cleared */
+	uint8_t plen;
+	void *data;
+};
+
+struct mbt_prefixes {
+	struct mbt_prefix *v;
+	size_t count;
+	size_t size;
+};
+
+/* depth of the node holding the entries of a prefix */
+static inline unsigned int mbt_depth(uint8_t plen)
+{
+	return plen ? (plen - 1) / MBT_STRIDE : 0;
+}
+
+static inline bool mbt_test(const uint64_t *bitmap, unsigned int i)
+{
+	return bitmap[i / 64] & (1ULL << (i % 64));
+}
+
+static inline void mbt_set(uint64_t *bitmap, unsigned int i)
+{
+	bitmap[i / 64] |= 1ULL << (i % 64);
+}
+
+/* number of bits set before @i */
+static inline unsigned int mbt_rank(const uint64_t *bitmap, unsigned int i)
+{
+	unsigned int w, rank = 0;
+
+	for (w = 0; w < i / 64; w++)
+		rank += __builtin_popcountll(bitmap[w]);
+
+	if (i % 64)
+		rank += __builtin_popcountll(bitmap[w] << (64 - i % 64));
+
+	return rank;
+}
+
+static int collect_prefixes(struct lpm_node *node, struct mbt_prefixes *p)
+{
+	struct mbt_prefix *e;
+	int i;
+
+	if (!node)
+		return 0;
+
+	if (node->data != (void *)-1 && (node->plen || node->data)) {
+		if (p->count == p->size) {
+			p->size = p->size ? 2 * p->size : 64;
+			e = realloc(p->v, p->size * sizeof(*e));
+			if (!e)
+				return -1;
+			p->v = e;
+		}
+
+		e = &p->v[p->count++];
+		memset(&e->addr, 0, sizeof(e->addr));
+		for (i = 0; i < node->plen / 8; i++)
+			e->addr.s6_addr[i] = node->prefix.s6_addr[i];
+		if (node->plen % 8)
+			e->addr.s6_addr[i] = node->prefix.s6_addr[i] &
+					     (0xff << (8 - node->plen % 8));
+		e->plen = node->plen;
+		e->data = node->data;
+	}
+
+	if (collect_prefixes(node->children[0], p) < 0)
+		return -1;
+
+	return collect_prefixes(node->children[1], p);
+}
+
+static int compare_prefix(const void *a, const void *b)
+{
+	const struct mbt_prefix *p1 = a, *p2 = b;
+	int ret;
+
+	ret = memcmp(&p1->addr, &p2->addr, sizeof(p1->addr));
+	if (ret)
+		return ret;
+
+	return p1->plen - p2->plen;
+}
+
+static int compare_plen(const void *a, const void *b)
+{
+	const struct mbt_prefix *p1 = *(struct mbt_prefix **)a;
+	const struct mbt_prefix *p2 = *(struct mbt_prefix **)b;
+
+	return p1->plen - p2->plen;
+}
+
+static int mbt_reserve(void **array, uint32_t *size, uint32_t count,
+		       size_t elem_size)
+{
+	uint32_t nsize = *size ? *size : 64;
+	void *narray;
+
+	if (count <= *size)
+		return 0;
+
+	while (nsize < count)
+		nsize *= 2;
+
+	narray = realloc(*array, nsize * elem_size);
+	if (!narray)
+		return -1;
+
+	*array = narray;
+	*size = nsize;
+
+	return 0;
+}
+
+/* Fills the node @idx at @depth from the prefixes [@lo, @hi), which share
+ * the bytes of the upper nodes. @inherited is the value of the entries
+ * that no prefix of the range covers.
+ */
+static int mbt_build_node(struct lpm_mbt *mbt, uint32_t idx,
+			  struct mbt_prefix *v, size_t lo, size_t hi,
+			  unsigned int depth, void *inherited,
+			  struct mbt_prefix **tmp)
+{
+	void *values[MBT_FANOUT];
+	struct lpm_mbt_node node;
+	unsigned int i, b, n = 0;
+	uint32_t nchildren = 0;
+	size_t j, k;
+
+	memset(&node, 0, sizeof(node));
+
+	for (i = 0; i < MBT_FANOUT; i++)
+		values[i] = inherited;
+
+	/* the longest prefixes are applied last */
+	for (j = lo; j < hi; j++) {
+		if (mbt_depth(v[j].plen) == depth && v[j].plen > depth * 8)
+			tmp[n++] = &v[j];
+		else if (mbt_depth(v[j].plen) > depth)
+			mbt_set(node.children, v[j].addr.s6_addr[depth]);
+	}
+
+	if (!depth && lo < hi && !v[lo].plen)
+		tmp[n++] = &v[lo];
+
+	qsort(tmp, n, sizeof(*tmp), compare_plen);
+
+	for (i = 0; i < n; i++) {
+		unsigned int span = (depth + 1) * MBT_STRIDE - tmp[i]->plen;
+
+		b = tmp[i]->addr.s6_addr[depth];
+		for (k = 0; k < (1U << span); k++)
+			values[b + k] = tmp[i]->data;
+	}
+
+	if (mbt_reserve((void **)&mbt->leaves, &mbt->leaves_size,
+			mbt->nleaves + MBT_FANOUT, sizeof(void *)) < 0)
+		return -1;
+
+	node.leaf_base = mbt->nleaves;
+	for (i = 0; i < MBT_FANOUT; i++) {
+		if (!i || values[i] != values[i - 1]) {
+			mbt_set(node.leaves, i);
+			mbt->leaves[mbt->nleaves++] = values[i];
+		}
+	}
+
+	for (i = 0; i < 4; i++)
+		nchildren += __builtin_popcountll(node.children[i]);
+
+	if (mbt_reserve((void **)&mbt->nodes, &mbt->nodes_size,
+			mbt->nnodes + nchildren, sizeof(*mbt->nodes)) < 0)
+		return -1;
+
+	node.child_base = mbt->nnodes;
+	mbt->nnodes += nchildren;
+	mbt->nodes[idx] = node;
+
+	/* the prefixes of a child are contiguous, sorted by address */
+	for (j = lo; j < hi; j = k) {
+		b = v[j].addr.s6_addr[depth];
+		for (k = j; k < hi && v[k].addr.s6_addr[depth] == b; k++)
+			;
+
+		if (!mbt_test(node.children, b))
+			continue;
+
+		if (mbt_build_node(mbt, node.child_base +
+				   mbt_rank(node.children, b), v, j, k,
+				   depth + 1, values[b], tmp) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+struct lpm_mbt *lpm_mbt_build(struct lpm_tree *tree)
+{
+	struct mbt_prefixes p = { 0 };
+	struct mbt_prefix **tmp;
+	struct lpm_mbt *mbt;
+
+	mbt = calloc(1, sizeof(*mbt));
+	if (!mbt)
+		return NULL;
+
+	if (collect_prefixes(&tree->head, &p) < 0)
+		goto out_free;
+
+	qsort(p.v, p.count, sizeof(*p.v), compare_prefix);
+
+	tmp = malloc((p.count + 1) * sizeof(*tmp));
+	if (!tmp)
+		goto out_free;
+
+	if (mbt_reserve((void **)&mbt->nodes, &mbt->nodes_size, 1,
+			sizeof(*mbt->nodes)) < 0)
+		goto out_tmp;
+
+	mbt->nnodes = 1;
+	if (mbt_build_node(mbt, 0, p.v, 0, p.count, 0, NULL, tmp) < 0)
+		goto out_tmp;
+
+	free(tmp);
+	free(p.v);
+	return mbt;
+
+out_tmp:
+	free(tmp);
+out_free:
+	free(p.v);
+	lpm_mbt_free(mbt);
+	return NULL;
+}
+
+void *lpm_mbt_lookup(const struct lpm_mbt *mbt, const struct in6_addr *addr)
+{
+	const struct lpm_mbt_node *node = mbt->nodes;
+	unsigned int depth, b;
+
+	for (depth = 0; depth < MBT_DEPTH; depth++) {
+		b = addr->s6_addr[depth];
+
+		if (!mbt_test(node->children, b))
+			break;
+
+		node = &mbt->nodes[node->child_base +
+				   mbt_rank(node->children, b)];
+	}
+
+	return mbt->leaves[node->leaf_base + mbt_rank(node->leaves, b + 1) - 1];
+}
+
+void lpm_mbt_free(struct lpm_mbt *mbt)
+{
+	if (!mbt)
+		return;
+
+	free(mbt->nodes);
+	free(mbt->leaves);
+	free(mbt);
+}
+
+/* Later lookups use a multibit trie, until the next update of @tree */
+int lpm_compile(struct lpm_tree *tree)
+{
+	lpm_drop_compiled(tree);
+
+	tree->mbt = lpm_mbt_build(tree);
+
+	return tree->mbt ? 0 : -1;
+}
+
 void print_node(struct lpm_node *node)
 {
 	char addr[129];
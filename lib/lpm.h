@@ -18,15 +18,46 @@ struct lpm_node {
 	struct lpm_node *children[2];
 };
 
+/* Stride-8 multibit trie compiled from a tree by lpm_compile(), for
+ * lookups only. A node covers one byte of the address. The values of its
+ * 256 entries are stored once per run of equal values, the prefixes
+ * being expanded to the entries they cover: bit i of @leaves is set when
+ * a run starts at entry i, bit i of @children when entry i continues in
+ * a child node. Children and runs are stored contiguously from
+ * @child_base and @leaf_base, the rank of a bit giving their index.
+ */
+struct lpm_mbt_node {
+	uint64_t children[4];
+	uint64_t leaves[4];
+	uint32_t child_base;
+	uint32_t leaf_base;
+};
+
+struct lpm_mbt {
+	struct lpm_mbt_node *nodes;
+	void **leaves;
+	uint32_t nnodes;
+	uint32_t nleaves;
+	uint32_t nodes_size;
+	uint32_t leaves_size;
+};
+
 struct lpm_tree {
 	struct lpm_node head;
+	struct lpm_mbt *mbt; /* dropped by the updates */
 };
 
 struct lpm_tree *lpm_new(void);
 void *lpm_lookup(struct lpm_tree *tree, struct in6_addr *addr);
+struct lpm_node *lpm_lookup_node(struct lpm_tree *tree, struct in6_addr *addr);
 struct lpm_node *lpm_insert(struct lpm_tree *tree, struct in6_addr *prefix,
 			    uint8_t plen, void *data);
 void *lpm_delete(struct lpm_tree *tree, struct in6_addr *prefix, uint8_t plen);
 void lpm_destroy(struct lpm_tree *tree);
+int lpm_compile(struct lpm_tree *tree);
+
+struct lpm_mbt *lpm_mbt_build(struct lpm_tree *tree);
+void *lpm_mbt_lookup(const struct lpm_mbt *mbt, const struct in6_addr *addr);
+void lpm_mbt_free(struct lpm_mbt *mbt);
 
 #endif
@@ -0,0 +1,36 @@
+#include <unistd.h>
+
+#include "rcu.h"
+
+#define RCU_POLL_US	100
+
+void rcu_init(struct rcu *rcu)
+{
+	rcu->epoch = 0;
+	rcu->readers[0] = 0;
+	rcu->readers[1] = 0;
+	pthread_mutex_init(&rcu->lock, NULL);
+}
+
+void rcu_destroy(struct rcu *rcu)
+{
+	pthread_mutex_destroy(&rcu->lock);
+}
+
+/* A single switch is enough since rcu_read_lock() retries when the
+ * epoch changes under it: the readers still counted in the previous
+ * epoch are known to this wait, and the others see the new versions.
+ */
+void synchronize_rcu(struct rcu *rcu)
+{
+	unsigned int idx;
+
+	pthread_mutex_lock(&rcu->lock);
+
+	idx = __atomic_fetch_add(&rcu->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+	while (__atomic_load_n(&rcu->readers[idx], __ATOMIC_SEQ_CST))
+		usleep(RCU_POLL_US);
+
+	pthread_mutex_unlock(&rcu->lock);
+}
@@ -0,0 +1,52 @@
+#ifndef _RCU_H
+#define _RCU_H
+
+#include <pthread.h>
+
+/* Read-copy-update of pointers to read-mostly data. Readers never block:
+ * they are counted in the current epoch. A writer publishes a new
+ * version with rcu_assign_pointer(), then synchronize_rcu() switches the
+ * epoch and waits for the readers of the previous one, after which the
+ * old version can be freed.
+ */
+struct rcu {
+	unsigned long epoch;
+	unsigned long readers[2];
+	pthread_mutex_t lock; /* serializes the writers */
+};
+
+#define rcu_dereference(p)	 __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+void rcu_init(struct rcu *rcu);
+void rcu_destroy(struct rcu *rcu);
+void synchronize_rcu(struct rcu *rcu);
+
+/* Returns the epoch to pass to rcu_read_unlock(). Sections can nest.
+ * A reader counted after synchronize_rcu() switched the epoch would not
+ * be waited for, so it checks that the epoch did not change meanwhile.
+ */
+static inline unsigned int rcu_read_lock(struct rcu *rcu)
+{
+	unsigned long epoch;
+
+	for (;;) {
+		epoch = __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&rcu->readers[epoch & 1], 1,
+				   __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST) == epoch)
+			return epoch & 1;
+
+		/* raced with a writer, retry in the new epoch */
+		__atomic_sub_fetch(&rcu->readers[epoch & 1], 1,
+				   __ATOMIC_SEQ_CST);
+	}
+}
+
+static inline void rcu_read_unlock(struct rcu *rcu, unsigned int idx)
+{
+	__atomic_sub_fetch(&rcu->readers[idx], 1, __ATOMIC_RELEASE);
+}
+
+#endif
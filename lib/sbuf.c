@@ -1,78 +1,200 @@
 #include <stdlib.h>
-#include <pthread.h>
-#include <semaphore.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "sbuf.h"
 
+#define load_acq(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_rel(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static void futex_wait(unsigned int *addr, unsigned int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned int *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Sleepers on a generation counter set its lowest bit, a notifier only
+ * goes to the kernel when it finds the bit set. It then bumps the counter,
+ * clearing the bit, and wakes them all up.
+ */
+static void sbuf_notify(unsigned int *gen)
+{
+	unsigned int g;
+
+	/* order the ring update before the load, pairs with sbuf_wait() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	g = __atomic_load_n(gen, __ATOMIC_RELAXED);
+	while (g & 1) {
+		if (__atomic_compare_exchange_n(gen, &g, (g + 2) & ~1U, false,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			futex_wake(gen);
+			break;
+		}
+	}
+}
+
 struct sbuf *sbuf_new(unsigned long bufsize)
 {
 	struct sbuf *sbuf;
+	unsigned long i;
 
 	sbuf = calloc(1, sizeof(*sbuf));
 	if (!sbuf)
 		return NULL;
 
-	pthread_mutex_init(&sbuf->lock, NULL);
+	/* a single cell could not tell a full ring from an empty one */
+	sbuf->capacity = 2;
+	while (sbuf->capacity < bufsize)
+		sbuf->capacity <<= 1;
+	sbuf->mask = sbuf->capacity - 1;
 
-	sem_init(&sbuf->empty, 0, bufsize);
-	sem_init(&sbuf->full, 0, 0);
+	sbuf->cells = malloc(sbuf->capacity * sizeof(*sbuf->cells));
+	if (!sbuf->cells) {
+		free(sbuf);
+		return NULL;
+	}
 
-	sbuf->capacity = bufsize;
-	sbuf->data = malloc(bufsize * sizeof(void *));
+	for (i = 0; i < sbuf->capacity; i++)
+		sbuf->cells[i].seq = i;
 
 	return sbuf;
 }
 
 void sbuf_destroy(struct sbuf *sbuf)
 {
-	free(sbuf->data);
+	free(sbuf->cells);
 	free(sbuf);
 }
 
-void sbuf_push(struct sbuf *sbuf, void *elem)
+static int __sbuf_trypush(struct sbuf *sbuf, void *elem)
 {
-	sem_wait(&sbuf->empty);
-	pthread_mutex_lock(&sbuf->lock);
-	__sbuf_push(sbuf, elem);
-	pthread_mutex_unlock(&sbuf->lock);
-	sem_post(&sbuf->full);
+	unsigned long pos, seq;
+	struct sbuf_cell *cell;
+	long dif;
+
+	pos = __atomic_load_n(&sbuf->write, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = &sbuf->cells[pos & sbuf->mask];
+		seq = load_acq(&cell->seq);
+		dif = (long)seq - (long)pos;
+
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&sbuf->write, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&sbuf->write, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->data = elem;
+	store_rel(&cell->seq, pos + 1);
+
+	return 0;
+}
+
+static int __sbuf_trypop(struct sbuf *sbuf, void **elem)
+{
+	unsigned long pos, seq;
+	struct sbuf_cell *cell;
+	long dif;
+
+	pos = __atomic_load_n(&sbuf->read, __ATOMIC_RELAXED);
+	for (;;) {
+		cell = &sbuf->cells[pos & sbuf->mask];
+		seq = load_acq(&cell->seq);
+		dif = (long)seq - (long)(pos + 1);
+
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&sbuf->read, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&sbuf->read, __ATOMIC_RELAXED);
+		}
+	}
+
+	*elem = cell->data;
+	store_rel(&cell->seq, pos + sbuf->mask + 1);
+
+	return 0;
 }
 
 int sbuf_trypush(struct sbuf *sbuf, void *elem)
 {
-	if (sem_trywait(&sbuf->empty))
+	if (__sbuf_trypush(sbuf, elem))
 		return -1;
 
-	pthread_mutex_lock(&sbuf->lock);
-	__sbuf_push(sbuf, elem);
-	pthread_mutex_unlock(&sbuf->lock);
-	sem_post(&sbuf->full);
-
+	sbuf_notify(&sbuf->pushed);
 	return 0;
 }
 
-void *sbuf_pop(struct sbuf *sbuf)
+int sbuf_trypop(struct sbuf *sbuf, void **elem)
 {
-	void *elem;
+	if (__sbuf_trypop(sbuf, elem))
+		return -1;
 
-	sem_wait(&sbuf->full);
-	pthread_mutex_lock(&sbuf->lock);
-	elem = __sbuf_pop(sbuf);
-	pthread_mutex_unlock(&sbuf->lock);
-	sem_post(&sbuf->empty);
+	sbuf_notify(&sbuf->popped);
+	return 0;
+}
 
-	return elem;
+/* Sleep until @gen moves, unless @retry succeeds once the waiting bit is
+ * set. A notifier either sees the bit, or updated the ring before the
+ * retry. Evaluates to 0 when @retry succeeded.
+ */
+#define sbuf_wait(gen, retry) ({						\
+	unsigned int __g = __atomic_load_n(gen, __ATOMIC_RELAXED);	\
+	int __ret = -1;							\
+									\
+	if ((__g & 1) ||						\
+	    __atomic_compare_exchange_n(gen, &__g, __g | 1, false,	\
+					__ATOMIC_RELAXED,		\
+					__ATOMIC_RELAXED)) {		\
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);		\
+		__ret = (retry);					\
+		if (__ret)						\
+			futex_wait(gen, __g | 1);			\
+	}								\
+	__ret;								\
+})
+
+void sbuf_push(struct sbuf *sbuf, void *elem)
+{
+	while (__sbuf_trypush(sbuf, elem)) {
+		if (!sbuf_wait(&sbuf->popped, __sbuf_trypush(sbuf, elem)))
+			break;
+	}
+
+	sbuf_notify(&sbuf->pushed);
 }
 
-int sbuf_trypop(struct sbuf *sbuf, void **elem)
+void *sbuf_pop(struct sbuf *sbuf)
 {
-	if (sem_trywait(&sbuf->full))
-		return -1;
+	void *elem;
 
-	pthread_mutex_lock(&sbuf->lock);
-	*elem = __sbuf_pop(sbuf);
-	pthread_mutex_unlock(&sbuf->lock);
-	sem_post(&sbuf->empty);
+	while (__sbuf_trypop(sbuf, &elem)) {
+		if (!sbuf_wait(&sbuf->pushed, __sbuf_trypop(sbuf, &elem)))
+			break;
+	}
 
-	return 0;
+	sbuf_notify(&sbuf->popped);
+
+	return elem;
 }
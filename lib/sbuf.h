@@ -1,25 +1,36 @@
 #ifndef _SBUF_H
 #define _SBUF_H
 
-#include <pthread.h>
-#include <semaphore.h>
+#include "atomic.h"
+
+/* Bounded multi-producer multi-consumer ring (D. Vyukov's algorithm).
+ *
+ * Each cell carries a sequence number telling whether it is ready to be
+ * written or read at a given position, so that producers and consumers
+ * only contend on a compare-and-swap of their own position. The blocking
+ * variants sleep on a futex only when the ring is full or empty.
+ */
+
+struct sbuf_cell {
+	unsigned long seq;
+	void *data;
+};
 
 struct sbuf {
-	pthread_mutex_t lock;
-	sem_t empty;
-	sem_t full;
-	void **data;
+	struct sbuf_cell *cells;
 	unsigned long capacity;
-	unsigned long read;
-	unsigned long write;
-};
+	unsigned long mask;
+
+	unsigned long write ____cacheline_aligned;
+	unsigned long read ____cacheline_aligned;
 
-#define __sbuf_mask(q, v)	((v) & ((q)->capacity - 1))
-#define __sbuf_push(q, v)	((q)->data[__sbuf_mask(q, (q)->write++)] = (v))
-#define __sbuf_pop(q)		((q)->data[__sbuf_mask(q, (q)->read++)])
-#define __sbuf_empty(q)		((q)->read == (q)->write)
-#define __sbuf_full(q)		(__sbuf_size(q) == (q)->capacity)
-#define __sbuf_size(q)		((q)->write - (q)->read)
+	/* futex words waited on by the consumers (resp. producers) that
+	 * found the ring empty (resp. full), bumped by a push (resp. pop)
+	 * when someone sleeps
+	 */
+	unsigned int pushed ____cacheline_aligned;
+	unsigned int popped ____cacheline_aligned;
+};
 
 struct sbuf *sbuf_new(unsigned long bufsize);
 void sbuf_destroy(struct sbuf *sbuf);
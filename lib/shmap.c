@@ -0,0 +1,75 @@
+#include <stdlib.h>
+
+#include "shmap.h"
+
+/* @nshards is rounded up to a power of two */
+struct shmap *shmap_new(unsigned int nshards,
+			unsigned int (*hash)(void *key),
+			int (*compare)(void *k1, void *k2))
+{
+	unsigned int i, bits = 0;
+	struct shmap *sm;
+
+	while ((1U << bits) < nshards && bits < 16)
+		bits++;
+
+	sm = malloc(sizeof(*sm));
+	if (!sm)
+		return NULL;
+
+	sm->nshards = 1U << bits;
+	sm->shift = 32 - bits;
+	sm->hash = hash;
+
+	sm->shards = calloc(sm->nshards, sizeof(*sm->shards));
+	if (!sm->shards)
+		goto out_free;
+
+	for (i = 0; i < sm->nshards; i++) {
+		sm->shards[i] = hmap_new(hash, compare);
+		if (!sm->shards[i])
+			goto out_shards;
+	}
+
+	return sm;
+
+out_shards:
+	while (i--)
+		hmap_destroy(sm->shards[i]);
+	free(sm->shards);
+out_free:
+	free(sm);
+	return NULL;
+}
+
+void shmap_destroy(struct shmap *sm)
+{
+	unsigned int i;
+
+	for (i = 0; i < sm->nshards; i++)
+		hmap_destroy(sm->shards[i]);
+
+	free(sm->shards);
+	free(sm);
+}
+
+int shmap_set(struct shmap *sm, void *key, void *elem)
+{
+	struct hashmap *hm = shmap_shard(sm, key);
+	int ret;
+
+	hmap_write_lock(hm);
+	ret = hmap_set(hm, key, elem);
+	hmap_unlock(hm);
+
+	return ret;
+}
+
+void shmap_delete(struct shmap *sm, void *key)
+{
+	struct hashmap *hm = shmap_shard(sm, key);
+
+	hmap_write_lock(hm);
+	hmap_delete(hm, key);
+	hmap_unlock(hm);
+}
@@ -0,0 +1,48 @@
+#ifndef _SHMAP_H
+#define _SHMAP_H
+
+#include "hashmap.h"
+
+/* Hashmap split in shards, each with its own lock, so that threads
+ * touching different keys do not contend. A key always lands in the
+ * shard given by the high bits of its hash, the shard's hashmap using
+ * the low bits.
+ *
+ * shmap_set() and shmap_delete() lock the shard of the key. Scans go
+ * through the shards with shmap_foreach_shard() and lock them one at a
+ * time, leaving the others to the writers:
+ *
+ *	shmap_foreach_shard(sm, i, hm) {
+ *		hmap_read_lock(hm);
+ *		hmap_foreach(hm, he)
+ *			...
+ *		hmap_unlock(hm);
+ *	}
+ */
+struct shmap {
+	unsigned int nshards; /* power of two */
+	unsigned int shift;
+	unsigned int (*hash)(void *key);
+	struct hashmap **shards;
+};
+
+#define shmap_foreach_shard(sm, i, hm)				\
+	for ((i) = 0; (i) < (sm)->nshards && ((hm) = (sm)->shards[i], 1); \
+	     (i)++)
+
+struct shmap *shmap_new(unsigned int nshards,
+			unsigned int (*hash)(void *key),
+			int (*compare)(void *k1, void *k2));
+void shmap_destroy(struct shmap *sm);
+int shmap_set(struct shmap *sm, void *key, void *elem);
+void shmap_delete(struct shmap *sm, void *key);
+
+static inline struct hashmap *shmap_shard(struct shmap *sm, void *key)
+{
+	if (sm->nshards == 1)
+		return sm->shards[0];
+
+	return sm->shards[sm->hash(key) >> sm->shift];
+}
+
+#endif
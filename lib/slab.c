@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "slab.h"
+
+#define SLAB_ALIGN	sizeof(void *)
+#define CHUNK_HDR	(2 * sizeof(void *))
+
+struct slab_cache {
+	unsigned long gen; /* of the slab the objects belong to */
+	void *free;
+	unsigned int count;
+};
+
+static __thread struct slab_cache caches[SLAB_CACHES];
+
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int caches_used;
+static unsigned long caches_gen;
+
+struct slab *slab_new(size_t obj_size, unsigned int chunk_objs)
+{
+	struct slab *slab;
+
+	slab = calloc(1, sizeof(*slab));
+	if (!slab)
+		return NULL;
+
+	if (obj_size < sizeof(void *))
+		obj_size = sizeof(void *);
+
+	slab->obj_size = (obj_size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+	slab->chunk_objs = chunk_objs ? chunk_objs : SLAB_DEFAULT_OBJS;
+	slab->cache = -1;
+	pthread_mutex_init(&slab->lock, NULL);
+
+	return slab;
+}
+
+/* Without a free slot of per-thread caches, the slab works uncached */
+struct slab *slab_new_cached(size_t obj_size, unsigned int chunk_objs)
+{
+	struct slab *slab;
+	int i;
+
+	slab = slab_new(obj_size, chunk_objs);
+	if (!slab)
+		return NULL;
+
+	pthread_mutex_lock(&caches_lock);
+	for (i = 0; i < SLAB_CACHES; i++) {
+		if (!(caches_used & (1U << i))) {
+			caches_used |= 1U << i;
+			slab->cache = i;
+			slab->gen = ++caches_gen;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&caches_lock);
+
+	return slab;
+}
+
+/* The cache of the calling thread, emptied if it holds the objects of a
+ * destroyed slab that had the same slot.
+ */
+static struct slab_cache *thread_cache(struct slab *slab)
+{
+	struct slab_cache *c;
+
+	if (slab->cache < 0)
+		return NULL;
+
+	c = &caches[slab->cache];
+	if (c->gen != slab->gen) {
+		c->gen = slab->gen;
+		c->free = NULL;
+		c->count = 0;
+	}
+
+	return c;
+}
+
+/* @dtor is called on each object of the free list, e.g. to release the
+ * buffers that the objects keep across allocations.
+ */
+void slab_destroy(struct slab *slab, void (*dtor)(void *))
+{
+	void *obj, *chunk, *next;
+
+	if (dtor) {
+		for (obj = slab->free; obj; obj = next) {
+			next = *(void **)obj;
+			dtor(obj);
+		}
+	}
+
+	for (chunk = slab->chunks; chunk; chunk = next) {
+		next = *(void **)chunk;
+		free(chunk);
+	}
+
+	if (slab->cache >= 0) {
+		pthread_mutex_lock(&caches_lock);
+		caches_used &= ~(1U << slab->cache);
+		pthread_mutex_unlock(&caches_lock);
+	}
+
+	pthread_mutex_destroy(&slab->lock);
+	free(slab);
+}
+
+static int slab_grow(struct slab *slab)
+{
+	unsigned char *chunk, *obj;
+	unsigned int i;
+
+	/* objects start zeroed, users may keep state across allocations */
+	chunk = calloc(1, CHUNK_HDR + slab->chunk_objs * slab->obj_size);
+	if (!chunk)
+		return -1;
+
+	*(void **)chunk = slab->chunks;
+	slab->chunks = chunk;
+
+	obj = chunk + CHUNK_HDR;
+	for (i = 0; i < slab->chunk_objs; i++, obj += slab->obj_size) {
+		*(void **)obj = slab->free;
+		slab->free = obj;
+	}
+
+	slab->nobjs += slab->chunk_objs;
+	slab->nfree += slab->chunk_objs;
+
+	return 0;
+}
+
+static void cache_refill(struct slab *slab, struct slab_cache *c)
+{
+	void *obj;
+
+	pthread_mutex_lock(&slab->lock);
+
+	while (c->count < SLAB_BATCH) {
+		if (!slab->free && slab_grow(slab) < 0)
+			break;
+
+		obj = slab->free;
+		slab->free = *(void **)obj;
+		slab->nfree--;
+
+		*(void **)obj = c->free;
+		c->free = obj;
+		c->count++;
+	}
+
+	pthread_mutex_unlock(&slab->lock);
+}
+
+static void cache_drain(struct slab *slab, struct slab_cache *c)
+{
+	void *head, *tail;
+	unsigned int i;
+
+	head = tail = c->free;
+	for (i = 1; i < SLAB_BATCH; i++)
+		tail = *(void **)tail;
+
+	c->free = *(void **)tail;
+	c->count -= SLAB_BATCH;
+
+	pthread_mutex_lock(&slab->lock);
+	*(void **)tail = slab->free;
+	slab->free = head;
+	slab->nfree += SLAB_BATCH;
+	pthread_mutex_unlock(&slab->lock);
+}
+
+void *slab_alloc(struct slab *slab)
+{
+	struct slab_cache *c;
+	void *obj = NULL;
+
+	c = thread_cache(slab);
+	if (c) {
+		if (!c->free)
+			cache_refill(slab, c);
+
+		obj = c->free;
+		if (obj) {
+			c->free = *(void **)obj;
+			c->count--;
+		}
+
+		return obj;
+	}
+
+	pthread_mutex_lock(&slab->lock);
+
+	if (!slab->free && slab_grow(slab) < 0)
+		goto out_unlock;
+
+	obj = slab->free;
+	slab->free = *(void **)obj;
+	slab->nfree--;
+
+out_unlock:
+	pthread_mutex_unlock(&slab->lock);
+	return obj;
+}
+
+void slab_free(struct slab *slab, void *obj)
+{
+	struct slab_cache *c;
+
+	c = thread_cache(slab);
+	if (c) {
+		*(void **)obj = c->free;
+		c->free = obj;
+		if (++c->count > 2 * SLAB_BATCH)
+			cache_drain(slab, c);
+		return;
+	}
+
+	pthread_mutex_lock(&slab->lock);
+	*(void **)obj = slab->free;
+	slab->free = obj;
+	slab->nfree++;
+	pthread_mutex_unlock(&slab->lock);
+}
@@ -0,0 +1,39 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define SLAB_DEFAULT_OBJS	64
+#define SLAB_CACHES		16	/* slabs with per-thread caches */
+#define SLAB_BATCH		32
+
+/* Pool of fixed-size objects carved from larger chunks. Freed objects are
+ * kept on a free list and handed out again, memory is only returned to
+ * the system by slab_destroy().
+ *
+ * The slabs from slab_new_cached() also keep up to 2 * SLAB_BATCH free
+ * objects per thread, exchanged with the shared free list SLAB_BATCH at
+ * a time, so that most allocations and frees take no lock. The objects
+ * cached by a thread that exits are lost until slab_destroy(), which
+ * does not pass them to its destructor.
+ */
+struct slab {
+	size_t obj_size;
+	unsigned int chunk_objs;
+	pthread_mutex_t lock;
+	void *free;	/* free objects, linked through their first word */
+	void *chunks;	/* allocated chunks, linked through their first word */
+	size_t nobjs;
+	size_t nfree;	/* on the shared free list */
+	int cache;	/* slot of the per-thread caches, -1 if none */
+	unsigned long gen;
+};
+
+struct slab *slab_new(size_t obj_size, unsigned int chunk_objs);
+struct slab *slab_new_cached(size_t obj_size, unsigned int chunk_objs);
+void slab_destroy(struct slab *slab, void (*dtor)(void *));
+void *slab_alloc(struct slab *slab);
+void slab_free(struct slab *slab, void *obj);
+
+#endif
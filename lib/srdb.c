@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <poll.h>
@@ -15,17 +16,25 @@
 #include "srdb.h"
 #include "misc.h"
 #include "llist.h"
+#include "hashmap.h"
+#include "srdb_cache.h"
+#include "slab.h"
+#include "srdb_mem.h"
 
 #define BUFLEN 1024
 #define JSON_BUFLEN 4096
 #define JSON_BUFLEN_MONMAX (8*1024*1024)
 #define READ_OVSDB_SERVER(b, addr, port) sscanf(b, "tcp:[%[^]]]:%hu", addr, port)
+#define OVSDB_UNIX_PREFIX "unix:"
 #define BOOL_TO_STR(boolean) ((boolean) ? "true" : "false")
 
 static int (*srdb_err) (const char *, ...);
 
-static void *transaction_worker(void *args);
+static const struct srdb_backend ovsdb_backend;
 static int srdb_read(const char *uuid, json_t *json, struct srdb_table *tbl);
+static int mon_batch_add(struct monitor_desc *desc, const char *uuid,
+			 json_t *json);
+static int mon_batch_flush(struct monitor_desc *desc);
 
 static int echo_reply(int fd)
 {
@@ -34,27 +43,312 @@ static int echo_reply(int fd)
 	return send(fd, reply, sizeof(reply) - 1, 0);
 }
 
-static void wakeup_tr_workers(struct srdb *srdb)
+/* Hand the queued transaction to a single idle worker. Busy workers pick
+ * up the queue by themselves once their pending result arrives.
+ */
+static void wakeup_tr_worker(struct srdb *srdb)
 {
+	int n = srdb->conf->ntransacts;
+	struct tr_thread *thread;
 	uint64_t event = 1;
-	int i;
+	bool idle;
+	int i, start;
 
-	for (i = 0; i < srdb->conf->ntransacts; i++) {
-		if (write(srdb->tr_workers[i].event_fd, &event, sizeof(event))
+	start = __atomic_fetch_add(&srdb->tr_next, 1, __ATOMIC_RELAXED) % n;
+
+	for (i = 0; i < n; i++) {
+		thread = &srdb->tr_workers[(start + i) % n];
+		idle = true;
+		if (!__atomic_compare_exchange_n(&thread->idle, &idle, false,
+						 false, __ATOMIC_SEQ_CST,
+						 __ATOMIC_SEQ_CST))
+			continue;
+
+		if (write(thread->event_fd, &event, sizeof(event))
 		    != sizeof(event))
-			srdb_err("failed to warn the transaction workers.");
+			srdb_err("failed to warn a transaction worker.");
+		return;
 	}
 }
 
-static int parse_ovsdb_update_tables(json_t *table_updates,
-				     struct srdb_table *tbl)
+struct mon_row {
+	char uuid[SLEN + 1];
+	json_t *row;
+	unsigned int generation;
+};
+
+static struct mon_row *mon_row_get(struct monitor_desc *desc, const char *uuid)
+{
+	return hmap_get(desc->rows, (void *)uuid);
+}
+
+static struct mon_row *mon_row_set(struct monitor_desc *desc, const char *uuid,
+				   json_t *row)
+{
+	struct mon_row *r;
+
+	r = mon_row_get(desc, uuid);
+	if (r) {
+		json_decref(r->row);
+	} else {
+		r = malloc(sizeof(*r));
+		if (!r)
+			return NULL;
+
+		strncpy(r->uuid, uuid, SLEN);
+		r->uuid[SLEN] = 0;
+
+		if (hmap_set(desc->rows, r->uuid, r) < 0) {
+			free(r);
+			return NULL;
+		}
+	}
+
+	r->row = json_incref(row);
+	r->generation = desc->generation;
+
+	return r;
+}
+
+static void mon_row_delete(struct monitor_desc *desc, struct mon_row *r)
+{
+	hmap_delete(desc->rows, r->uuid);
+	json_decref(r->row);
+	free(r);
+}
+
+static void mon_rows_destroy(struct monitor_desc *desc)
+{
+	struct hmap_entry *he, *tmp;
+	struct mon_row *r;
+
+	hmap_foreach_safe(desc->rows, he, tmp) {
+		r = he->elem;
+		json_decref(r->row);
+		free(r);
+	}
+
+	hmap_destroy(desc->rows);
+	desc->rows = NULL;
+}
+
+/* Forward a row change to the table cache and, if the operation was
+ * requested in mon_flags, to srdb_read().
+ */
+static int mon_dispatch(struct monitor_desc *desc, int flag, const char *uuid,
+			json_t *modification)
+{
+	struct srdb_table *tbl = desc->tbl;
+
+	if (tbl->cache)
+		srdb_cache_apply(tbl->cache, uuid, modification);
+
+	if (!(desc->mon_flags & flag))
+		return 0;
+
+	/* rows sent again by a legacy monitor after a reconnection */
+	if (flag == MON_INITIAL && desc->synced)
+		return 0;
+
+	if (tbl->cb_batch)
+		return mon_batch_add(desc, uuid, modification);
+
+	return srdb_read(uuid, modification, tbl);
+}
+
+/* Build a row change with the "new"/"old" layout of the monitor updates */
+static int mon_deliver(struct monitor_desc *desc, int flag, const char *uuid,
+		       json_t *new, json_t *old)
 {
 	json_t *modification;
+	int ret;
+
+	if (!(desc->mon_flags & flag) && !desc->tbl->cache)
+		return 0;
+
+	modification = json_object();
+	if (!modification)
+		return -1;
+
+	if (new)
+		json_object_set(modification, "new", new);
+	if (old)
+		json_object_set(modification, "old", old);
+
+	ret = mon_dispatch(desc, flag, uuid, modification);
+
+	json_decref(modification);
+	return ret;
+}
+
+/* "initial" rows are either the first contents of the table or, after a
+ * reconnection for which the server lost our transaction id, the full
+ * table to compare with the local copy.
+ */
+static int mon_apply_initial(struct monitor_desc *desc, const char *uuid,
+			     json_t *row)
+{
+	json_t *old, *column_value;
+	const char *column;
+	struct mon_row *r;
+	int ret;
+
+	r = mon_row_get(desc, uuid);
+	if (!r) {
+		if (!mon_row_set(desc, uuid, row))
+			return -1;
+
+		return mon_deliver(desc, desc->synced ? MON_INSERT : MON_INITIAL,
+				   uuid, row, NULL);
+	}
+
+	if (json_equal(r->row, row)) {
+		r->generation = desc->generation;
+		return 0;
+	}
+
+	old = json_object();
+	json_object_foreach(r->row, column, column_value) {
+		if (!json_equal(column_value, json_object_get(row, column)))
+			json_object_set(old, column, column_value);
+	}
+
+	mon_row_set(desc, uuid, row);
+	ret = mon_deliver(desc, MON_UPDATE, uuid, row, old);
+
+	json_decref(old);
+	return ret;
+}
+
+static int mon_apply_modify(struct monitor_desc *desc, const char *uuid,
+			    json_t *diff)
+{
+	json_t *old, *column_value, *old_value;
+	const char *column;
+	struct mon_row *r;
+	int ret;
+
+	r = mon_row_get(desc, uuid);
+	if (!r) {
+		srdb_err("modification of unknown row %s in table %s.", uuid,
+			 desc->tbl->name);
+		return -1;
+	}
+
+	old = json_object();
+	json_object_foreach(diff, column, column_value) {
+		old_value = json_object_get(r->row, column);
+		if (old_value)
+			json_object_set(old, column, old_value);
+		json_object_set(r->row, column, column_value);
+	}
+
+	ret = mon_deliver(desc, MON_UPDATE, uuid, r->row, old);
+
+	json_decref(old);
+	return ret;
+}
+
+static int mon_apply_delete(struct monitor_desc *desc, const char *uuid,
+			    json_t *row)
+{
+	struct mon_row *r;
+	int ret;
+
+	r = mon_row_get(desc, uuid);
+	if (!r)
+		return json_is_object(row) ?
+		       mon_deliver(desc, MON_DELETE, uuid, NULL, row) : 0;
+
+	ret = mon_deliver(desc, MON_DELETE, uuid, NULL, r->row);
+	mon_row_delete(desc, r);
+
+	return ret;
+}
+
+static int parse_ovsdb_update2_tables(json_t *table_updates,
+				      struct monitor_desc *desc)
+{
+	json_t *row_update, *value;
+	const char *uuid, *op;
+	int err, ret = 0;
+
+	/* keep applying the changes after a failure so that the local copy
+	 * of the table stays consistent with the server
+	 */
+	json_object_foreach(table_updates, uuid, row_update) {
+		json_object_foreach(row_update, op, value) {
+			if (!strcmp(op, "initial")) {
+				err = mon_apply_initial(desc, uuid, value);
+			} else if (!strcmp(op, "insert")) {
+				if (!mon_row_set(desc, uuid, value))
+					err = -1;
+				else
+					err = mon_deliver(desc, MON_INSERT, uuid,
+							  value, NULL);
+			} else if (!strcmp(op, "modify")) {
+				err = mon_apply_modify(desc, uuid, value);
+			} else if (!strcmp(op, "delete")) {
+				err = mon_apply_delete(desc, uuid, value);
+			} else {
+				srdb_err("unknown row update `%s'.", op);
+				err = -1;
+			}
+
+			if (err && !ret)
+				ret = err;
+		}
+	}
+
+	return ret;
+}
+
+/* drop the rows that were not part of the last full resynchronisation */
+static void mon_rows_sweep(struct monitor_desc *desc)
+{
+	struct hmap_entry *he, *tmp;
+	struct mon_row *r;
+
+	hmap_foreach_safe(desc->rows, he, tmp) {
+		r = he->elem;
+		if (r->generation == desc->generation)
+			continue;
+
+		mon_deliver(desc, MON_DELETE, r->uuid, NULL, r->row);
+		mon_row_delete(desc, r);
+	}
+}
+
+static void mon_set_txn_id(struct monitor_desc *desc, json_t *txn_id)
+{
+	if (!json_is_string(txn_id))
+		return;
+
+	strncpy(desc->last_txn_id, json_string_value(txn_id), SLEN);
+	desc->last_txn_id[SLEN] = 0;
+}
+
+static int parse_ovsdb_update_tables(json_t *table_updates,
+				     struct monitor_desc *desc, bool initial)
+{
+	json_t *modification, *new, *old;
 	const char *uuid;
-	int ret = 0;
+	int flag, ret = 0;
 
 	json_object_foreach(table_updates, uuid, modification) {
-		if ((ret = srdb_read(uuid, modification, tbl))) {
+		new = json_object_get(modification, "new");
+		old = json_object_get(modification, "old");
+
+		if (initial)
+			flag = MON_INITIAL;
+		else if (new && old)
+			flag = MON_UPDATE;
+		else if (new)
+			flag = MON_INSERT;
+		else
+			flag = MON_DELETE;
+
+		if ((ret = mon_dispatch(desc, flag, uuid, modification))) {
 			break;
 		}
 	}
@@ -62,8 +356,9 @@ static int parse_ovsdb_update_tables(json_t *table_updates,
 }
 
 static int parse_ovsdb_monitor_reply(json_t *monitor_reply,
-				     struct srdb_table *tbl)
+				     struct monitor_desc *desc)
 {
+	struct srdb_table *tbl = desc->tbl;
 	int ret = 0;
 
 	if (!json_is_null(json_object_get(monitor_reply, "error"))) {
@@ -79,16 +374,48 @@ static int parse_ovsdb_monitor_reply(json_t *monitor_reply,
 	}
 	json_t *table_updates = json_object_get(updates, tbl->name);
 	if (table_updates)
-		ret = parse_ovsdb_update_tables(table_updates, tbl);
+		ret = parse_ovsdb_update_tables(table_updates, desc, true);
 
-	sem_post(&tbl->initial_read);
+	return ret;
+}
+
+/* result: [<found>, <last-txn-id>, <table-updates2>] */
+static int parse_ovsdb_monitor_cond_since_reply(json_t *monitor_reply,
+						struct monitor_desc *desc)
+{
+	json_t *result, *found, *updates, *table_updates;
+	int ret = 0;
+
+	result = json_object_get(monitor_reply, "result");
+	found = json_array_get(result, 0);
+	if (!json_is_boolean(found)) {
+		srdb_err("Monitor reply parsing issue: No result found\n");
+		return -1;
+	}
+
+	/* the server does not know our last transaction, it sends the whole
+	 * table again and the local copy is used to compute the delta.
+	 */
+	if (!json_is_true(found))
+		desc->generation++;
+
+	updates = json_array_get(result, 2);
+	table_updates = json_object_get(updates, desc->tbl->name);
+	if (table_updates)
+		ret = parse_ovsdb_update2_tables(table_updates, desc);
+
+	if (!json_is_true(found))
+		mon_rows_sweep(desc);
+
+	mon_set_txn_id(desc, json_array_get(result, 1));
 
 	return ret;
 }
 
-static int parse_ovsdb_update(json_t *update, struct srdb_table *tbl)
+static int parse_ovsdb_update(json_t *update, struct monitor_desc *desc)
 {
 	json_t *params, *updates, *table_updates;
+	struct srdb_table *tbl = desc->tbl;
 
 	params = json_object_get(update, "params");
 	if (!params) {
@@ -113,30 +440,99 @@ static int parse_ovsdb_update(json_t *update, struct srdb_table *tbl)
 		return -1;
 	}
 
-	return parse_ovsdb_update_tables(table_updates, tbl);
+	return parse_ovsdb_update_tables(table_updates, desc, false);
 }
 
-static bool is_echo(json_t *msg)
+/* params: [<json-value>, <last-txn-id>, <table-updates2>] */
+static int parse_ovsdb_update3(json_t *update, struct monitor_desc *desc)
+{
+	json_t *params, *updates, *table_updates;
+	int ret;
+
+	params = json_object_get(update, "params");
+	if (!params) {
+		srdb_err("no params object in json.");
+		return -1;
+	}
+
+	if (json_array_size(params) < 3) {
+		srdb_err("params object has invalid array size.");
+		return -1;
+	}
+
+	updates = json_array_get(params, 2);
+	table_updates = json_object_get(updates, desc->tbl->name);
+	if (!table_updates) {
+		srdb_err("cannot fetch updates for table %s.", desc->tbl->name);
+		return -1;
+	}
+
+	ret = parse_ovsdb_update2_tables(table_updates, desc);
+
+	mon_set_txn_id(desc, json_array_get(params, 1));
+
+	return ret;
+}
+
+static bool is_method(json_t *msg, const char *name)
 {
 	json_t *method = json_object_get(msg, "method");
 
 	if (!method || !json_is_string(method))
 		return false;
 
-	if (!strcmp(json_string_value(method), "echo"))
+	if (!strcmp(json_string_value(method), name))
 		return true;
 
 	return false;
 }
 
-static int ovsdb_socket(const struct ovsdb_config *conf)
+static bool is_echo(json_t *msg)
+{
+	return is_method(msg, "echo");
+}
+
+static int ovsdb_unix_socket(const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		srdb_err("unix socket path too long: %s", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		srdb_err("%s: socket", strerror(errno));
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		srdb_err("%s: connect to ovsdb server", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int ovsdb_tcp_socket(const char *spec)
 {
 	int fd = -1;
 	char str_addr[BUFLEN+1];
 	unsigned short port;
 	int err = 0;
 
-	READ_OVSDB_SERVER(conf->ovsdb_server, str_addr, &port);
+	if (READ_OVSDB_SERVER(spec, str_addr, &port) != 2) {
+		srdb_err("invalid ovsdb server specification: %s", spec);
+		return -1;
+	}
+
 	struct sockaddr_in6 addr = {
 		.sin6_family = AF_INET6,
 		.sin6_port = htons(port),
@@ -169,28 +565,113 @@ close_fd:
 	goto out;
 }
 
-static void *ovsdb_monitor(void *_args)
+/* "unix:<path>" for a colocated server, "tcp:[<addr>]:<port>" otherwise */
+static int ovsdb_socket(const struct ovsdb_config *conf)
+{
+	if (!strncmp(conf->ovsdb_server, OVSDB_UNIX_PREFIX,
+		     strlen(OVSDB_UNIX_PREFIX)))
+		return ovsdb_unix_socket(conf->ovsdb_server +
+					 strlen(OVSDB_UNIX_PREFIX));
+
+	return ovsdb_tcp_socket(conf->ovsdb_server);
+}
+
+static int send_monitor_request(struct monitor_desc *desc, int fd)
+{
+	struct srdb *srdb = desc->srdb;
+	struct srdb_table *tbl = desc->tbl;
+	int mon_flags = desc->mon_flags;
+	char buf[JSON_BUFLEN];
+	size_t len;
+
+	if (desc->legacy) {
+		/* without transaction id, the server would send again the
+		 * rows that were already processed before the connection loss.
+		 * The cache needs every operation and is rebuilt from scratch.
+		 */
+		if (tbl->cache) {
+			mon_flags = MON_ALL;
+			if (desc->synced)
+				srdb_cache_flush(tbl->cache);
+		} else if (desc->synced) {
+			mon_flags &= ~(MON_INITIAL);
+		}
+
+		len = snprintf(buf, JSON_BUFLEN, OVSDB_MONITOR_FORMAT,
+			       srdb->conf->ovsdb_database, tbl->name,
+			       BOOL_TO_STR(mon_flags & MON_UPDATE),
+			       BOOL_TO_STR(mon_flags & MON_INITIAL),
+			       BOOL_TO_STR(mon_flags & MON_INSERT),
+			       BOOL_TO_STR(mon_flags & MON_DELETE));
+	} else {
+		len = snprintf(buf, JSON_BUFLEN, OVSDB_MONITOR_COND_SINCE_FORMAT,
+			       srdb->conf->ovsdb_database, tbl->name, tbl->name,
+			       desc->last_txn_id);
+	}
+
+	if (send(fd, buf, len, 0) < 0) {
+		srdb_err("failed to send monitor request (%s).", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void process_monitor_reply(struct monitor_desc *desc, int fd,
+				  json_t *json)
+{
+	json_t *error;
+	char *err;
+	int ret;
+
+	error = json_object_get(json, "error");
+
+	if (!desc->legacy && error && !json_is_null(error)) {
+		err = json_dumps(error, 0);
+		srdb_err("monitor_cond_since refused (%s), falling back to monitor.",
+			 err);
+		free(err);
+
+		desc->legacy = true;
+		if (send_monitor_request(desc, fd) < 0)
+			desc->mon_status = MON_STATUS_REQFAIL;
+		return;
+	}
+
+	if (desc->legacy)
+		ret = parse_ovsdb_monitor_reply(json, desc);
+	else
+		ret = parse_ovsdb_monitor_cond_since_reply(json, desc);
+
+	mon_batch_flush(desc);
+
+	if (ret < 0 || desc->synced)
+		return;
+
+	desc->synced = true;
+	sem_post(&desc->tbl->initial_read);
+}
+
+/* Run one monitoring session: connect, request the table contents and
+ * process the updates until the connection is lost or the monitor stops.
+ */
+static void ovsdb_monitor_session(struct monitor_desc *desc)
 {
-	struct monitor_desc *desc = _args;
 	json_error_t json_error;
-	struct srdb_table *tbl;
 	size_t cur_buflen, len;
-	struct pollfd pfd;
+	uint64_t start;
+	struct pollfd pfd[2];
 	struct srdb *srdb;
-	int mon_flags;
 	json_t *json;
 	int ret, fd;
 	char *buf;
 
 	srdb = desc->srdb;
-	tbl = desc->tbl;
-	mon_flags = desc->mon_flags;
-	desc->mon_status = MON_STATUS_RUNNING;
 
 	fd = ovsdb_socket(srdb->conf);
 	if (fd < 0) {
 		desc->mon_status = MON_STATUS_CONNREFUSED;
-		goto out;
+		return;
 	}
 
 	cur_buflen = JSON_BUFLEN;
@@ -200,44 +681,39 @@ static void *ovsdb_monitor(void *_args)
 		goto out_close;
 	}
 
-	len = snprintf(buf, cur_buflen, OVSDB_MONITOR_FORMAT,
-		       srdb->conf->ovsdb_database, tbl->name,
-		       BOOL_TO_STR(mon_flags & MON_UPDATE),
-		       BOOL_TO_STR(mon_flags & MON_INITIAL),
-		       BOOL_TO_STR(mon_flags & MON_INSERT),
-		       BOOL_TO_STR(mon_flags & MON_DELETE));
-
-	ret = send(fd, buf, len, 0);
-	if (ret < 0) {
+	if (send_monitor_request(desc, fd) < 0) {
 		desc->mon_status = MON_STATUS_REQFAIL;
-		srdb_err("failed to send monitor request (%s).", strerror(errno));
 		goto out_close;
 	}
 
 	len = 0;
-	pfd.fd = fd;
-	pfd.events = POLLIN | POLLPRI;
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN | POLLPRI;
+	pfd[1].fd = desc->stop_fd;
+	pfd[1].events = POLLIN;
 
 	for (;;) {
 		size_t jpos = 0;
 		int ready;
 
-		ready = poll(&pfd, 1, 1);
+		ready = poll(pfd, 2, -1);
 		if (ready < 0) {
+			if (errno == EINTR)
+				continue;
 			srdb_err("poll (%s).", strerror(errno));
 			desc->mon_status = MON_STATUS_READERR;
 			goto out_close;
 		}
 
-		if (!ready)
-			continue;
-
 		if (!sem_trywait(&desc->stop)) {
 			desc->mon_status = MON_STATUS_FINISHED;
 			goto out_close;
 		}
 
-		if (pfd.revents & POLLERR) {
+		if (!(pfd[0].revents & (POLLIN | POLLPRI | POLLERR)))
+			continue;
+
+		if (pfd[0].revents & POLLERR) {
 			srdb_err("poll_revents (%s).", strerror(errno));
 			desc->mon_status = MON_STATUS_READERR;
 			goto out_close;
@@ -261,6 +737,7 @@ static void *ovsdb_monitor(void *_args)
 
 		/* loop on buffer and process all valid json */
 		do {
+			start = srdb_now_us();
 			json = json_loadb(buf + jpos, len - jpos,
 					  JSON_DISABLE_EOF_CHECK, &json_error);
 
@@ -272,19 +749,29 @@ static void *ovsdb_monitor(void *_args)
 					srdb_err("failed to send echo reply (%s)",
 						 strerror(errno));
 				}
+			} else if (json_is_integer(json_object_get(json, "id"))) {
+				process_monitor_reply(desc, fd, json);
+			} else if (is_method(json, "update3")) {
+				parse_ovsdb_update3(json, desc);
 			} else {
-				if (json_is_integer(json_object_get(json, "id")))
-					parse_ovsdb_monitor_reply(json, tbl);
-				else
-					parse_ovsdb_update(json, tbl);
+				parse_ovsdb_update(json, desc);
 			}
 
+			/* one batch per update message */
+			mon_batch_flush(desc);
+
+			srdb_hist_add(&desc->tbl->stats.parse,
+				      srdb_now_us() - start);
+
 			jpos += json_error.position;
 
 			json_decref(json);
 
 		} while (jpos < len - 1);
 
+		if (desc->mon_status != MON_STATUS_RUNNING)
+			goto out_close;
+
 		if (!json && jpos) {
 			/* one or more valid json were processed */
 			memmove(buf, buf + jpos, len - jpos);
@@ -303,6 +790,7 @@ static void *ovsdb_monitor(void *_args)
 			srdb_err("cur recvq exceeded, increasing to %lu.",
 				cur_buflen * 2);
 			cur_buflen *= 2;
+			desc->tbl->stats.buffer_grows++;
 			buf = realloc(buf, cur_buflen);
 			if (!buf) {
 				srdb_err("failed to increase json buffer.");
@@ -312,23 +800,197 @@ static void *ovsdb_monitor(void *_args)
 		}
 	}
 
-	sem_post(&desc->zombie);
-
 out_close:
 	close(fd);
 	free(buf);
-out:
-	/* temp hack to prevent deadlock when ovsdb server is down at startup */
-	sem_post(&tbl->initial_read);
+}
+
+/* Sleep @ms milliseconds, return false if the monitor was asked to stop */
+static bool mon_backoff_wait(struct monitor_desc *desc, unsigned int ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	while (sem_timedwait(&desc->stop, &ts)) {
+		if (errno != EINTR)
+			return true;
+	}
+
+	return false;
+}
+
+static void *ovsdb_monitor(void *_args)
+{
+	struct monitor_desc *desc = _args;
+	unsigned int backoff = MON_BACKOFF_MIN;
+	char last_txn_id[SLEN + 1];
+
+	for (;;) {
+		desc->mon_status = MON_STATUS_RUNNING;
+		strcpy(last_txn_id, desc->last_txn_id);
+
+		ovsdb_monitor_session(desc);
+
+		if (desc->mon_status == MON_STATUS_FINISHED ||
+		    desc->mon_status == MON_STATUS_NOMEM)
+			break;
+
+		/* the server must be reachable at startup */
+		if (!desc->synced)
+			break;
+
+		/* restart the backoff once the session made progress */
+		if (strcmp(last_txn_id, desc->last_txn_id))
+			backoff = MON_BACKOFF_MIN;
+
+		srdb_err("monitor of table %s disconnected (%d), reconnecting in %u ms.",
+			 desc->tbl->name, desc->mon_status, backoff);
+
+		desc->mon_status = MON_STATUS_RECONNECTING;
+		if (!mon_backoff_wait(desc, backoff)) {
+			desc->mon_status = MON_STATUS_FINISHED;
+			break;
+		}
+
+		backoff = backoff * 2 < MON_BACKOFF_MAX ? backoff * 2 :
+			  MON_BACKOFF_MAX;
+		desc->reconnects++;
+	}
+
+	srdb_monitor_release(desc);
 
 	return NULL;
 }
 
-static struct transaction *ovsdb_delete(struct srdb *srdb, const char *table,
-					const char *uuid)
+static int ovsdb_monitor_start(struct monitor_desc *desc)
 {
-	char *json_buf;
+	desc->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (desc->stop_fd < 0)
+		return -1;
+
+	if (pthread_create(&desc->thread, NULL, ovsdb_monitor, desc)) {
+		close(desc->stop_fd);
+		desc->stop_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The eventfd interrupts a session, the semaphore a reconnection backoff */
+static void ovsdb_monitor_stop(struct monitor_desc *desc)
+{
+	uint64_t event = 1;
+
+	sem_post(&desc->stop);
+	if (write(desc->stop_fd, &event, sizeof(event)) < 0)
+		srdb_err("failed to stop monitor of table %s.", desc->tbl->name);
+}
+
+/* Apply a <table-updates2> object of the monitored table. This is how
+ * the backends that do not speak JSON-RPC feed their monitors.
+ */
+int srdb_monitor_apply(struct monitor_desc *desc, json_t *table_updates)
+{
+	uint64_t start = srdb_now_us();
+	int ret;
+
+	ret = parse_ovsdb_update2_tables(table_updates, desc);
+	mon_batch_flush(desc);
+
+	srdb_hist_add(&desc->tbl->stats.parse, srdb_now_us() - start);
+
+	if (!desc->synced) {
+		desc->synced = true;
+		sem_post(&desc->tbl->initial_read);
+	}
+
+	return ret;
+}
+
+/* Release the monitor state, last call of a monitor thread */
+void srdb_monitor_release(struct monitor_desc *desc)
+{
+	mon_rows_destroy(desc);
+	free(desc->batch);
+
+	sem_post(&desc->zombie);
+
+	/* temp hack to prevent deadlock when ovsdb server is down at startup */
+	sem_post(&desc->tbl->initial_read);
+}
+
+/* Once the monitor thread is joined */
+static void monitor_free(struct monitor_desc *desc)
+{
+	if (desc->stop_fd >= 0)
+		close(desc->stop_fd);
+	free(desc);
+}
+
+/* Queue a transaction for the workers. When @cb is set, the transaction
+ * is released after the callback and must not be used by the caller. It
+ * is not queued, and @cb not called, if SRDB_TR_QUEUE transactions are
+ * already pending.
+ */
+static struct transaction *submit_transaction(struct srdb *srdb,
+					      struct srdb_table *tbl, int op,
+					      json_t *json, transaction_cb_t cb,
+					      void *arg)
+{
+	struct srdb_stats *stats = &srdb->stats;
 	struct transaction *tr;
+	unsigned int depth, max;
+
+	if (cb)
+		tr = create_transaction_cb(json, cb, arg);
+	else
+		tr = create_transaction(json);
+
+	if (!tr) {
+		srdb_err("failed to build transaction object.");
+		json_decref(json);
+		return NULL;
+	}
+
+	tr->srdb = srdb;
+	tr->tbl = tbl;
+	tr->op = op;
+	tr->queued = srdb_now_us();
+
+	__atomic_add_fetch(&stats->submitted, 1, __ATOMIC_RELAXED);
+	depth = __atomic_add_fetch(&stats->queue_depth, 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&stats->queue_max, __ATOMIC_RELAXED);
+	while (depth > max &&
+	       !__atomic_compare_exchange_n(&stats->queue_max, &max, depth,
+					    true, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+
+	if (srdb->backend->submit(srdb, tr) < 0) {
+		__atomic_sub_fetch(&stats->submitted, 1, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&stats->queue_depth, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats->overflows, 1, __ATOMIC_RELAXED);
+		free_transaction(tr);
+		return NULL;
+	}
+
+	return tr;
+}
+
+static struct transaction *ovsdb_delete(struct srdb *srdb,
+					struct srdb_table *tbl,
+					const char *uuid, transaction_cb_t cb,
+					void *arg)
+{
+	char *json_buf;
 	json_t *json_delete;
 
 	json_buf = malloc(JSON_BUFLEN);
@@ -336,7 +998,7 @@ static struct transaction *ovsdb_delete(struct srdb *srdb, const char *table,
 		return NULL;
 
 	snprintf(json_buf, JSON_BUFLEN, OVSDB_DELETE_FORMAT,
-		 srdb->conf->ovsdb_database, table, uuid);
+		 srdb->conf->ovsdb_database, tbl->name, uuid);
 
 	json_delete = json_loads(json_buf, 0, NULL);
 	if (!json_delete) {
@@ -347,24 +1009,16 @@ static struct transaction *ovsdb_delete(struct srdb *srdb, const char *table,
 
 	free(json_buf);
 
-	tr = create_transaction(json_delete);
-	if (!tr) {
-		srdb_err("failed to build transaction object.");
-		json_decref(json_delete);
-		return NULL;
-	}
-
-	sbuf_push(srdb->transactions, tr);
-	wakeup_tr_workers(srdb);
-
-	return tr;
+	return submit_transaction(srdb, tbl, SRDB_OP_DELETE, json_delete, cb,
+				  arg);
 }
 
-static struct transaction *ovsdb_update(struct srdb *srdb, const char *table,
-					const char *uuid, json_t *fields)
+static struct transaction *ovsdb_update(struct srdb *srdb,
+					struct srdb_table *tbl,
+					const char *uuid, json_t *fields,
+					transaction_cb_t cb, void *arg)
 {
 	char *json_buf, *str_fields;
-	struct transaction *tr;
 	json_t *json_update;
 
 	json_buf = malloc(JSON_BUFLEN);
@@ -379,7 +1033,7 @@ static struct transaction *ovsdb_update(struct srdb *srdb, const char *table,
 	}
 
 	snprintf(json_buf, JSON_BUFLEN, OVSDB_UPDATE_FORMAT,
-		 srdb->conf->ovsdb_database, str_fields, table, uuid);
+		 srdb->conf->ovsdb_database, str_fields, tbl->name, uuid);
 	free(str_fields);
 
 	json_update = json_loads(json_buf, 0, NULL);
@@ -391,24 +1045,16 @@ static struct transaction *ovsdb_update(struct srdb *srdb, const char *table,
 
 	free(json_buf);
 
-	tr = create_transaction(json_update);
-	if (!tr) {
-		srdb_err("failed to build transaction object.");
-		json_decref(json_update);
-		return NULL;
-	}
-
-	sbuf_push(srdb->transactions, tr);
-	wakeup_tr_workers(srdb);
-
-	return tr;
+	return submit_transaction(srdb, tbl, SRDB_OP_UPDATE, json_update, cb,
+				  arg);
 }
 
-static struct transaction *ovsdb_insert(struct srdb *srdb, const char *table,
-					json_t *fields)
+static struct transaction *ovsdb_insert(struct srdb *srdb,
+					struct srdb_table *tbl,
+					json_t *fields, transaction_cb_t cb,
+					void *arg)
 {
 	char *json_buf, *str_fields;
-	struct transaction *tr;
 	json_t *json_insert;
 
 	json_buf = malloc(JSON_BUFLEN);
@@ -423,7 +1069,7 @@ static struct transaction *ovsdb_insert(struct srdb *srdb, const char *table,
 	}
 
 	snprintf(json_buf, JSON_BUFLEN, OVSDB_INSERT_FORMAT,
-		 srdb->conf->ovsdb_database, str_fields, table);
+		 srdb->conf->ovsdb_database, str_fields, tbl->name);
 	free(str_fields);
 
 	json_insert = json_loads(json_buf, 0, NULL);
@@ -435,107 +1081,488 @@ static struct transaction *ovsdb_insert(struct srdb *srdb, const char *table,
 
 	free(json_buf);
 
-	tr = create_transaction(json_insert);
-	if (!tr) {
-		srdb_err("failed to build transaction object.");
-		json_decref(json_insert);
+	return submit_transaction(srdb, tbl, SRDB_OP_INSERT, json_insert, cb,
+				  arg);
+}
+
+/* Column decoder of a table, compiled from its descriptors: a perfect
+ * hash maps the column names to their descriptor, and the descriptors
+ * are also indexed by field index.
+ */
+#define DECODER_MAX_COLUMNS	64
+
+struct srdb_decoder {
+	unsigned int seed;
+	unsigned int mask;
+	short *slots;
+	const struct srdb_descriptor **by_index;
+	unsigned int max_index;
+	const struct srdb_descriptor *version;
+};
+
+static unsigned int decoder_hash(const char *name, unsigned int seed)
+{
+	unsigned int hash = 2166136261u ^ seed;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static bool decoder_try_seed(struct srdb_decoder *dec,
+			     struct srdb_descriptor *desc)
+{
+	unsigned int h;
+	int i;
+
+	memset(dec->slots, 0xff, (dec->mask + 1) * sizeof(*dec->slots));
+
+	for (i = 0; desc[i].name; i++) {
+		h = decoder_hash(desc[i].name, dec->seed) & dec->mask;
+		if (dec->slots[h] >= 0)
+			return false;
+		dec->slots[h] = i;
+	}
+
+	return true;
+}
+
+static void decoder_free(struct srdb_decoder *dec)
+{
+	if (!dec)
+		return;
+
+	free(dec->slots);
+	free(dec->by_index);
+	free(dec);
+}
+
+static struct srdb_decoder *decoder_compile(struct srdb_descriptor *desc)
+{
+	struct srdb_decoder *dec;
+	unsigned int n, size;
+	int i;
+
+	dec = calloc(1, sizeof(*dec));
+	if (!dec)
 		return NULL;
+
+	for (n = 0; desc[n].name; n++) {
+		if (desc[n].index > dec->max_index)
+			dec->max_index = desc[n].index;
+		if (!strcmp(desc[n].name, "_version"))
+			dec->version = &desc[n];
+	}
+
+	if (n > DECODER_MAX_COLUMNS)
+		goto out_err;
+
+	dec->by_index = calloc(dec->max_index + 1, sizeof(*dec->by_index));
+	if (!dec->by_index)
+		goto out_err;
+
+	for (i = n - 1; i >= 0; i--)
+		dec->by_index[desc[i].index] = &desc[i];
+
+	for (size = 1; size < 2 * n; size <<= 1);
+
+	for (;;) {
+		free(dec->slots);
+		dec->slots = malloc(size * sizeof(*dec->slots));
+		if (!dec->slots)
+			goto out_err;
+
+		dec->mask = size - 1;
+		for (dec->seed = 0; dec->seed < 1024; dec->seed++) {
+			if (decoder_try_seed(dec, desc))
+				return dec;
+		}
+
+		size <<= 1;
+	}
+
+out_err:
+	decoder_free(dec);
+	return NULL;
+}
+
+static const struct srdb_descriptor *
+decoder_lookup(struct srdb_table *tbl, const char *name)
+{
+	struct srdb_decoder *dec = tbl->decoder;
+	const struct srdb_descriptor *desc;
+	short slot;
+
+	slot = dec->slots[decoder_hash(name, dec->seed) & dec->mask];
+	if (slot < 0)
+		return NULL;
+
+	desc = &tbl->desc[slot];
+	if (strcmp(desc->name, name))
+		return NULL;
+
+	return desc;
+}
+
+static const struct srdb_descriptor *
+find_desc_fromindex(struct srdb_table *tbl, unsigned int index)
+{
+	if (index > tbl->decoder->max_index)
+		return NULL;
+
+	return tbl->decoder->by_index[index];
+}
+
+unsigned int fill_srdb_entry(struct srdb_table *tbl,
+			     struct srdb_entry *entry, const char *uuid,
+			     json_t *line_json)
+{
+	const struct srdb_descriptor *desc, *varstr[DECODER_MAX_COLUMNS];
+	const char *strs[DECODER_MAX_COLUMNS];
+	size_t lens[DECODER_MAX_COLUMNS];
+	unsigned int index_mask = 0;
+	size_t arena_len = 0;
+	json_t *column_value;
+	const char *column;
+	int i, nvarstr = 0;
+	char *arena;
+	void *data;
+
+	strncpy(entry->row, uuid, SLEN);
+
+	json_object_foreach(line_json, column, column_value) {
+		desc = decoder_lookup(tbl, column);
+		if (!desc)
+			continue;
+
+		if (desc->index)
+			index_mask |= ENTRY_MASK(desc->index);
+
+		if (desc == tbl->decoder->version)
+			column_value = json_array_get(column_value, 1);
+
+		data = (unsigned char *)entry + desc->offset;
+
+		switch (desc->type) {
+		case SRDB_STR:
+			if (!json_is_string(column_value)) {
+				srdb_err("type str mismatch for field name `%s'.",
+					 desc->name);
+			} else {
+				strncpy((char *)data,
+					json_string_value(column_value),
+					desc->maxlen);
+			}
+			break;
+		case SRDB_INT:
+			if (!json_is_integer(column_value)) {
+				srdb_err("type int mismatch for field name `%s'.",
+					 desc->name);
+			} else {
+				*(int *)data = json_integer_value(column_value);
+			}
+			break;
+		case SRDB_VARSTR:
+			if (!json_is_string(column_value)) {
+				srdb_err("type str mismatch for field name `%s'.",
+					 desc->name);
+			} else {
+				varstr[nvarstr] = desc;
+				strs[nvarstr] = json_string_value(column_value);
+				lens[nvarstr] = strnlen(strs[nvarstr], desc->maxlen);
+				arena_len += lens[nvarstr] + 1;
+				nvarstr++;
+			}
+			break;
+		}
+	}
+
+	if (!nvarstr)
+		return index_mask;
+
+	/* all the variable strings of the entry share one allocation, kept
+	 * by pooled entries across reuses
+	 */
+	if (entry->arena_size < arena_len) {
+		free(entry->arena);
+		entry->arena_size = 0;
+
+		entry->arena = malloc(arena_len);
+		if (!entry->arena) {
+			srdb_err("failed to allocate entry strings.");
+			return index_mask;
+		}
+
+		entry->arena_size = arena_len;
+	}
+
+	arena = entry->arena;
+	entry->arena_len = arena_len;
+
+	for (i = 0; i < nvarstr; i++) {
+		memcpy(arena, strs[i], lens[i]);
+		arena[lens[i]] = 0;
+		*(char **)((unsigned char *)entry + varstr[i]->offset) = arena;
+		arena += lens[i] + 1;
+	}
+
+	return index_mask;
+}
+
+/* Release the strings of an entry. Strings that were not decoded by
+ * fill_srdb_entry() are owned by the entry and freed one by one.
+ */
+void clear_srdb_entry(struct srdb_descriptor *desc,
+		      struct srdb_entry *entry)
+{
+	uintptr_t arena = (uintptr_t)entry->arena;
+	struct srdb_descriptor *tmp;
+	uintptr_t str;
+
+	for (tmp = desc; tmp->name; tmp++) {
+		void *data = (unsigned char *)entry + tmp->offset;
+
+		if (tmp->type != SRDB_VARSTR)
+			continue;
+
+		/* as integers, the string may not belong to the arena */
+		str = (uintptr_t)*(char **)data;
+		if (str < arena || str >= arena + entry->arena_len)
+			free(*(char **)data);
+	}
+
+	entry->arena_len = 0;
+
+	if (!entry->pool) {
+		free(entry->arena);
+		entry->arena = NULL;
+		entry->arena_size = 0;
+	}
+}
+
+/* Zeroed entry from the pool of the table, its string arena is recycled */
+struct srdb_entry *alloc_srdb_entry(struct srdb_table *tbl)
+{
+	struct srdb_entry *entry;
+	size_t arena_size;
+	char *arena;
+
+	if (!tbl->pool)
+		return calloc(1, tbl->entry_size);
+
+	entry = slab_alloc(tbl->pool);
+	if (!entry)
+		return NULL;
+
+	arena = entry->arena;
+	arena_size = entry->arena_size;
+
+	memset(entry, 0, tbl->entry_size);
+
+	entry->arena = arena;
+	entry->arena_size = arena_size;
+	entry->pool = tbl->pool;
+
+	return entry;
+}
+
+void free_srdb_entry(struct srdb_descriptor *desc,
+		     struct srdb_entry *entry)
+{
+	clear_srdb_entry(desc, entry);
+
+	if (entry->pool)
+		slab_free(entry->pool, entry);
+	else
+		free(entry);
+}
+
+static void pooled_entry_dtor(void *obj)
+{
+	free(((struct srdb_entry *)obj)->arena);
+}
+
+/* Unlike fill_srdb_entry(), a column of the wrong type fails the whole row */
+struct srdb_compact_entry *srdb_compact_decode(struct srdb_table *tbl,
+					       const char *uuid,
+					       json_t *line_json)
+{
+	const struct srdb_descriptor *desc, *version = tbl->decoder->version;
+	const char *strs[DECODER_MAX_COLUMNS];
+	struct srdb_compact_entry *ce;
+	unsigned int nslots, slot;
+	size_t arena_len, len;
+	json_t *column_value;
+	const char *column;
+	char *arena;
+
+	for (nslots = 0; tbl->desc[nslots].name; nslots++)
+		strs[nslots] = NULL;
+
+	/* the uuid comes first, see srdb_compact_row() */
+	strs[0] = uuid;
+	arena_len = strnlen(uuid, SLEN) + 1;
+
+	json_object_foreach(line_json, column, column_value) {
+		desc = decoder_lookup(tbl, column);
+		if (!desc || desc == tbl->desc)
+			continue;
+
+		if (desc->type == SRDB_INT) {
+			if (!json_is_integer(column_value)) {
+				srdb_err("type int mismatch for field name `%s'.",
+					 desc->name);
+				return NULL;
+			}
+			continue;
+		}
+
+		if (desc == version)
+			column_value = json_array_get(column_value, 1);
+
+		if (!json_is_string(column_value)) {
+			srdb_err("type str mismatch for field name `%s'.",
+				 desc->name);
+			return NULL;
+		}
+
+		slot = desc - tbl->desc;
+		strs[slot] = json_string_value(column_value);
+		arena_len += strnlen(strs[slot], desc->maxlen) + 1;
+	}
+
+	ce = malloc(sizeof(*ce) + nslots * sizeof(uint32_t) + arena_len);
+	if (!ce)
+		return NULL;
+
+	ce->index_mask = 0;
+	ce->nslots = nslots;
+	ce->arena_len = arena_len;
+	arena = (char *)&ce->slots[nslots];
+
+	for (slot = 0; slot < nslots; slot++) {
+		desc = &tbl->desc[slot];
+		column_value = NULL;
+
+		if (desc->type == SRDB_INT) {
+			column_value = json_object_get(line_json, desc->name);
+			if (json_is_integer(column_value)) {
+				ce->slots[slot] = json_integer_value(column_value);
+				if (desc->index)
+					ce->index_mask |= ENTRY_MASK(desc->index);
+			} else {
+				ce->slots[slot] = 0;
+			}
+			continue;
+		}
+
+		if (!strs[slot]) {
+			ce->slots[slot] = SRDB_COMPACT_NONE;
+			continue;
+		}
+
+		if (desc->index)
+			ce->index_mask |= ENTRY_MASK(desc->index);
+
+		len = strnlen(strs[slot], desc->maxlen);
+		memcpy(arena, strs[slot], len);
+		arena[len] = 0;
+		ce->slots[slot] = arena - (char *)&ce->slots[nslots];
+		arena += len + 1;
 	}
 
-	sbuf_push(srdb->transactions, tr);
-	wakeup_tr_workers(srdb);
+	return ce;
+}
 
-	return tr;
+static int compact_slot(struct srdb_table *tbl, unsigned int index)
+{
+	const struct srdb_descriptor *desc;
+
+	desc = find_desc_fromindex(tbl, index);
+	if (!desc)
+		return -1;
+
+	return desc - tbl->desc;
 }
 
-static int find_desc_fromindex(struct srdb_descriptor *desc, unsigned int index)
+const char *srdb_compact_str(struct srdb_table *tbl,
+			     const struct srdb_compact_entry *ce,
+			     unsigned int index)
 {
-	int i;
+	int slot = compact_slot(tbl, index);
 
-	for (i = 0; desc[i].name; i++) {
-		if (desc[i].index == index)
-			return i;
-	}
+	if (slot < 0 || tbl->desc[slot].type == SRDB_INT ||
+	    ce->slots[slot] == SRDB_COMPACT_NONE)
+		return NULL;
 
-	return -1;
+	return srdb_compact_row(ce) + ce->slots[slot];
 }
 
-static unsigned int fill_srdb_entry(struct srdb_descriptor *desc,
-				    struct srdb_entry *entry, const char *uuid,
-				    json_t *line_json)
+int srdb_compact_int(struct srdb_table *tbl,
+		     const struct srdb_compact_entry *ce, unsigned int index)
 {
-	unsigned int index_mask = 0;
-	json_t *column_value;
-	void *data;
-	int i;
+	int slot = compact_slot(tbl, index);
 
-	for (i = 0; desc[i].name; i++) {
-		if (!strcmp(desc[i].name, "row")) {
-			strncpy(entry->row, uuid, desc[i].maxlen);
-			continue;
-		}
+	if (slot < 0 || tbl->desc[slot].type != SRDB_INT)
+		return 0;
 
-		column_value = json_object_get(line_json, desc[i].name);
-		if (!column_value)
-			continue;
+	return (int)ce->slots[slot];
+}
 
-		if (desc[i].index)
-			index_mask |= ENTRY_MASK(desc[i].index);
+/* Full entry from a compact one, the strings share the same arena */
+struct srdb_entry *srdb_compact_expand(struct srdb_table *tbl,
+				       const struct srdb_compact_entry *ce)
+{
+	const struct srdb_descriptor *desc;
+	struct srdb_entry *entry;
+	const char *strs;
+	unsigned int slot;
+	void *data;
 
-		if (!strcmp(desc[i].name, "_version")) {
-			column_value = json_object_get(line_json, "_version");
-			column_value = json_array_get(column_value, 1);
-		}
+	entry = alloc_srdb_entry(tbl);
+	if (!entry)
+		return NULL;
 
-		data = (unsigned char *)entry + desc[i].offset;
+	if (entry->arena_size < ce->arena_len) {
+		free(entry->arena);
+		entry->arena_size = 0;
 
-		switch (desc[i].type) {
-		case SRDB_STR:
-			if (!json_is_string(column_value)) {
-				srdb_err("type str mismatch for field name `%s'.",
-					 desc[i].name);
-			} else {
-				strncpy((char *)data,
-					json_string_value(column_value),
-					desc[i].maxlen);
-			}
-			break;
-		case SRDB_INT:
-			if (!json_is_integer(column_value)) {
-				srdb_err("type int mismatch for field name `%s'.",
-					 desc[i].name);
-			} else {
-				*(int *)data = json_integer_value(column_value);
-			}
-			break;
-		case SRDB_VARSTR:
-			if (!json_is_string(column_value)) {
-				srdb_err("type str mismatch for field name `%s'.",
-					 desc[i].name);
-			} else {
-				*(char **)data = strndup(json_string_value(column_value),
-							 desc[i].maxlen);
-			}
-			break;
+		entry->arena = malloc(ce->arena_len);
+		if (!entry->arena) {
+			free_srdb_entry(tbl->desc, entry);
+			return NULL;
 		}
+
+		entry->arena_size = ce->arena_len;
 	}
 
-	return index_mask;
-}
+	memcpy(entry->arena, srdb_compact_row(ce), ce->arena_len);
+	entry->arena_len = ce->arena_len;
+	strs = entry->arena;
 
-void free_srdb_entry(struct srdb_descriptor *desc,
-		     struct srdb_entry *entry)
-{
-	struct srdb_descriptor *tmp;
+	for (slot = 0; slot < ce->nslots; slot++) {
+		desc = &tbl->desc[slot];
+		data = (unsigned char *)entry + desc->offset;
 
-	for (tmp = desc; tmp->name; tmp++) {
-		void *data = (unsigned char *)entry + tmp->offset;
+		if (desc->type == SRDB_INT) {
+			*(int *)data = (int)ce->slots[slot];
+			continue;
+		}
 
-		if (tmp->type == SRDB_VARSTR)
-			free(*(char **)data);
+		if (ce->slots[slot] == SRDB_COMPACT_NONE)
+			continue;
+
+		if (desc->type == SRDB_VARSTR)
+			*(const char **)data = strs + ce->slots[slot];
+		else
+			strncpy((char *)data, strs + ce->slots[slot],
+				desc->maxlen);
 	}
 
-	free(entry);
+	return entry;
 }
 
 #define SRDB_BUILTIN_ENTRIES()					\
@@ -1045,11 +2072,27 @@ struct srdb_table *srdb_get_tables(void)
 		return NULL;
 
 	for (i = 0; i < sizeof(srdb_tables) / sizeof(struct srdb_table); i++) {
-		if (tbl[i].name)
-			tbl[i].desc = memdup(tbl[i].desc_tmpl, tbl[i].desc_size);
+		if (!tbl[i].name)
+			continue;
+
+		tbl[i].desc = memdup(tbl[i].desc_tmpl, tbl[i].desc_size);
+		if (!tbl[i].desc)
+			goto out_free;
+
+		tbl[i].decoder = decoder_compile(tbl[i].desc);
+		if (!tbl[i].decoder)
+			goto out_free;
+
+		tbl[i].pool = slab_new(tbl[i].entry_size, 0);
+		if (!tbl[i].pool)
+			goto out_free;
 	}
 
 	return tbl;
+
+out_free:
+	srdb_free_tables(tbl);
+	return NULL;
 }
 
 void srdb_free_tables(struct srdb_table *tbl)
@@ -1057,8 +2100,15 @@ void srdb_free_tables(struct srdb_table *tbl)
 	unsigned int i;
 
 	for (i = 0; i < sizeof(srdb_tables) / sizeof(struct srdb_table); i++) {
-		if (tbl[i].name)
-			free(tbl[i].desc);
+		if (!tbl[i].name)
+			continue;
+
+		if (tbl[i].cache)
+			srdb_cache_destroy(tbl[i].cache);
+		if (tbl[i].pool)
+			slab_destroy(tbl[i].pool, pooled_entry_dtor);
+		decoder_free(tbl[i].decoder);
+		free(tbl[i].desc);
 	}
 
 	free(tbl);
@@ -1077,16 +2127,11 @@ struct srdb_table *srdb_table_by_name(struct srdb_table *tables,
 	return NULL;
 }
 
-#define OP_INSERT	1
-#define OP_UPDATE	2
-#define OP_DELETE	3
-
-static int srdb_read(const char *uuid, json_t *json, struct srdb_table *tbl)
+/* Decode a row change in the "new"/"old" layout of the monitor updates */
+static int srdb_decode(const char *uuid, json_t *json, struct srdb_table *tbl,
+		       struct srdb_row_change *rc)
 {
-	struct srdb_entry *entry, *update_entry;
-	unsigned int imask, op = 0;
 	json_t *new, *old;
-	int ret = 0;
 
 	if (!uuid || !json)
 		return -1;
@@ -1094,61 +2139,128 @@ static int srdb_read(const char *uuid, json_t *json, struct srdb_table *tbl)
 	new = json_object_get(json, "new");
 	old = json_object_get(json, "old");
 
+	memset(rc, 0, sizeof(*rc));
+
 	if (new && !old)
-		op = OP_INSERT;
+		rc->op = SRDB_OP_INSERT;
 	else if (new && old)
-		op = OP_UPDATE;
+		rc->op = SRDB_OP_UPDATE;
 	else if (old)
-		op = OP_DELETE;
+		rc->op = SRDB_OP_DELETE;
 
-	if (!op) {
+	if (!rc->op) {
 		srdb_err("unknown row data configuration.");
 		return -1;
 	}
 
-	entry = calloc(1, tbl->entry_size);
-
-	switch (op) {
-	case OP_INSERT:
-		fill_srdb_entry(tbl->desc, entry, uuid, new);
-
-		if (tbl->cb_insert)
-			ret = tbl->cb_insert(entry);
-
-		if (!tbl->delayed_free)
-			free_srdb_entry(tbl->desc, entry);
+	rc->entry = alloc_srdb_entry(tbl);
+	if (!rc->entry)
+		return -1;
 
+	switch (rc->op) {
+	case SRDB_OP_INSERT:
+		fill_srdb_entry(tbl, rc->entry, uuid, new);
 		break;
-	case OP_UPDATE:
-		update_entry = calloc(1, tbl->entry_size);
+	case SRDB_OP_UPDATE:
+		rc->diff = alloc_srdb_entry(tbl);
+		if (!rc->diff) {
+			free_srdb_entry(tbl->desc, rc->entry);
+			return -1;
+		}
 
 		/* "new" contains *all* field set, with new values */
-		fill_srdb_entry(tbl->desc, entry, uuid, new);
+		fill_srdb_entry(tbl, rc->entry, uuid, new);
 
 		/* "old" contains only changed fields, with old values */
-		imask = fill_srdb_entry(tbl->desc, update_entry, uuid, old);
+		rc->fmask = fill_srdb_entry(tbl, rc->diff, uuid, old);
+		break;
+	case SRDB_OP_DELETE:
+		fill_srdb_entry(tbl, rc->entry, uuid, old);
+		break;
+	}
 
-		if (tbl->cb_update)
-			ret = tbl->cb_update(entry, update_entry, imask);
+	return 0;
+}
 
-		if (!tbl->delayed_free) {
-			free_srdb_entry(tbl->desc, update_entry);
-			free_srdb_entry(tbl->desc, entry);
-		}
+static void srdb_release(struct srdb_table *tbl, struct srdb_row_change *rc)
+{
+	if (rc->diff)
+		free_srdb_entry(tbl->desc, rc->diff);
+	free_srdb_entry(tbl->desc, rc->entry);
+}
 
-		break;
-	case OP_DELETE:
-		fill_srdb_entry(tbl->desc, entry, uuid, old);
+static int srdb_read(const char *uuid, json_t *json, struct srdb_table *tbl)
+{
+	struct srdb_row_change rc;
+	int ret = 0;
+
+	if (srdb_decode(uuid, json, tbl, &rc) < 0)
+		return -1;
 
+	switch (rc.op) {
+	case SRDB_OP_INSERT:
+		if (tbl->cb_insert)
+			ret = tbl->cb_insert(rc.entry);
+		break;
+	case SRDB_OP_UPDATE:
+		if (tbl->cb_update)
+			ret = tbl->cb_update(rc.entry, rc.diff, rc.fmask);
+		break;
+	case SRDB_OP_DELETE:
 		if (tbl->cb_delete)
-			ret = tbl->cb_delete(entry);
+			ret = tbl->cb_delete(rc.entry);
+		break;
+	}
 
-		if (!tbl->delayed_free)
-			free_srdb_entry(tbl->desc, entry);
+	if (!tbl->delayed_free)
+		srdb_release(tbl, &rc);
 
-		break;
+	return ret;
+}
+
+/* Queue a row change until the whole update message is parsed */
+static int mon_batch_add(struct monitor_desc *desc, const char *uuid,
+			 json_t *json)
+{
+	struct srdb_row_change *batch;
+	unsigned int size;
+
+	if (desc->batch_len == desc->batch_size) {
+		size = desc->batch_size ? desc->batch_size * 2 : 16;
+		batch = realloc(desc->batch, size * sizeof(*batch));
+		if (!batch)
+			return -1;
+
+		desc->batch = batch;
+		desc->batch_size = size;
+	}
+
+	if (srdb_decode(uuid, json, desc->tbl, &desc->batch[desc->batch_len]) < 0)
+		return -1;
+
+	desc->batch_len++;
+
+	return 0;
+}
+
+static int mon_batch_flush(struct monitor_desc *desc)
+{
+	struct srdb_table *tbl = desc->tbl;
+	unsigned int i;
+	int ret;
+
+	if (!desc->batch_len)
+		return 0;
+
+	ret = tbl->cb_batch(desc->batch, desc->batch_len);
+
+	if (!tbl->delayed_free) {
+		for (i = 0; i < desc->batch_len; i++)
+			srdb_release(tbl, &desc->batch[i]);
 	}
 
+	desc->batch_len = 0;
+
 	return ret;
 }
 
@@ -1173,23 +2285,61 @@ int srdb_monitor(struct srdb *srdb, const char *table, int mon_flags,
 	if (!desc)
 		return -1;
 
+	desc->rows = hmap_new(hash_str, compare_str);
+	if (!desc->rows) {
+		free(desc);
+		return -1;
+	}
+
 	desc->srdb = srdb;
 	desc->tbl = tbl;
 	desc->mon_flags = mon_flags;
 	sem_init(&desc->stop, 0, 0);
 	sem_init(&desc->zombie, 0, 0);
+	desc->stop_fd = -1;
 	desc->mon_status = MON_STATUS_STARTING;
+	strcpy(desc->last_txn_id, OVSDB_TXN_ID_ZERO);
+	desc->legacy = false;
+	desc->synced = false;
+	desc->generation = 0;
+	desc->reconnects = 0;
+	desc->batch = NULL;
+	desc->batch_len = 0;
+	desc->batch_size = 0;
+	desc->backend_data = NULL;
+
+	if (srdb->backend->monitor(desc)) {
+		hmap_destroy(desc->rows);
+		free(desc);
+		return -1;
+	}
 
 	llist_node_insert_tail(srdb->monitors, desc);
 
-	pthread_create(&desc->thread, NULL, ovsdb_monitor, desc);
-
 	if (sync)
 		sem_wait(&tbl->initial_read);
 
 	return desc->mon_status;
 }
 
+/* Same as srdb_monitor(), but all the row changes of an update message
+ * are delivered at once to @cb_batch.
+ */
+int srdb_monitor_batch(struct srdb *srdb, const char *table, int mon_flags,
+		       table_batch_cb_t cb_batch, bool delayed_free, bool sync)
+{
+	struct srdb_table *tbl;
+
+	tbl = srdb_table_by_name(srdb->tables, table);
+	if (!tbl)
+		return -1;
+
+	tbl->cb_batch = cb_batch;
+
+	return srdb_monitor(srdb, table, mon_flags, NULL, NULL, NULL,
+			    delayed_free, sync);
+}
+
 static void write_desc_data(json_t *row, const struct srdb_descriptor *desc,
 			   struct srdb_entry *entry)
 {
@@ -1215,7 +2365,13 @@ static void write_desc_data(json_t *row, const struct srdb_descriptor *desc,
 struct transaction *srdb_delete(struct srdb *srdb, struct srdb_table *tbl,
 				struct srdb_entry *entry)
 {
-	return ovsdb_delete(srdb, tbl->name, entry->row);
+	return ovsdb_delete(srdb, tbl, entry->row, NULL, NULL);
+}
+
+int srdb_delete_async(struct srdb *srdb, struct srdb_table *tbl,
+		      struct srdb_entry *entry, transaction_cb_t cb, void *arg)
+{
+	return ovsdb_delete(srdb, tbl, entry->row, cb, arg) ? 0 : -1;
 }
 
 int srdb_delete_sync(struct srdb *srdb, struct srdb_table *tbl,
@@ -1252,14 +2408,11 @@ struct srdb_update_transact *srdb_update_prepare(struct srdb *srdb,
 int srdb_update_append(struct srdb_update_transact *utr, unsigned int index)
 {
 	const struct srdb_descriptor *desc;
-	int idx;
 
-	idx = find_desc_fromindex(utr->tbl->desc, index);
-	if (idx < 0)
+	desc = find_desc_fromindex(utr->tbl, index);
+	if (!desc)
 		return -1;
 
-	desc = &utr->tbl->desc[idx];
-
 	write_desc_data(utr->fields, desc, utr->entry);
 	utr->index_mask |= ENTRY_MASK(index);
 
@@ -1285,12 +2438,13 @@ void srdb_update_append_mask(struct srdb_update_transact *utr,
 	utr->index_mask |= index_mask;
 }
 
-struct transaction *srdb_update_commit(struct srdb_update_transact *utr)
+static struct transaction *update_commit(struct srdb_update_transact *utr,
+					 transaction_cb_t cb, void *arg)
 {
 	struct transaction *tr;
 
-	tr = ovsdb_update(utr->srdb, utr->tbl->name, utr->entry->row,
-			  utr->fields);
+	tr = ovsdb_update(utr->srdb, utr->tbl, utr->entry->row,
+			  utr->fields, cb, arg);
 
 	json_decref(utr->fields);
 	free(utr);
@@ -1298,6 +2452,17 @@ struct transaction *srdb_update_commit(struct srdb_update_transact *utr)
 	return tr;
 }
 
+struct transaction *srdb_update_commit(struct srdb_update_transact *utr)
+{
+	return update_commit(utr, NULL, NULL);
+}
+
+int srdb_update_commit_async(struct srdb_update_transact *utr,
+			     transaction_cb_t cb, void *arg)
+{
+	return update_commit(utr, cb, arg) ? 0 : -1;
+}
+
 struct transaction *srdb_update(struct srdb *srdb, struct srdb_table *tbl,
 				struct srdb_entry *entry, unsigned int index)
 {
@@ -1307,44 +2472,215 @@ struct transaction *srdb_update(struct srdb *srdb, struct srdb_table *tbl,
 	if (!utr)
 		return NULL;
 
-	srdb_update_append(utr, index);
+	srdb_update_append(utr, index);
+
+	return srdb_update_commit(utr);
+}
+
+int srdb_update_async(struct srdb *srdb, struct srdb_table *tbl,
+		      struct srdb_entry *entry, unsigned int index,
+		      transaction_cb_t cb, void *arg)
+{
+	struct srdb_update_transact *utr;
+
+	utr = srdb_update_prepare(srdb, tbl, entry);
+	if (!utr)
+		return -1;
+
+	srdb_update_append(utr, index);
+
+	return srdb_update_commit_async(utr, cb, arg);
+}
+
+/* {"row": ..., "table": ..., "op": "update", "where": uuid == @entry} */
+static json_t *update_op(struct srdb_table *tbl,
+			 const struct srdb_descriptor *desc,
+			 struct srdb_entry *entry)
+{
+	json_t *op, *row, *uuid, *cond, *where;
+
+	op = json_object();
+	row = json_object();
+	uuid = json_array();
+	cond = json_array();
+	where = json_array();
+	if (!op || !row || !uuid || !cond || !where)
+		goto out_err;
+
+	write_desc_data(row, desc, entry);
+
+	json_array_append_new(uuid, json_string("uuid"));
+	json_array_append_new(uuid, json_string(entry->row));
+	json_array_append_new(cond, json_string("_uuid"));
+	json_array_append_new(cond, json_string("=="));
+	json_array_append_new(cond, uuid);
+	json_array_append_new(where, cond);
+
+	json_object_set_new(op, "row", row);
+	json_object_set_new(op, "table", json_string(tbl->name));
+	json_object_set_new(op, "op", json_string("update"));
+	json_object_set_new(op, "where", where);
+
+	return op;
+
+out_err:
+	json_decref(where);
+	json_decref(cond);
+	json_decref(uuid);
+	json_decref(row);
+	json_decref(op);
+	return NULL;
+}
+
+/* Update the column @index of @count rows in a single transaction */
+static struct transaction *update_rows(struct srdb *srdb,
+				       struct srdb_table *tbl,
+				       struct srdb_entry **entries,
+				       unsigned int count, unsigned int index,
+				       transaction_cb_t cb, void *arg)
+{
+	const struct srdb_descriptor *desc;
+	json_t *json, *params, *op;
+	unsigned int i;
+
+	desc = find_desc_fromindex(tbl, index);
+	if (!desc || !count)
+		return NULL;
+
+	json = json_object();
+	params = json_array();
+	if (!json || !params)
+		goto out_err;
+
+	json_array_append_new(params,
+			      json_string(srdb->conf->ovsdb_database));
+
+	for (i = 0; i < count; i++) {
+		op = update_op(tbl, desc, entries[i]);
+		if (!op)
+			goto out_err;
+		json_array_append_new(params, op);
+	}
+
+	json_object_set_new(json, "method", json_string("transact"));
+	json_object_set_new(json, "params", params);
+
+	return submit_transaction(srdb, tbl, SRDB_OP_UPDATE, json, cb, arg);
+
+out_err:
+	srdb_err("failed to build json object.");
+	json_decref(params);
+	json_decref(json);
+	return NULL;
+}
+
+/* The reply of the transaction holds one result per row.
+ * srdb_transaction_reply() waits for it.
+ */
+struct transaction *srdb_update_rows(struct srdb *srdb, struct srdb_table *tbl,
+				     struct srdb_entry **entries,
+				     unsigned int count, unsigned int index)
+{
+	return update_rows(srdb, tbl, entries, count, index, NULL, NULL);
+}
+
+/* @cb is called once, with the reply holding one result per row */
+int srdb_update_rows_async(struct srdb *srdb, struct srdb_table *tbl,
+			   struct srdb_entry **entries, unsigned int count,
+			   unsigned int index, transaction_cb_t cb, void *arg)
+{
+	return update_rows(srdb, tbl, entries, count, index, cb, arg) ? 0 : -1;
+}
+
+/* Wait for the reply of a synchronous transaction and release @tr. The
+ * caller owns the reply, NULL if the transaction failed.
+ */
+json_t *srdb_transaction_reply(struct transaction *tr)
+{
+	json_t *res;
+
+	res = sbuf_pop(tr->result);
+	free_transaction(tr);
+
+	return res;
+}
+
+/* Result of operation @idx of a transaction reply, NULL if it failed */
+static json_t *transaction_op_result(json_t *res, unsigned int idx)
+{
+	json_t *error, *jres, *jerr;
+
+	if (!res)
+		return NULL;
+
+	error = json_object_get(res, "error");
+
+	if (!error || !json_is_null(error))
+		return NULL;
+
+	jres = json_array_get(json_object_get(res, "result"), idx);
+	if (!json_is_object(jres))
+		return NULL;
+
+	jerr = json_object_get(jres, "error");
+	if (jerr && !json_is_null(jerr))
+		return NULL;
+
+	return jres;
+}
+
+/* Number of rows affected by operation @idx of an update or delete
+ * reply. The operations following a failed one are not applied.
+ */
+int srdb_result_op_count(json_t *res, unsigned int idx, int *count)
+{
+	json_t *jres;
+
+	jres = transaction_op_result(res, idx);
+	if (!jres)
+		return -1;
+
+	if (count)
+		*count = json_integer_value(json_object_get(jres, "count"));
+
+	return 0;
+}
+
+/* Number of rows affected by an update or delete reply */
+int srdb_result_count(json_t *res, int *count)
+{
+	return srdb_result_op_count(res, 0, count);
+}
+
+/* uuid of the row created by an insert reply */
+int srdb_result_uuid(json_t *res, char *uuid)
+{
+	json_t *jres, *juuid;
+
+	jres = transaction_op_result(res, 0);
+	if (!jres)
+		return -1;
+
+	juuid = json_array_get(json_object_get(jres, "uuid"), 1);
+	if (uuid)
+		strncpy(uuid, json_string_value(juuid), SLEN + 1);
 
-	return srdb_update_commit(utr);
+	return 0;
 }
 
 int srdb_update_result(struct transaction *tr, int *count)
 {
-	json_t *res, *error, *jres, *jcount, *jerr;
-	int ret = 0;
+	json_t *res;
+	int ret;
 
 	res = sbuf_pop(tr->result);
 
-	if (!res)
-		goto out_error;
-
-	error = json_object_get(res, "error");
-
-	if (!error || !json_is_null(error))
-		goto out_error;
-
-	jres = json_array_get(json_object_get(res, "result"), 0);
-
-	jerr = json_object_get(jres, "error");
-	if (jerr && !json_is_null(jerr))
-		goto out_error;
-
-	jcount = json_object_get(jres, "count");
-	if (count)
-		*count = json_integer_value(jcount);
+	ret = srdb_result_count(res, count);
 
-out_free:
 	if (res)
 		json_decref(res);
 	free_transaction(tr);
 	return ret;
-out_error:
-	ret = -1;
-	goto out_free;
 }
 
 int srdb_update_sync(struct srdb *srdb, struct srdb_table *tbl,
@@ -1373,51 +2709,53 @@ struct transaction *srdb_insert(struct srdb *srdb, struct srdb_table *tbl,
 			write_desc_data(row, tmp, entry);
 	}
 
-	tr = ovsdb_insert(srdb, tbl->name, row);
+	tr = ovsdb_insert(srdb, tbl, row, NULL, NULL);
 
 	json_decref(row);
 	return tr;
 }
 
-int srdb_insert_sync(struct srdb *srdb, struct srdb_table *tbl,
-		     struct srdb_entry *entry, char *uuid)
+int srdb_insert_async(struct srdb *srdb, struct srdb_table *tbl,
+		      struct srdb_entry *entry, transaction_cb_t cb, void *arg)
 {
-	json_t *res, *error, *jres, *juuid, *jerr;
+	const struct srdb_descriptor *tmp;
 	struct transaction *tr;
-	int ret = 0;
+	json_t *row;
 
-	tr = srdb_insert(srdb, tbl, entry);
-	if (!tr)
+	row = json_object();
+	if (!row)
 		return -1;
 
-	res = sbuf_pop(tr->result);
+	for (tmp = tbl->desc; tmp->name; tmp++) {
+		if (!tmp->builtin)
+			write_desc_data(row, tmp, entry);
+	}
 
-	if (!res)
-		goto out_error;
+	tr = ovsdb_insert(srdb, tbl, row, cb, arg);
 
-	error = json_object_get(res, "error");
+	json_decref(row);
+	return tr ? 0 : -1;
+}
 
-	if (!error || !json_is_null(error))
-		goto out_error;
+int srdb_insert_sync(struct srdb *srdb, struct srdb_table *tbl,
+		     struct srdb_entry *entry, char *uuid)
+{
+	struct transaction *tr;
+	json_t *res;
+	int ret;
 
-	jres = json_array_get(json_object_get(res, "result"), 0);
+	tr = srdb_insert(srdb, tbl, entry);
+	if (!tr)
+		return -1;
 
-	jerr = json_object_get(jres, "error");
-	if (jerr && !json_is_null(jerr))
-		goto out_error;
+	res = sbuf_pop(tr->result);
 
-	juuid = json_array_get(json_object_get(jres, "uuid"), 1);
-	if (uuid)
-		strncpy(uuid, json_string_value(juuid), SLEN + 1);
+	ret = srdb_result_uuid(res, uuid);
 
-out_free:
 	if (res)
 		json_decref(res);
 	free_transaction(tr);
 	return ret;
-out_error:
-	ret = -1;
-	goto out_free;
 }
 
 /**
@@ -1428,7 +2766,6 @@ struct srdb *srdb_new(struct ovsdb_config *conf, int (*print) (const char *, ...
 {
 	struct srdb *srdb;
 	int i;
-	int envent_inits = 0;
 
 	srdb = malloc(sizeof(*srdb));
 	if (!srdb)
@@ -1441,35 +2778,47 @@ struct srdb *srdb_new(struct ovsdb_config *conf, int (*print) (const char *, ...
 		goto out_free_srdb;
 
 	srdb->conf = conf;
+	srdb->backend = &ovsdb_backend;
+	if (!strncmp(conf->ovsdb_server, SRDB_MEM_PREFIX,
+		     strlen(SRDB_MEM_PREFIX)))
+		srdb->backend = &srdb_mem_backend;
+	srdb->backend_data = NULL;
+	memset(&srdb->stats, 0, sizeof(srdb->stats));
+
+	srdb->tr_next = 0;
+	srdb->stopping = false;
 	srdb->tr_workers = malloc(conf->ntransacts * sizeof(*srdb->tr_workers));
 	if (!srdb->tr_workers)
 		goto out_free_tables;
-	for (i = 0; i < conf->ntransacts; i++, envent_inits++) {
+	for (i = 0; i < conf->ntransacts; i++) {
 		srdb->tr_workers[i].srdb = srdb;
-		srdb->tr_workers[i].event_fd = eventfd(0, 0);
-		if (srdb->tr_workers[i].event_fd < 0)
-			goto out_close_events;
+		srdb->tr_workers[i].idle = false;
+		srdb->tr_workers[i].event_fd = -1;
 	}
 
 	srdb->monitors = llist_node_alloc();
 	if (!srdb->monitors)
-		goto out_close_events;
+		goto out_free_workers;
 
-	srdb->transactions = sbuf_new(2 * conf->ntransacts);
+	srdb->transactions = sbuf_new(SRDB_TR_QUEUE > 2 * conf->ntransacts ?
+				      SRDB_TR_QUEUE : 2 * conf->ntransacts);
 	if (!srdb->transactions)
 		goto out_free_monitors;
 
+	if (srdb->backend->init(srdb) < 0)
+		goto out_free_transactions;
+
 	for (i = 0; i < conf->ntransacts; i++)
 		pthread_create(&srdb->tr_workers[i].thread, NULL,
-			       transaction_worker, &srdb->tr_workers[i]);
+			       srdb->backend->tr_worker, &srdb->tr_workers[i]);
 
 	return srdb;
 
+out_free_transactions:
+	sbuf_destroy(srdb->transactions);
 out_free_monitors:
 	llist_node_destroy(srdb->monitors);
-out_close_events:
-	for (i = 0; i < envent_inits; i++)
-		close(srdb->tr_workers[i].event_fd);
+out_free_workers:
 	free(srdb->tr_workers);
 out_free_tables:
 	srdb_free_tables(srdb->tables);
@@ -1480,28 +2829,40 @@ out_free_srdb:
 
 void srdb_destroy(struct srdb *srdb)
 {
+	struct transaction *tr;
 	struct llist_node *iter;
 	struct monitor_desc *md;
 	int i;
 
+	srdb_stats_stop(srdb);
+
+	/* each worker stops on the first NULL transaction it pops, or when
+	 * it is waiting to reconnect
+	 */
+	__atomic_store_n(&srdb->stopping, true, __ATOMIC_SEQ_CST);
 	for (i = 0; i < srdb->conf->ntransacts; i++)
-		sbuf_push(srdb->transactions, NULL);
-	wakeup_tr_workers(srdb);
+		srdb->backend->submit(srdb, NULL);
 
-	for (i = 0; i < srdb->conf->ntransacts; i++) {
+	for (i = 0; i < srdb->conf->ntransacts; i++)
 		pthread_join(srdb->tr_workers[i].thread, NULL);
-		close(srdb->tr_workers[i].event_fd);
+
+	/* transactions that no worker could send */
+	while (!sbuf_trypop(srdb->transactions, (void **)&tr)) {
+		if (tr)
+			complete_transaction(tr, NULL);
 	}
 
 	llist_node_foreach(srdb->monitors, iter) {
 		md = iter->data;
-		sem_post(&md->stop);
+		srdb->backend->stop_monitor(md);
 		pthread_join(md->thread, NULL);
-		free(md);
+		monitor_free(md);
 	}
 
 	llist_node_destroy(srdb->monitors);
 
+	srdb->backend->destroy(srdb);
+
 	free(srdb->tr_workers);
 	sbuf_destroy(srdb->transactions);
 	srdb_free_tables(srdb->tables);
@@ -1517,7 +2878,7 @@ void srdb_monitor_join_all(struct srdb *srdb)
 		md = iter->data;
 		pthread_join(md->thread, NULL);
 		llist_node_remove(srdb->monitors, iter);
-		free(md);
+		monitor_free(md);
 	}
 }
 
@@ -1536,6 +2897,29 @@ struct transaction *create_transaction(json_t *json)
 	}
 
 	tr->json = json;
+	tr->cb = NULL;
+	tr->cb_arg = NULL;
+	tr->srdb = NULL;
+	tr->started = 0;
+
+	return tr;
+}
+
+struct transaction *create_transaction_cb(json_t *json, transaction_cb_t cb,
+					  void *arg)
+{
+	struct transaction *tr;
+
+	tr = malloc(sizeof(*tr));
+	if (!tr)
+		return NULL;
+
+	tr->json = json;
+	tr->result = NULL;
+	tr->cb = cb;
+	tr->cb_arg = arg;
+	tr->srdb = NULL;
+	tr->started = 0;
 
 	return tr;
 }
@@ -1543,86 +2927,172 @@ struct transaction *create_transaction(json_t *json)
 void free_transaction(struct transaction *tr)
 {
 	json_decref(tr->json);
-	sbuf_destroy(tr->result);
+	if (tr->result)
+		sbuf_destroy(tr->result);
 	free(tr);
 }
 
+/* Called by the backends when the transaction leaves the queue */
+void start_transaction(struct transaction *tr)
+{
+	struct srdb_stats *stats;
+
+	if (!tr->srdb)
+		return;
+
+	stats = &tr->srdb->stats;
+	tr->started = srdb_now_us();
+
+	__atomic_sub_fetch(&stats->queue_depth, 1, __ATOMIC_RELAXED);
+	srdb_hist_add(&stats->wait, tr->started - tr->queued);
+}
+
+static void transaction_stats(struct transaction *tr, json_t *res)
+{
+	struct srdb_stats *stats = &tr->srdb->stats;
+
+	if (!tr->started)
+		__atomic_sub_fetch(&stats->queue_depth, 1, __ATOMIC_RELAXED);
+
+	if (!res) {
+		__atomic_add_fetch(&stats->failed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	__atomic_add_fetch(&stats->completed, 1, __ATOMIC_RELAXED);
+
+	if (tr->started && tr->tbl)
+		srdb_hist_add(&tr->tbl->stats.rtt[tr->op],
+			      srdb_now_us() - tr->started);
+}
+
+/* Hand the reply (NULL on failure) to the issuer of the transaction.
+ * Callbacks run in the transaction worker and must not wait for another
+ * transaction.
+ */
+void complete_transaction(struct transaction *tr, json_t *res)
+{
+	/* a synchronous issuer may release tr as soon as it has the reply */
+	if (tr->srdb)
+		transaction_stats(tr, res);
+
+	if (!tr->cb) {
+		sbuf_push(tr->result, res);
+		return;
+	}
+
+	tr->cb(res, tr->cb_arg);
+
+	if (res)
+		json_decref(res);
+	free_transaction(tr);
+}
+
+/* The transactions of srdb_update_rows_async() have one operation per
+ * row, so they are serialised to a string of their own size.
+ */
 static int send_transaction(int fd, json_t *json, unsigned int id)
 {
-	ssize_t len, ret;
+	size_t len, sent = 0;
 	json_t *method;
 	char *json_buf;
+	ssize_t ret;
 
 	method = json_object_get(json, "method");
 	if (!method || strcmp(json_string_value(method), "transact"))
 		return -1;
 
-	json_buf = malloc(JSON_BUFLEN);
+	json_object_set_new(json, "id", json_integer(id));
+
+	json_buf = json_dumps(json, JSON_COMPACT);
 	if (!json_buf)
 		return -1;
 
-	json_object_set_new(json, "id", json_integer(id));
+	len = strlen(json_buf);
 
-	len = json_dumpb(json, json_buf, JSON_BUFLEN, JSON_COMPACT);
-	if (!len)
-		goto out_err;
+	while (sent < len) {
+		ret = send(fd, json_buf + sent, len - sent, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			srdb_err("failed to send transaction (%s).",
+				 strerror(errno));
+			free(json_buf);
+			return -1;
+		}
 
-	ret = send(fd, json_buf, len, 0);
-	if (ret < 0) {
-		srdb_err("failed to send transaction (%s).", strerror(errno));
-		goto out_err;
+		sent += ret;
 	}
 
-	if (ret != len) {
-		srdb_err("partial send (%ld < %ld) for transaction id %u.", ret,
-			 len, id);
-		goto out_err;
+	free(json_buf);
+	return 0;
+}
+
+/* Bytes received on a transaction connection and not parsed yet */
+struct tr_recvq {
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+/* Append what the socket has to @q, -1 if the connection is lost */
+static int recv_transaction_data(int fd, struct tr_recvq *q)
+{
+	ssize_t ret;
+	char *buf;
+
+	if (q->len == q->size) {
+		if (q->size == JSON_BUFLEN_MONMAX) {
+			srdb_err("max transaction recvq exceeded.");
+			return -1;
+		}
+
+		buf = realloc(q->buf, q->size * 2);
+		if (!buf)
+			return -1;
+
+		q->buf = buf;
+		q->size *= 2;
 	}
 
-	ret = 0;
+	ret = recv(fd, q->buf + q->len, q->size - q->len, 0);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -1;
+	if (!ret)
+		return -1;
 
-out:
-	free(json_buf);
-	return ret;
-out_err:
-	ret = -1;
-	goto out;
+	q->len += ret;
+	return 0;
 }
 
-static json_t *recv_transaction_result(int fd)
+/* First complete message of @q, NULL if more data is needed */
+static json_t *recv_transaction_result(struct tr_recvq *q)
 {
-	json_t *json = NULL;
-	char *json_buf;
-	int ret;
+	json_error_t json_error;
+	size_t pos;
+	json_t *json;
 
-	json_buf = malloc(JSON_BUFLEN);
-	if (!json_buf)
+	if (!q->len)
 		return NULL;
 
-	/* transaction results are small, assume we'll get everything
-	 * in one shot.
-	 */
-
-	ret = recv(fd, json_buf, JSON_BUFLEN, 0);
-	if (ret <= 0)
-		goto out;
+	json = json_loadb(q->buf, q->len, JSON_DISABLE_EOF_CHECK, &json_error);
+	if (!json)
+		return NULL;
 
-	json = json_loadb(json_buf, ret, JSON_DISABLE_EOF_CHECK, NULL);
+	pos = json_error.position;
+	memmove(q->buf, q->buf + pos, q->len - pos);
+	q->len -= pos;
 
-out:
-	free(json_buf);
 	return json;
 }
 
-static json_t *fetch_transaction_result(int fd)
+/* Next transaction result of @q, the echo requests are answered */
+static json_t *fetch_transaction_result(int fd, struct tr_recvq *q)
 {
 	json_t *json, *method, *error;
 
-	/* data available on ovsdb socket
-	 * echo, and if pending, transaction result
-	 */
-
-	json = recv_transaction_result(fd);
+next:
+	json = recv_transaction_result(q);
 	if (!json)
 		return NULL;
 
@@ -1637,7 +3107,7 @@ static json_t *fetch_transaction_result(int fd)
 		}
 
 		json_decref(json);
-		return NULL;
+		goto next;
 	}
 
 	/* transaction result */
@@ -1646,25 +3116,50 @@ static json_t *fetch_transaction_result(int fd)
 
 	/* unknown */
 	json_decref(json);
-	return NULL;
+	goto next;
 }
 
-static void *transaction_worker(void *args)
+/* Returns 0 with the next transaction in @tr, or -1 after having marked
+ * the worker idle if the queue is empty.
+ */
+static int tr_worker_pop(struct tr_thread *thread, struct transaction **tr)
+{
+	struct sbuf *transactions = thread->srdb->transactions;
+
+	if (!sbuf_trypop(transactions, (void **)tr))
+		return 0;
+
+	/* a transaction pushed after this store finds us idle and wakes us */
+	__atomic_store_n(&thread->idle, true, __ATOMIC_SEQ_CST);
+
+	if (sbuf_trypop(transactions, (void **)tr))
+		return -1;
+
+	__atomic_store_n(&thread->idle, false, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+/* Serve transactions over @fd until the connection is lost, return 0 if
+ * the worker was asked to stop. Only the transaction sent on @fd is failed
+ * with the connection, the others stay queued for the connected workers.
+ */
+static int tr_worker_session(struct tr_thread *thread, int fd)
 {
 	struct transaction *tr = NULL;
 	unsigned int transact_id = 0;
-	struct tr_thread *thread = args;
-	struct srdb *srdb = thread->srdb;
 	int event_fd = thread->event_fd;
-	bool pending = false;
+	bool pending = false, closed = false;
+	struct tr_recvq q;
 	struct pollfd pfd[2];
-	int fd, ready;
-	json_t *json;
 	uint64_t event = 0;
+	json_t *json;
+	int ready;
 
-	fd = ovsdb_socket(srdb->conf);
-	if (fd < 0)
-		return NULL;
+	q.size = JSON_BUFLEN;
+	q.len = 0;
+	q.buf = malloc(q.size);
+	if (!q.buf)
+		return -1;
 
 	pfd[0].fd = fd;
 	pfd[0].events = POLLIN | POLLPRI;
@@ -1672,54 +3167,175 @@ static void *transaction_worker(void *args)
 	pfd[1].events = POLLIN;
 
 	for (;;) {
+		/* process new transaction only if no result is pending */
+		if (!pending && !tr_worker_pop(thread, &tr)) {
+			if (!tr) {
+				free(q.buf);
+				return 0;
+			}
+
+			start_transaction(tr);
+			if (send_transaction(fd, tr->json, ++transact_id) < 0) {
+				srdb_err("failed to send transaction id %u\n",
+					 transact_id);
+				complete_transaction(tr, NULL);
+				break;
+			}
+
+			pending = true;
+		}
+
 		ready = poll(pfd, 2, -1);
 		if (ready < 0) {
+			if (errno == EINTR)
+				continue;
 			srdb_err("%s: poll", strerror(errno));
 			break;
 		}
 
-		if (ready && (pfd[0].revents & POLLERR
-			      || pfd[1].revents & POLLERR)) {
-			srdb_err("%s: poll_revents", strerror(errno));
-			break;
-		}
+		if (pfd[0].revents & (POLLIN | POLLPRI)) {
+			if (recv_transaction_data(fd, &q) < 0)
+				closed = true;
+
+			while ((json = fetch_transaction_result(fd, &q))) {
+				if (!pending) {
+					srdb_err("received unknown transaction result.");
+					json_decref(json);
+					continue;
+				}
 
-		if (ready && pfd[0].revents & (POLLIN | POLLPRI)) {
-			json = fetch_transaction_result(fd);
-			if (json && !pending) {
-				srdb_err("received unknown transaction result.");
-				json_decref(json);
-			} else if (json) {
-				sbuf_push(tr->result, json);
+				complete_transaction(tr, json);
 				pending = false;
 			}
 		}
 
-		if (ready && pfd[1].revents & POLLIN
+		if (closed || pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+			break;
+
+		if (pfd[1].revents & POLLIN
 		    && read(event_fd, &event, sizeof(event)) != sizeof(event)) {
 			srdb_err("cannot read event fd");
 			break;
 		}
+	}
 
-		/* process new transaction only if no result is pending */
-		if (!pending) {
-			if (sbuf_trypop(srdb->transactions, (void **)&tr))
-				continue;
+	if (pending)
+		complete_transaction(tr, NULL);
 
-			if (!tr)
-				break;
+	free(q.buf);
+	return -1;
+}
 
-			if (send_transaction(fd, tr->json, ++transact_id) < 0) {
-				srdb_err("failed to send transaction id %u\n",
-					 transact_id);
-				break;
+/* Sleep @ms milliseconds, return false if srdb_destroy() was called */
+static bool tr_backoff_wait(struct tr_thread *thread, unsigned int ms)
+{
+	struct pollfd pfd = { .fd = thread->event_fd, .events = POLLIN };
+	uint64_t event;
+
+	if (poll(&pfd, 1, ms) > 0 && read(thread->event_fd, &event,
+					    sizeof(event)) < 0)
+		srdb_err("cannot read event fd");
+
+	return !__atomic_load_n(&thread->srdb->stopping, __ATOMIC_SEQ_CST);
+}
+
+static void *transaction_worker(void *args)
+{
+	unsigned int backoff = MON_BACKOFF_MIN;
+	struct tr_thread *thread = args;
+	struct srdb *srdb = thread->srdb;
+	int fd;
+
+	for (;;) {
+		fd = ovsdb_socket(srdb->conf);
+		if (fd >= 0) {
+			if (!tr_worker_session(thread, fd)) {
+				close(fd);
+				return NULL;
 			}
 
-			pending = true;
+			close(fd);
+			backoff = MON_BACKOFF_MIN;
 		}
+
+		/* a wakeup may have been meant for this worker, pass it on
+		 * to one that is connected
+		 */
+		__atomic_store_n(&thread->idle, false, __ATOMIC_SEQ_CST);
+		wakeup_tr_worker(srdb);
+
+		srdb_err("transaction worker disconnected, retrying in %u ms.",
+			 backoff);
+
+		if (!tr_backoff_wait(thread, backoff))
+			return NULL;
+
+		backoff = backoff * 2 < MON_BACKOFF_MAX ? backoff * 2 :
+			  MON_BACKOFF_MAX;
+	}
+}
+
+/* The asynchronous issuers are not blocked by a full queue */
+static int ovsdb_submit(struct srdb *srdb, struct transaction *tr)
+{
+	uint64_t event = 1;
+	int i;
+
+	if (tr && tr->cb) {
+		if (sbuf_trypush(srdb->transactions, tr) < 0)
+			return -1;
+	} else {
+		sbuf_push(srdb->transactions, tr);
 	}
 
-	close(fd);
+	wakeup_tr_worker(srdb);
 
-	return NULL;
+	/* the workers waiting to reconnect do not pop their NULL */
+	if (tr)
+		return 0;
+
+	for (i = 0; i < srdb->conf->ntransacts; i++) {
+		if (write(srdb->tr_workers[i].event_fd, &event, sizeof(event))
+		    != sizeof(event))
+			srdb_err("failed to stop a transaction worker.");
+	}
+
+	return 0;
+}
+
+static int ovsdb_init(struct srdb *srdb)
+{
+	int i;
+
+	for (i = 0; i < srdb->conf->ntransacts; i++) {
+		srdb->tr_workers[i].event_fd = eventfd(0, 0);
+		if (srdb->tr_workers[i].event_fd < 0)
+			goto out_close_events;
+	}
+
+	return 0;
+
+out_close_events:
+	while (i--)
+		close(srdb->tr_workers[i].event_fd);
+	return -1;
+}
+
+static void ovsdb_destroy(struct srdb *srdb)
+{
+	int i;
+
+	for (i = 0; i < srdb->conf->ntransacts; i++)
+		close(srdb->tr_workers[i].event_fd);
 }
+
+/* JSON-RPC connections to an ovsdb-server */
+static const struct srdb_backend ovsdb_backend = {
+	.name		= "ovsdb",
+	.init		= ovsdb_init,
+	.destroy	= ovsdb_destroy,
+	.submit		= ovsdb_submit,
+	.tr_worker	= transaction_worker,
+	.monitor	= ovsdb_monitor_start,
+	.stop_monitor	= ovsdb_monitor_stop,
+};
@@ -1,13 +1,18 @@
 #ifndef _SRDB_H
 #define _SRDB_H
 
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <jansson.h>
 
 #include "sbuf.h"
+#include "srdb_stats.h"
 
 #define SLEN	127
 #define SLEN_LIST	7 * SLEN
@@ -33,6 +38,24 @@ struct srdb_descriptor {
 struct srdb_entry {
 	char row[SLEN + 1];
 	char version[SLEN + 1];
+	char *arena; /* storage of the decoded SRDB_VARSTR columns */
+	size_t arena_len;
+	size_t arena_size;
+	struct slab *pool; /* entry allocated by alloc_srdb_entry() */
+};
+
+/* Compact layout of a row: integer columns are stored inline and string
+ * columns as offsets into the arena that follows the slots, in the order
+ * of the table descriptors. The whole entry is a single allocation.
+ * The table caches keep their rows in this layout.
+ */
+#define SRDB_COMPACT_NONE	0xffffffff
+
+struct srdb_compact_entry {
+	unsigned int index_mask;
+	unsigned int nslots;
+	unsigned int arena_len;
+	uint32_t slots[];
 };
 
 typedef int (*table_insert_cb_t)(struct srdb_entry *);
@@ -40,17 +63,42 @@ typedef int (*table_update_cb_t)(struct srdb_entry *, struct srdb_entry *,
 				 unsigned int);
 typedef int (*table_delete_cb_t)(struct srdb_entry *);
 
+/* Row change of a monitored table. For updates, @diff holds the old
+ * values of the fields set in @fmask.
+ */
+#define SRDB_OP_INSERT	1
+#define SRDB_OP_UPDATE	2
+#define SRDB_OP_DELETE	3
+
+struct srdb_row_change {
+	int op;
+	struct srdb_entry *entry;
+	struct srdb_entry *diff;
+	unsigned int fmask;
+};
+
+typedef int (*table_batch_cb_t)(struct srdb_row_change *, unsigned int);
+
+struct srdb_cache;
+struct srdb_decoder;
+struct slab;
+
 struct srdb_table {
 	const char *name;
 	const struct srdb_descriptor *desc_tmpl;
 	struct srdb_descriptor *desc;
+	struct srdb_decoder *decoder;
+	struct slab *pool;
 	size_t desc_size;
 	size_t entry_size;
 	table_insert_cb_t cb_insert;
 	table_update_cb_t cb_update;
 	table_delete_cb_t cb_delete;
+	table_batch_cb_t cb_batch;
 	sem_t initial_read;
 	bool delayed_free;
+	struct srdb_cache *cache; /* optional local replica */
+	struct srdb_table_stats stats;
 };
 
 struct ovsdb_config {
@@ -60,9 +108,21 @@ struct ovsdb_config {
 	int ntransacts;
 };
 
+/* Completion of an asynchronous transaction. @res is the reply of the
+ * server, or NULL if the transaction could not be sent.
+ */
+typedef void (*transaction_cb_t)(json_t *res, void *arg);
+
 struct transaction {
 	json_t *json;
 	struct sbuf *result;
+	transaction_cb_t cb;
+	void *cb_arg;
+	struct srdb *srdb;
+	struct srdb_table *tbl;
+	int op; /* SRDB_OP_* */
+	uint64_t queued; /* us */
+	uint64_t started;
 };
 
 #define OVSDB_UPDATE_FORMAT						\
@@ -79,6 +139,18 @@ struct transaction {
 	"{\"%s\":[{\"select\":{\"modify\":%s,\"initial\":%s,"		\
 	"\"insert\":%s,\"delete\":%s}}]}]}"
 
+/* monitor_cond_since always selects every operation: the monitor keeps
+ * a local copy of the rows to resolve "modify" diffs and to compute the
+ * delta after a resynchronisation. Operations are filtered against
+ * mon_flags before the table callbacks are called.
+ */
+#define OVSDB_MONITOR_COND_SINCE_FORMAT					\
+	"{\"id\":0,\"method\":\"monitor_cond_since\",\"params\":"	\
+	"[\"%s\",\"%s\",{\"%s\":[{\"select\":{\"modify\":true,"		\
+	"\"initial\":true,\"insert\":true,\"delete\":true}}]},\"%s\"]}"
+
+#define OVSDB_TXN_ID_ZERO	"00000000-0000-0000-0000-000000000000"
+
 #define OVSDB_DELETE_FORMAT						\
 	"{\"method\":\"transact\",\"params\":[\"%s\",{"			\
 	"\"table\":\"%s\",\"op\":\"delete\","				\
@@ -88,6 +160,13 @@ struct transaction {
 #define MON_INSERT	1 << 1
 #define MON_UPDATE	1 << 2
 #define MON_DELETE	1 << 3
+#define MON_ALL		(MON_INITIAL | MON_INSERT | MON_UPDATE | MON_DELETE)
+
+/* Reconnection backoff of the monitors (ms) */
+#define MON_BACKOFF_MIN	100
+#define MON_BACKOFF_MAX	10000
+
+struct hashmap;
 
 struct monitor_desc {
 	pthread_t thread;
@@ -95,14 +174,26 @@ struct monitor_desc {
 	struct srdb_table *tbl;
 	int mon_flags;
 	sem_t stop;
+	int stop_fd; /* ovsdb backend, readable once stopped */
 	sem_t zombie;
 	int mon_status;
+	char last_txn_id[SLEN + 1];
+	bool legacy; /* server does not support monitor_cond_since */
+	bool synced; /* initial contents received at least once */
+	struct hashmap *rows; /* uuid -> struct mon_row */
+	struct srdb_row_change *batch; /* changes of the current message */
+	unsigned int batch_len;
+	unsigned int batch_size;
+	unsigned int generation;
+	unsigned int reconnects;
+	void *backend_data;
 };
 
 enum {
 	MON_STATUS_STARTING	= 0,
 	MON_STATUS_RUNNING	= 1,
 	MON_STATUS_FINISHED	= 2,
+	MON_STATUS_RECONNECTING	= 3, /* Connection lost, waiting to resync */
 	MON_STATUS_CONNREFUSED	= -1, /* Cannot create ovsdb socket */
 	MON_STATUS_CONNCLOSED	= -2, /* Connection closed remotely */
 	MON_STATUS_NOMEM	= -3, /* Cannot allocate memory */
@@ -114,15 +205,37 @@ struct srdb;
 struct tr_thread {
 	pthread_t thread;
 	int event_fd;
+	bool idle; /* waiting on event_fd for a transaction */
 	struct srdb *srdb;
 };
 
+/* Storage behind a srdb handle, selected from the ovsdb_server string.
+ * Transactions handed to submit() are executed by the tr_worker threads
+ * and finished with complete_transaction(); submit(NULL) stops one
+ * worker. monitor() starts desc->thread, which feeds the table until
+ * stop_monitor() and then calls srdb_monitor_release().
+ */
+struct srdb_backend {
+	const char *name;
+	int (*init)(struct srdb *srdb);
+	void (*destroy)(struct srdb *srdb);
+	int (*submit)(struct srdb *srdb, struct transaction *tr);
+	void *(*tr_worker)(void *args);
+	int (*monitor)(struct monitor_desc *desc);
+	void (*stop_monitor)(struct monitor_desc *desc);
+};
+
 struct srdb {
 	struct ovsdb_config *conf;
+	const struct srdb_backend *backend;
+	void *backend_data;
 	struct srdb_table *tables;
 	struct sbuf *transactions;
 	struct tr_thread *tr_workers;
+	unsigned int tr_next; /* first worker probed by the next wakeup */
+	bool stopping; /* set by srdb_destroy() */
 	struct llist_node *monitors;
+	struct srdb_stats stats;
 };
 
 #define _row		entry.row
@@ -214,6 +327,7 @@ enum flow_status {
 	FLOW_STATUS_RUNNING	= 1,
 	FLOW_STATUS_EXPIRED	= 2,
 	FLOW_STATUS_ORPHAN	= 3,
+	FLOW_STATUS_REVOKED	= 4, /* denied by reloaded rules */
 };
 
 struct srdb_flowreq_entry {
@@ -252,6 +366,7 @@ enum flowreq_status {
 	REQ_STATUS_ERROR	= 4,
 	REQ_STATUS_NOROUTER	= 6,
 	REQ_STATUS_NOPREFIX	= 7,
+	REQ_STATUS_OVERLOAD	= 8,
 };
 
 struct srdb_linkstate_entry {
@@ -339,6 +454,8 @@ enum {
 int srdb_monitor(struct srdb *srdb, const char *table, int mon_flags,
 		 table_insert_cb_t cb_insert, table_update_cb_t cb_update,
 		 table_delete_cb_t cb_delete, bool delayed_free, bool sync);
+int srdb_monitor_batch(struct srdb *srdb, const char *table, int mon_flags,
+		       table_batch_cb_t cb_batch, bool delayed_free, bool sync);
 struct transaction *srdb_update(struct srdb *srdb, struct srdb_table *tbl,
 				struct srdb_entry *entry,
 				unsigned int index);
@@ -363,8 +480,41 @@ struct transaction *srdb_delete(struct srdb *srdb, struct srdb_table *tbl,
 int srdb_delete_sync(struct srdb *srdb, struct srdb_table *tbl,
 		     struct srdb_entry *entry, int *count);
 
+/* The asynchronous calls never block: they return -1 without calling @cb
+ * when SRDB_TR_QUEUE transactions are already waiting for the workers.
+ * The synchronous calls wait for a free slot instead.
+ */
+#define SRDB_TR_QUEUE	1024
+
+int srdb_insert_async(struct srdb *srdb, struct srdb_table *tbl,
+		      struct srdb_entry *entry, transaction_cb_t cb, void *arg);
+int srdb_update_async(struct srdb *srdb, struct srdb_table *tbl,
+		      struct srdb_entry *entry, unsigned int index,
+		      transaction_cb_t cb, void *arg);
+int srdb_update_commit_async(struct srdb_update_transact *utr,
+			     transaction_cb_t cb, void *arg);
+int srdb_update_rows_async(struct srdb *srdb, struct srdb_table *tbl,
+			   struct srdb_entry **entries, unsigned int count,
+			   unsigned int index, transaction_cb_t cb, void *arg);
+struct transaction *srdb_update_rows(struct srdb *srdb, struct srdb_table *tbl,
+				     struct srdb_entry **entries,
+				     unsigned int count, unsigned int index);
+json_t *srdb_transaction_reply(struct transaction *tr);
+int srdb_delete_async(struct srdb *srdb, struct srdb_table *tbl,
+		      struct srdb_entry *entry, transaction_cb_t cb, void *arg);
+int srdb_result_count(json_t *res, int *count);
+int srdb_result_op_count(json_t *res, unsigned int idx, int *count);
+int srdb_result_uuid(json_t *res, char *uuid);
+
 struct transaction *create_transaction(json_t *json);
+struct transaction *create_transaction_cb(json_t *json, transaction_cb_t cb,
+					  void *arg);
 void free_transaction(struct transaction *tr);
+void start_transaction(struct transaction *tr);
+void complete_transaction(struct transaction *tr, json_t *res);
+
+int srdb_monitor_apply(struct monitor_desc *desc, json_t *table_updates);
+void srdb_monitor_release(struct monitor_desc *desc);
 
 struct srdb_table *srdb_get_tables(void);
 void srdb_free_tables(struct srdb_table *tbl);
@@ -374,6 +524,33 @@ struct srdb *srdb_new(struct ovsdb_config *conf, int (*print) (const char *, ...
 void srdb_destroy(struct srdb *srdb);
 void free_srdb_entry(struct srdb_descriptor *desc,
  		     struct srdb_entry *entry);
+struct srdb_entry *alloc_srdb_entry(struct srdb_table *tbl);
+void clear_srdb_entry(struct srdb_descriptor *desc,
+		      struct srdb_entry *entry);
+unsigned int fill_srdb_entry(struct srdb_table *tbl,
+			     struct srdb_entry *entry, const char *uuid,
+			     json_t *line_json);
+
+struct srdb_compact_entry *srdb_compact_decode(struct srdb_table *tbl,
+					       const char *uuid,
+					       json_t *line_json);
+const char *srdb_compact_str(struct srdb_table *tbl,
+			     const struct srdb_compact_entry *ce,
+			     unsigned int index);
+int srdb_compact_int(struct srdb_table *tbl,
+		     const struct srdb_compact_entry *ce, unsigned int index);
+struct srdb_entry *srdb_compact_expand(struct srdb_table *tbl,
+				       const struct srdb_compact_entry *ce);
+
+static inline const char *srdb_compact_row(const struct srdb_compact_entry *ce)
+{
+	return (const char *)&ce->slots[ce->nslots];
+}
+
+static inline void srdb_compact_free(struct srdb_compact_entry *ce)
+{
+	free(ce);
+}
 
 void srdb_monitor_join_all(struct srdb *srdb);
 
@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "srdb_cache.h"
+#include "hashmap.h"
+#include "misc.h"
+
+#define load_acquire(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static const struct srdb_descriptor *find_desc(struct srdb_table *tbl,
+					       const char *column)
+{
+	struct srdb_descriptor *desc;
+
+	for (desc = tbl->desc; desc->name; desc++) {
+		if (!strcmp(desc->name, column))
+			return desc;
+	}
+
+	return NULL;
+}
+
+static const void *entry_value(const struct srdb_cache_index *idx,
+			       struct srdb_cache_entry *ce)
+{
+	const struct srdb_compact_entry *row = ce->row;
+	unsigned int slot = idx->slot;
+
+	if (idx->desc->type == SRDB_INT)
+		return &row->slots[slot];
+
+	if (row->slots[slot] == SRDB_COMPACT_NONE)
+		return "";
+
+	return srdb_compact_row(row) + row->slots[slot];
+}
+
+static unsigned int hash_value(const struct srdb_descriptor *desc,
+			       const void *key)
+{
+	if (desc->type == SRDB_INT)
+		return hashint(*(const int *)key);
+
+	return hash_str((void *)key);
+}
+
+static bool value_equal(const struct srdb_descriptor *desc, const void *k1,
+			const void *k2)
+{
+	if (desc->type == SRDB_INT)
+		return *(const int *)k1 == *(const int *)k2;
+
+	return !strcmp(k1, k2);
+}
+
+static struct srdb_cache_entry **bucket(struct srdb_cache_buckets *table,
+					int index, unsigned int hash)
+{
+	return &table->buckets[index][hash & (table->size - 1)];
+}
+
+static struct srdb_cache_buckets *buckets_new(size_t size,
+					      unsigned int nindexes)
+{
+	struct srdb_cache_buckets *table;
+	unsigned int i;
+
+	table = calloc(1, sizeof(*table));
+	if (!table)
+		return NULL;
+
+	table->size = size;
+
+	for (i = 0; i < nindexes; i++) {
+		table->buckets[i] = calloc(size, sizeof(*table->buckets[i]));
+		if (!table->buckets[i])
+			goto out_free;
+	}
+
+	return table;
+
+out_free:
+	while (i--)
+		free(table->buckets[i]);
+	free(table);
+	return NULL;
+}
+
+static void buckets_free(struct srdb_cache_buckets *table)
+{
+	unsigned int i;
+
+	for (i = 0; i < SRDB_CACHE_MAX_INDEXES; i++)
+		free(table->buckets[i]);
+
+	free(table);
+}
+
+struct srdb_cache *srdb_cache_new(struct srdb_table *tbl, size_t size)
+{
+	struct srdb_cache *cache;
+	size_t sz = 1;
+
+	while (sz < size)
+		sz <<= 1;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->table = buckets_new(sz, 0);
+	if (!cache->table) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->tbl = tbl;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	/* index 0 is the uuid of the rows */
+	if (srdb_cache_add_index(cache, "row") < 0) {
+		srdb_cache_destroy(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static void cache_entry_free(struct srdb_cache_entry *ce)
+{
+	srdb_compact_free(ce->row);
+	free(ce);
+}
+
+void srdb_cache_destroy(struct srdb_cache *cache)
+{
+	struct srdb_cache_buckets *table = cache->table;
+	struct srdb_cache_entry *ce, *tmp;
+	size_t b;
+
+	for (b = 0; cache->nindexes && b < table->size; b++) {
+		for (ce = table->buckets[0][b]; ce; ce = tmp) {
+			tmp = ce->next[0];
+			cache_entry_free(ce);
+		}
+	}
+
+	for (ce = cache->retired; ce; ce = tmp) {
+		tmp = ce->retired;
+		cache_entry_free(ce);
+	}
+
+	buckets_free(table);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/* Secondary indexes must be declared before the cache is populated */
+int srdb_cache_add_index(struct srdb_cache *cache, const char *column)
+{
+	struct srdb_cache_buckets *table = cache->table;
+	struct srdb_cache_index *idx;
+	const struct srdb_descriptor *desc;
+
+	if (cache->elems || cache->nindexes == SRDB_CACHE_MAX_INDEXES)
+		return -1;
+
+	desc = find_desc(cache->tbl, column);
+	if (!desc)
+		return -1;
+
+	table->buckets[cache->nindexes] = calloc(table->size,
+						sizeof(*table->buckets[0]));
+	if (!table->buckets[cache->nindexes])
+		return -1;
+
+	idx = &cache->indexes[cache->nindexes];
+	idx->desc = desc;
+	idx->slot = desc - cache->tbl->desc;
+
+	return cache->nindexes++;
+}
+
+int srdb_cache_index(struct srdb_cache *cache, const char *column)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->nindexes; i++) {
+		if (!strcmp(cache->indexes[i].desc->name, column))
+			return i;
+	}
+
+	return -1;
+}
+
+/* Attach a cache to @table, indexed by the NULL-terminated list of
+ * @columns. Must be called before srdb_monitor() for this table.
+ */
+int srdb_cache_enable(struct srdb *srdb, const char *table,
+		      const char *const *columns)
+{
+	struct srdb_cache *cache;
+	struct srdb_table *tbl;
+
+	tbl = srdb_table_by_name(srdb->tables, table);
+	if (!tbl || tbl->cache)
+		return -1;
+
+	cache = srdb_cache_new(tbl, SRDB_CACHE_DEFAULT_SIZE);
+	if (!cache)
+		return -1;
+
+	for (; columns && *columns; columns++) {
+		if (srdb_cache_add_index(cache, *columns) < 0) {
+			srdb_cache_destroy(cache);
+			return -1;
+		}
+	}
+
+	tbl->cache = cache;
+	return 0;
+}
+
+unsigned int srdb_cache_read_lock(struct srdb_cache *cache)
+{
+	unsigned int epoch;
+
+	for (;;) {
+		epoch = __atomic_load_n(&cache->epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&cache->readers[epoch & 1], 1,
+				   __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&cache->epoch, __ATOMIC_SEQ_CST) == epoch)
+			return epoch;
+
+		/* raced with a writer, retry in the new epoch */
+		__atomic_sub_fetch(&cache->readers[epoch & 1], 1,
+				   __ATOMIC_SEQ_CST);
+	}
+}
+
+void srdb_cache_read_unlock(struct srdb_cache *cache, unsigned int epoch)
+{
+	__atomic_sub_fetch(&cache->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+}
+
+/* Wait until no reader can still reference an unlinked entry */
+static void cache_synchronize(struct srdb_cache *cache)
+{
+	unsigned int epoch = cache->epoch;
+
+	__atomic_store_n(&cache->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+
+	while (__atomic_load_n(&cache->readers[epoch & 1], __ATOMIC_SEQ_CST))
+		sched_yield();
+}
+
+static void cache_free_retired(struct srdb_cache *cache)
+{
+	struct srdb_cache_entry *ce, *tmp;
+
+	for (ce = cache->retired; ce; ce = tmp) {
+		tmp = ce->retired;
+		cache_entry_free(ce);
+	}
+
+	cache->retired = NULL;
+	cache->nretired = 0;
+}
+
+/* Release the unlinked entries once no reader can reference them */
+static void cache_reclaim(struct srdb_cache *cache)
+{
+	if (!cache->retired)
+		return;
+
+	cache_synchronize(cache);
+	cache_free_retired(cache);
+}
+
+static void cache_retire(struct srdb_cache *cache, struct srdb_cache_entry *ce)
+{
+	ce->retired = cache->retired;
+	cache->retired = ce;
+
+	if (++cache->nretired >= SRDB_CACHE_MAX_RETIRED)
+		cache_reclaim(cache);
+}
+
+static struct srdb_cache_entry *
+cache_find(struct srdb_cache *cache, int index, struct srdb_cache_entry *ce,
+	   const void *key)
+{
+	const struct srdb_cache_index *idx = &cache->indexes[index];
+	unsigned int hash = hash_value(idx->desc, key);
+
+	if (!ce)
+		ce = load_acquire(bucket(load_acquire(&cache->table), index,
+					 hash));
+
+	for (; ce; ce = load_acquire(&ce->next[index])) {
+		if (ce->hash[index] == hash &&
+		    value_equal(idx->desc, entry_value(idx, ce), key))
+			return ce;
+	}
+
+	return NULL;
+}
+
+struct srdb_cache_entry *srdb_cache_lookup(struct srdb_cache *cache,
+					  int index, const void *key)
+{
+	if (index < 0 || (unsigned int)index >= cache->nindexes)
+		return NULL;
+
+	return cache_find(cache, index, NULL, key);
+}
+
+struct srdb_cache_entry *srdb_cache_lookup_next(struct srdb_cache *cache,
+					       int index,
+					       struct srdb_cache_entry *entry,
+					       const void *key)
+{
+	struct srdb_cache_entry *ce;
+
+	ce = load_acquire(&entry->next[index]);
+	if (!ce)
+		return NULL;
+
+	return cache_find(cache, index, ce, key);
+}
+
+static void cache_link(struct srdb_cache *cache,
+		       struct srdb_cache_buckets *table,
+		       struct srdb_cache_entry *ce)
+{
+	const struct srdb_cache_index *idx;
+	struct srdb_cache_entry **b;
+	unsigned int i;
+
+	for (i = 0; i < cache->nindexes; i++) {
+		idx = &cache->indexes[i];
+		ce->hash[i] = hash_value(idx->desc, entry_value(idx, ce));
+
+		b = bucket(table, i, ce->hash[i]);
+		ce->next[i] = *b;
+		ce->pprev[i] = b;
+		if (*b)
+			(*b)->pprev[i] = &ce->next[i];
+		store_release(b, ce);
+	}
+}
+
+static void cache_unlink(struct srdb_cache *cache, struct srdb_cache_entry *ce)
+{
+	unsigned int i;
+
+	/* ce->next[i] is kept for the readers still walking ce */
+	for (i = 0; i < cache->nindexes; i++) {
+		store_release(ce->pprev[i], ce->next[i]);
+		if (ce->next[i])
+			ce->next[i]->pprev[i] = ce->pprev[i];
+	}
+
+	cache->elems--;
+}
+
+/* Double the buckets once there are more rows than buckets. The readers
+ * may still be walking the chains of the current table, so the rows are
+ * linked into the new table through copies of their entries, and the old
+ * entries are released once no reader can see them.
+ */
+static void cache_grow(struct srdb_cache *cache)
+{
+	struct srdb_cache_buckets *old = cache->table, *table;
+	struct srdb_cache_entry *ce, *nce, *tmp, *copies = NULL;
+	size_t b;
+
+	table = buckets_new(old->size * 2, cache->nindexes);
+	if (!table)
+		return;
+
+	for (b = 0; b < old->size; b++) {
+		for (ce = old->buckets[0][b]; ce; ce = ce->next[0]) {
+			nce = malloc(sizeof(*nce));
+			if (!nce)
+				goto out_free;
+
+			nce->row = ce->row;
+			nce->retired = copies;
+			copies = nce;
+			cache_link(cache, table, nce);
+		}
+	}
+
+	store_release(&cache->table, table);
+	cache_synchronize(cache);
+
+	for (b = 0; b < old->size; b++) {
+		for (ce = old->buckets[0][b]; ce; ce = tmp) {
+			tmp = ce->next[0];
+			free(ce);
+		}
+	}
+
+	buckets_free(old);
+
+	/* the retired rows were unlinked before the synchronisation */
+	cache_free_retired(cache);
+	return;
+
+out_free:
+	for (ce = copies; ce; ce = tmp) {
+		tmp = ce->retired;
+		free(ce);
+	}
+
+	buckets_free(table);
+}
+
+/* Apply a row change in the "new"/"old" layout of the monitor updates.
+ * "new" holds all the columns of the row, it replaces the cached entry.
+ * A row that cannot be decoded is removed from the cache rather than kept
+ * in its previous version.
+ */
+int srdb_cache_apply(struct srdb_cache *cache, const char *uuid,
+		     json_t *modification)
+{
+	struct srdb_cache_entry *ce = NULL, *old;
+	json_t *new;
+	int ret = 0;
+
+	new = json_object_get(modification, "new");
+
+	if (new) {
+		ce = calloc(1, sizeof(*ce));
+		if (ce)
+			ce->row = srdb_compact_decode(cache->tbl, uuid, new);
+
+		if (!ce || !ce->row) {
+			free(ce);
+			ce = NULL;
+			ret = -1;
+		}
+	}
+
+	pthread_mutex_lock(&cache->lock);
+
+	old = cache_find(cache, 0, NULL, uuid);
+
+	/* readers see the new version before the old one disappears */
+	if (ce) {
+		cache_link(cache, cache->table, ce);
+		cache->elems++;
+	}
+
+	if (old) {
+		cache_unlink(cache, old);
+		cache_retire(cache, old);
+	}
+
+	if (cache->elems > cache->table->size)
+		cache_grow(cache);
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+void srdb_cache_flush(struct srdb_cache *cache)
+{
+	struct srdb_cache_buckets *table;
+	struct srdb_cache_entry *ce;
+	unsigned int i;
+	size_t b;
+
+	pthread_mutex_lock(&cache->lock);
+
+	table = cache->table;
+
+	for (b = 0; b < table->size; b++) {
+		for (ce = table->buckets[0][b]; ce; ce = ce->next[0]) {
+			ce->retired = cache->retired;
+			cache->retired = ce;
+		}
+	}
+
+	for (i = 0; i < cache->nindexes; i++) {
+		for (b = 0; b < table->size; b++)
+			store_release(&table->buckets[i][b], NULL);
+	}
+
+	cache->elems = 0;
+	cache_reclaim(cache);
+
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,91 @@
+#ifndef _SRDB_CACHE_H
+#define _SRDB_CACHE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "srdb.h"
+
+/* Local replica of a monitored table.
+ *
+ * The cache is fed by the monitor thread of the table and can be looked
+ * up without taking any lock. Rows are indexed by uuid ("row") and by
+ * every declared secondary column. Secondary indexes are not unique,
+ * all the rows with a given value are reached with srdb_cache_foreach.
+ *
+ * Rows are kept in the compact layout, their columns are read with
+ * srdb_compact_str() and srdb_compact_int() on entry->row.
+ *
+ * Readers must enclose the lookups and the use of the returned entries
+ * between srdb_cache_read_lock() and srdb_cache_read_unlock(). Entries
+ * are immutable: an update replaces the entry, and the old version is
+ * only released once all the readers that could see it are gone.
+ */
+
+#define SRDB_CACHE_MAX_INDEXES	8
+#define SRDB_CACHE_DEFAULT_SIZE	1024
+#define SRDB_CACHE_MAX_RETIRED	64
+
+struct srdb_cache_entry {
+	struct srdb_cache_entry *next[SRDB_CACHE_MAX_INDEXES];
+	struct srdb_cache_entry **pprev[SRDB_CACHE_MAX_INDEXES]; /* writers */
+	unsigned int hash[SRDB_CACHE_MAX_INDEXES];
+	struct srdb_cache_entry *retired;
+	struct srdb_compact_entry *row;
+};
+
+struct srdb_cache_index {
+	const struct srdb_descriptor *desc;
+	unsigned int slot; /* column of the compact rows */
+};
+
+/* Buckets of all the indexes. The table is replaced as a whole when the
+ * cache grows, so that readers always see a consistent size.
+ */
+struct srdb_cache_buckets {
+	size_t size;
+	struct srdb_cache_entry **buckets[SRDB_CACHE_MAX_INDEXES];
+};
+
+struct srdb_cache {
+	struct srdb_table *tbl;
+	unsigned int nindexes;
+	struct srdb_cache_index indexes[SRDB_CACHE_MAX_INDEXES];
+	struct srdb_cache_buckets *table;
+	size_t elems;
+	pthread_mutex_t lock; /* serialises writers */
+	struct srdb_cache_entry *retired; /* unlinked, waiting for readers */
+	unsigned int nretired;
+	unsigned int epoch;
+	unsigned int readers[2];
+};
+
+struct srdb_cache *srdb_cache_new(struct srdb_table *tbl, size_t size);
+void srdb_cache_destroy(struct srdb_cache *cache);
+int srdb_cache_add_index(struct srdb_cache *cache, const char *column);
+int srdb_cache_index(struct srdb_cache *cache, const char *column);
+int srdb_cache_enable(struct srdb *srdb, const char *table,
+		      const char *const *columns);
+
+int srdb_cache_apply(struct srdb_cache *cache, const char *uuid,
+		     json_t *modification);
+void srdb_cache_flush(struct srdb_cache *cache);
+
+unsigned int srdb_cache_read_lock(struct srdb_cache *cache);
+void srdb_cache_read_unlock(struct srdb_cache *cache, unsigned int epoch);
+
+struct srdb_cache_entry *srdb_cache_lookup(struct srdb_cache *cache,
+					  int index, const void *key);
+struct srdb_cache_entry *srdb_cache_lookup_next(struct srdb_cache *cache,
+					       int index,
+					       struct srdb_cache_entry *entry,
+					       const void *key);
+
+/* @key is the string itself for string columns and points to the value
+ * for integer columns.
+ */
+#define srdb_cache_foreach(cache, index, key, entry)			\
+	for ((entry) = srdb_cache_lookup(cache, index, key); (entry);	\
+	     (entry) = srdb_cache_lookup_next(cache, index, entry, key))
+
+#endif
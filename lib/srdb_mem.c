@@ -0,0 +1,738 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <jansson.h>
+
+#include "srdb_mem.h"
+#include "hashmap.h"
+#include "llist.h"
+#include "sbuf.h"
+
+struct mem_row {
+	char uuid[SLEN + 1];
+	json_t *row;
+};
+
+struct mem_table {
+	char name[SLEN + 1];
+	struct hashmap *rows; /* uuid -> struct mem_row */
+	struct llist_head monitors;
+	struct llist_head list;
+};
+
+struct mem_db {
+	char name[SLEN + 1];
+	unsigned int refcnt;
+	pthread_mutex_t lock; /* serialises the transactions */
+	struct llist_head tables;
+	struct llist_head list;
+	uint32_t tag;
+	unsigned long long seq;
+};
+
+/* updates of a table waiting for the monitor thread */
+struct mem_update {
+	json_t *updates;
+	struct llist_head list;
+};
+
+struct srdb_mem_monitor {
+	struct mem_db *db;
+	struct llist_head list; /* in mem_table monitors */
+	pthread_mutex_t lock;
+	sem_t pending;
+	struct llist_head queue;
+	bool stop;
+};
+
+static struct llist_head mem_dbs = { &mem_dbs, &mem_dbs };
+static pthread_mutex_t mem_dbs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct mem_table *mem_table_get(struct mem_db *db, const char *name)
+{
+	struct mem_table *mt;
+
+	llist_foreach(&db->tables, mt, list) {
+		if (!strcmp(mt->name, name))
+			return mt;
+	}
+
+	return NULL;
+}
+
+static struct mem_table *mem_table_add(struct mem_db *db, const char *name)
+{
+	struct mem_table *mt;
+
+	mt = malloc(sizeof(*mt));
+	if (!mt)
+		return NULL;
+
+	mt->rows = hmap_new(hash_str, compare_str);
+	if (!mt->rows) {
+		free(mt);
+		return NULL;
+	}
+
+	strncpy(mt->name, name, SLEN);
+	mt->name[SLEN] = 0;
+	llist_init(&mt->monitors);
+	llist_insert_tail(&db->tables, &mt->list);
+
+	return mt;
+}
+
+static void mem_table_free(struct mem_table *mt)
+{
+	struct hmap_entry *he, *tmp;
+	struct mem_row *r;
+
+	hmap_foreach_safe(mt->rows, he, tmp) {
+		r = he->elem;
+		json_decref(r->row);
+		free(r);
+	}
+
+	hmap_destroy(mt->rows);
+	free(mt);
+}
+
+static void mem_db_free(struct mem_db *db)
+{
+	struct mem_table *mt, *tmp;
+
+	llist_foreach_safe(&db->tables, mt, tmp, list)
+		mem_table_free(mt);
+
+	pthread_mutex_destroy(&db->lock);
+	free(db);
+}
+
+static struct mem_db *mem_db_get(const char *name)
+{
+	struct mem_db *db;
+
+	llist_foreach(&mem_dbs, db, list) {
+		if (!strcmp(db->name, name))
+			return db;
+	}
+
+	db = calloc(1, sizeof(*db));
+	if (!db)
+		return NULL;
+
+	strncpy(db->name, name, SLEN);
+	pthread_mutex_init(&db->lock, NULL);
+	llist_init(&db->tables);
+	db->tag = (uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)db;
+	llist_insert_tail(&mem_dbs, &db->list);
+
+	return db;
+}
+
+static int mem_init(struct srdb *srdb)
+{
+	const char *name = srdb->conf->ovsdb_server + strlen(SRDB_MEM_PREFIX);
+	struct srdb_table *tbl;
+	struct mem_db *db;
+	int ret = -1;
+
+	pthread_mutex_lock(&mem_dbs_lock);
+
+	db = mem_db_get(name);
+	if (!db)
+		goto out_unlock;
+
+	pthread_mutex_lock(&db->lock);
+	for (tbl = srdb->tables; tbl->name; tbl++) {
+		if (!mem_table_get(db, tbl->name) && !mem_table_add(db, tbl->name))
+			break;
+	}
+	pthread_mutex_unlock(&db->lock);
+
+	/* the tables already created are kept for the other users */
+	if (tbl->name) {
+		if (!db->refcnt) {
+			llist_remove(&db->list);
+			mem_db_free(db);
+		}
+		goto out_unlock;
+	}
+
+	db->refcnt++;
+	srdb->backend_data = db;
+	ret = 0;
+
+out_unlock:
+	pthread_mutex_unlock(&mem_dbs_lock);
+	return ret;
+}
+
+static void mem_destroy(struct srdb *srdb)
+{
+	struct mem_db *db = srdb->backend_data;
+
+	pthread_mutex_lock(&mem_dbs_lock);
+
+	if (!--db->refcnt) {
+		llist_remove(&db->list);
+		mem_db_free(db);
+	}
+
+	pthread_mutex_unlock(&mem_dbs_lock);
+}
+
+/* ["uuid", <uuid>] */
+static json_t *mem_json_uuid(const char *uuid)
+{
+	json_t *json;
+
+	json = json_array();
+	if (!json)
+		return NULL;
+
+	json_array_append_new(json, json_string("uuid"));
+	json_array_append_new(json, json_string(uuid));
+
+	return json;
+}
+
+/* {<key>: <value>}, the reference to @value is stolen */
+static json_t *mem_json_pair(const char *key, json_t *value)
+{
+	json_t *json;
+
+	json = json_object();
+	if (!json) {
+		json_decref(value);
+		return NULL;
+	}
+
+	json_object_set_new(json, key, value);
+
+	return json;
+}
+
+static void mem_uuid(struct mem_db *db, char *uuid)
+{
+	snprintf(uuid, SLEN + 1, "%08x-0000-4000-8000-%012llx", db->tag,
+		 ++db->seq);
+}
+
+static json_t *mem_new_version(struct mem_db *db)
+{
+	char uuid[SLEN + 1];
+
+	mem_uuid(db, uuid);
+
+	return mem_json_uuid(uuid);
+}
+
+static void mem_enqueue(struct srdb_mem_monitor *mm, json_t *updates)
+{
+	struct mem_update *up;
+
+	up = malloc(sizeof(*up));
+	if (!up) {
+		json_decref(updates);
+		return;
+	}
+
+	up->updates = updates;
+
+	pthread_mutex_lock(&mm->lock);
+	llist_insert_tail(&mm->queue, &up->list);
+	pthread_mutex_unlock(&mm->lock);
+
+	sem_post(&mm->pending);
+}
+
+/* Every monitor gets its own copy, the monitors modify the rows */
+static void mem_notify(struct mem_table *mt, json_t *updates)
+{
+	struct srdb_mem_monitor *mm;
+
+	llist_foreach(&mt->monitors, mm, list)
+		mem_enqueue(mm, json_deep_copy(updates));
+}
+
+/* Only the rows selected by their uuid are supported, which is what the
+ * srdb transactions use: [["_uuid", "==", ["uuid", <uuid>]]]
+ */
+static const char *mem_where_uuid(json_t *op)
+{
+	json_t *where, *cond;
+	const char *column, *func;
+
+	where = json_object_get(op, "where");
+	if (json_array_size(where) != 1)
+		return NULL;
+
+	cond = json_array_get(where, 0);
+	column = json_string_value(json_array_get(cond, 0));
+	func = json_string_value(json_array_get(cond, 1));
+	if (!column || !func || strcmp(column, "_uuid") || strcmp(func, "=="))
+		return NULL;
+
+	return json_string_value(json_array_get(json_array_get(cond, 2), 1));
+}
+
+/* Row with the default value of the columns missing from @values */
+static json_t *mem_new_row(struct srdb_table *tbl, json_t *values)
+{
+	struct srdb_descriptor *desc;
+	json_t *row;
+
+	row = json_object();
+	if (!row)
+		return NULL;
+
+	for (desc = tbl->desc; desc->name; desc++) {
+		if (desc->builtin)
+			continue;
+
+		if (desc->type == SRDB_INT)
+			json_object_set_new(row, desc->name, json_integer(0));
+		else
+			json_object_set_new(row, desc->name, json_string(""));
+	}
+
+	json_object_update(row, values);
+
+	return row;
+}
+
+static json_t *mem_insert(struct srdb *srdb, struct mem_table *mt,
+			  json_t *op, json_t *updates)
+{
+	struct mem_db *db = srdb->backend_data;
+	struct srdb_table *tbl;
+	struct mem_row *r;
+
+	tbl = srdb_table_by_name(srdb->tables, mt->name);
+	if (!tbl)
+		return NULL;
+
+	r = malloc(sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->row = mem_new_row(tbl, json_object_get(op, "row"));
+	if (!r->row) {
+		free(r);
+		return NULL;
+	}
+
+	mem_uuid(db, r->uuid);
+	json_object_set_new(r->row, "_version", mem_new_version(db));
+
+	if (hmap_set(mt->rows, r->uuid, r) < 0) {
+		json_decref(r->row);
+		free(r);
+		return NULL;
+	}
+
+	json_object_set_new(updates, r->uuid,
+			    mem_json_pair("insert", json_deep_copy(r->row)));
+
+	return mem_json_pair("uuid", mem_json_uuid(r->uuid));
+}
+
+static json_t *mem_update(struct srdb *srdb, struct mem_table *mt,
+			  json_t *op, json_t *updates)
+{
+	struct mem_db *db = srdb->backend_data;
+	json_t *diff, *value, *old, *prev;
+	const char *uuid, *column;
+	struct mem_row *r;
+
+	uuid = mem_where_uuid(op);
+	if (!uuid)
+		return NULL;
+
+	r = hmap_get(mt->rows, (void *)uuid);
+	if (!r)
+		return mem_json_pair("count", json_integer(0));
+
+	diff = json_object();
+	if (!diff)
+		return NULL;
+
+	json_object_foreach(json_object_get(op, "row"), column, value) {
+		old = json_object_get(r->row, column);
+		if (old && json_equal(old, value))
+			continue;
+
+		json_object_set(r->row, column, value);
+		json_object_set(diff, column, value);
+	}
+
+	/* a row modified twice in a transaction gets one update */
+	if (json_object_size(diff)) {
+		json_object_set_new(r->row, "_version", mem_new_version(db));
+		json_object_set(diff, "_version",
+				json_object_get(r->row, "_version"));
+
+		prev = json_object_get(json_object_get(updates, r->uuid),
+				       "modify");
+		if (prev)
+			json_object_update(prev, diff);
+		else
+			json_object_set_new(updates, r->uuid,
+					    mem_json_pair("modify",
+							  json_deep_copy(diff)));
+	}
+
+	json_decref(diff);
+
+	return mem_json_pair("count", json_integer(1));
+}
+
+static json_t *mem_delete(struct mem_table *mt, json_t *op, json_t *updates)
+{
+	const char *uuid;
+	struct mem_row *r;
+
+	uuid = mem_where_uuid(op);
+	if (!uuid)
+		return NULL;
+
+	r = hmap_get(mt->rows, (void *)uuid);
+	if (!r)
+		return mem_json_pair("count", json_integer(0));
+
+	json_object_set_new(updates, r->uuid, mem_json_pair("delete",
+								json_null()));
+	hmap_delete(mt->rows, r->uuid);
+	json_decref(r->row);
+	free(r);
+
+	return mem_json_pair("count", json_integer(1));
+}
+
+/* Table of @op, NULL if the operation is not supported */
+static struct mem_table *mem_check_op(struct srdb *srdb, struct mem_db *db,
+				      json_t *op)
+{
+	const char *name, *table;
+	struct mem_table *mt;
+
+	name = json_string_value(json_object_get(op, "op"));
+	table = json_string_value(json_object_get(op, "table"));
+	if (!name || !table)
+		return NULL;
+
+	mt = mem_table_get(db, table);
+	if (!mt)
+		return NULL;
+
+	if (!strcmp(name, "insert"))
+		return srdb_table_by_name(srdb->tables, table) ? mt : NULL;
+
+	if (!strcmp(name, "update") || !strcmp(name, "delete"))
+		return mem_where_uuid(op) ? mt : NULL;
+
+	return NULL;
+}
+
+/* Updates of @mt in the transaction, created on first use */
+static json_t *mem_table_updates(json_t *tables, struct mem_table *mt)
+{
+	json_t *updates;
+
+	updates = json_object_get(tables, mt->name);
+	if (updates)
+		return updates;
+
+	updates = json_object();
+	if (!updates)
+		return NULL;
+
+	json_object_set_new(tables, mt->name, updates);
+
+	return updates;
+}
+
+/* Execute the operations of a "transact" request and build the reply an
+ * ovsdb-server would send. Nothing is applied unless every operation is
+ * supported, and the monitors of a table get one update per transaction.
+ */
+json_t *srdb_mem_transact(struct srdb *srdb, json_t *json)
+{
+	struct mem_db *db = srdb->backend_data;
+	json_t *params, *op, *res, *results, *tables, *updates;
+	struct mem_table *mt;
+	const char *name;
+	size_t i, j;
+
+	params = json_object_get(json, "params");
+	results = json_array();
+	tables = json_object();
+	if (!results || !tables) {
+		json_decref(results);
+		json_decref(tables);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&db->lock);
+
+	for (i = 1; i < json_array_size(params); i++) {
+		if (mem_check_op(srdb, db, json_array_get(params, i)))
+			continue;
+
+		for (j = 1; j < i; j++)
+			json_array_append_new(results, json_null());
+		json_array_append_new(results,
+				      mem_json_pair("error",
+						    json_string("not supported")));
+		goto out_unlock;
+	}
+
+	for (i = 1; i < json_array_size(params); i++) {
+		op = json_array_get(params, i);
+		name = json_string_value(json_object_get(op, "op"));
+		mt = mem_check_op(srdb, db, op);
+
+		updates = mem_table_updates(tables, mt);
+		res = NULL;
+
+		if (!updates)
+			res = NULL;
+		else if (!strcmp(name, "insert"))
+			res = mem_insert(srdb, mt, op, updates);
+		else if (!strcmp(name, "update"))
+			res = mem_update(srdb, mt, op, updates);
+		else
+			res = mem_delete(mt, op, updates);
+
+		/* only an allocation failure ends the transaction here */
+		if (!res) {
+			json_array_append_new(results,
+					      mem_json_pair("error",
+						json_string("resources exhausted")));
+			break;
+		}
+
+		json_array_append_new(results, res);
+	}
+
+	llist_foreach(&db->tables, mt, list) {
+		updates = json_object_get(tables, mt->name);
+		if (json_object_size(updates))
+			mem_notify(mt, updates);
+	}
+
+out_unlock:
+	pthread_mutex_unlock(&db->lock);
+
+	json_decref(tables);
+
+	res = json_object();
+	if (!res) {
+		json_decref(results);
+		return NULL;
+	}
+
+	json_object_set_new(res, "id", json_null());
+	json_object_set_new(res, "result", results);
+	json_object_set_new(res, "error", json_null());
+
+	return res;
+}
+
+static int mem_submit(struct srdb *srdb, struct transaction *tr)
+{
+	if (tr && tr->cb)
+		return sbuf_trypush(srdb->transactions, tr);
+
+	sbuf_push(srdb->transactions, tr);
+	return 0;
+}
+
+static void *mem_tr_worker(void *args)
+{
+	struct tr_thread *thread = args;
+	struct srdb *srdb = thread->srdb;
+	struct transaction *tr;
+
+	while ((tr = sbuf_pop(srdb->transactions))) {
+		start_transaction(tr);
+		complete_transaction(tr, srdb_mem_transact(srdb, tr->json));
+	}
+
+	return NULL;
+}
+
+/* Subscribe to the changes of @table. The current rows are queued as
+ * "initial" updates in the same critical section as the registration, no
+ * transaction can be missed or seen twice.
+ */
+struct srdb_mem_monitor *srdb_mem_monitor_new(struct srdb *srdb,
+					      const char *table)
+{
+	struct mem_db *db = srdb->backend_data;
+	struct srdb_mem_monitor *mm;
+	struct hmap_entry *he;
+	struct mem_table *mt;
+	json_t *initial;
+	struct mem_row *r;
+
+	mm = calloc(1, sizeof(*mm));
+	if (!mm)
+		return NULL;
+
+	initial = json_object();
+	if (!initial)
+		goto out_free;
+
+	mm->db = db;
+	pthread_mutex_init(&mm->lock, NULL);
+	sem_init(&mm->pending, 0, 0);
+	llist_init(&mm->queue);
+
+	pthread_mutex_lock(&db->lock);
+
+	mt = mem_table_get(db, table);
+	if (!mt) {
+		pthread_mutex_unlock(&db->lock);
+		json_decref(initial);
+		goto out_destroy;
+	}
+
+	hmap_foreach(mt->rows, he) {
+		r = he->elem;
+		json_object_set_new(initial, r->uuid,
+				    mem_json_pair("initial",
+						  json_deep_copy(r->row)));
+	}
+
+	mem_enqueue(mm, initial);
+	llist_insert_tail(&mt->monitors, &mm->list);
+
+	pthread_mutex_unlock(&db->lock);
+
+	return mm;
+
+out_destroy:
+	pthread_mutex_destroy(&mm->lock);
+	sem_destroy(&mm->pending);
+out_free:
+	free(mm);
+	return NULL;
+}
+
+/* Wait for the next <table-updates2> object of the table, NULL once the
+ * monitor is stopped. The caller owns the returned reference.
+ */
+json_t *srdb_mem_monitor_next(struct srdb_mem_monitor *mm)
+{
+	struct mem_update *up;
+	json_t *updates;
+
+	sem_wait(&mm->pending);
+
+	pthread_mutex_lock(&mm->lock);
+	if (mm->stop) {
+		pthread_mutex_unlock(&mm->lock);
+		return NULL;
+	}
+
+	up = llist_first_entry(&mm->queue, struct mem_update, list);
+	llist_remove(&up->list);
+	pthread_mutex_unlock(&mm->lock);
+
+	updates = up->updates;
+	free(up);
+
+	return updates;
+}
+
+/* Wake up srdb_mem_monitor_next(), it returns NULL from now on */
+void srdb_mem_monitor_stop(struct srdb_mem_monitor *mm)
+{
+	pthread_mutex_lock(&mm->lock);
+	mm->stop = true;
+	pthread_mutex_unlock(&mm->lock);
+
+	sem_post(&mm->pending);
+}
+
+/* Unregister the monitor and drop the updates it did not process */
+void srdb_mem_monitor_free(struct srdb_mem_monitor *mm)
+{
+	struct mem_update *up, *tmp;
+
+	pthread_mutex_lock(&mm->db->lock);
+	llist_remove(&mm->list);
+	pthread_mutex_unlock(&mm->db->lock);
+
+	llist_foreach_safe(&mm->queue, up, tmp, list) {
+		json_decref(up->updates);
+		free(up);
+	}
+
+	pthread_mutex_destroy(&mm->lock);
+	sem_destroy(&mm->pending);
+	free(mm);
+}
+
+static void *mem_monitor(void *args)
+{
+	struct monitor_desc *desc = args;
+	struct srdb_mem_monitor *mm = desc->backend_data;
+	json_t *updates;
+
+	desc->mon_status = MON_STATUS_RUNNING;
+
+	while ((updates = srdb_mem_monitor_next(mm))) {
+		srdb_monitor_apply(desc, updates);
+		json_decref(updates);
+	}
+
+	desc->mon_status = MON_STATUS_FINISHED;
+
+	desc->backend_data = NULL;
+	srdb_mem_monitor_free(mm);
+	srdb_monitor_release(desc);
+
+	return NULL;
+}
+
+static int mem_monitor_start(struct monitor_desc *desc)
+{
+	struct srdb_mem_monitor *mm;
+
+	mm = srdb_mem_monitor_new(desc->srdb, desc->tbl->name);
+	if (!mm)
+		return -1;
+
+	desc->backend_data = mm;
+
+	if (pthread_create(&desc->thread, NULL, mem_monitor, desc)) {
+		desc->backend_data = NULL;
+		srdb_mem_monitor_free(mm);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void mem_monitor_stop(struct monitor_desc *desc)
+{
+	srdb_mem_monitor_stop(desc->backend_data);
+}
+
+const struct srdb_backend srdb_mem_backend = {
+	.name		= "mem",
+	.init		= mem_init,
+	.destroy	= mem_destroy,
+	.submit		= mem_submit,
+	.tr_worker	= mem_tr_worker,
+	.monitor	= mem_monitor_start,
+	.stop_monitor	= mem_monitor_stop,
+};
@@ -0,0 +1,32 @@
+#ifndef _SRDB_MEM_H
+#define _SRDB_MEM_H
+
+#include "srdb.h"
+
+/* Embedded in-memory store, selected with ovsdb_server "mem:<name>".
+ *
+ * All the srdb handles of a process that use the same name share the
+ * store, which lives as long as one of them is open. Transactions and
+ * monitors behave as with an ovsdb-server (insert/update/delete of rows
+ * identified by their uuid, columns defaulted from the table
+ * descriptors, asynchronous monitor updates) without leaving the process.
+ * The contents are not persisted, nor shared with other processes: it is
+ * meant for tests and benchmarks running in one process, and sr-mockdb
+ * serves it to the others.
+ */
+
+#define SRDB_MEM_PREFIX	"mem:"
+
+extern const struct srdb_backend srdb_mem_backend;
+
+/* Direct access to the store of a "mem:" handle, to serve it to others */
+struct srdb_mem_monitor;
+
+json_t *srdb_mem_transact(struct srdb *srdb, json_t *request);
+struct srdb_mem_monitor *srdb_mem_monitor_new(struct srdb *srdb,
+					      const char *table);
+json_t *srdb_mem_monitor_next(struct srdb_mem_monitor *mm);
+void srdb_mem_monitor_stop(struct srdb_mem_monitor *mm);
+void srdb_mem_monitor_free(struct srdb_mem_monitor *mm);
+
+#endif
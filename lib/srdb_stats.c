@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "srdb.h"
+#include "srdb_stats.h"
+
+#define load(p)		__atomic_load_n((p), __ATOMIC_RELAXED)
+#define add(p, v)	__atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+
+/* written by the signal handler, read by the dump thread */
+static int dump_pipe[2] = { -1, -1 };
+
+static const char *op_names[SRDB_STATS_OPS] = {
+	[SRDB_OP_INSERT]	= "insert",
+	[SRDB_OP_UPDATE]	= "update",
+	[SRDB_OP_DELETE]	= "delete",
+};
+
+uint64_t srdb_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void srdb_hist_add(struct srdb_hist *h, uint64_t us)
+{
+	unsigned int b = us ? 64 - __builtin_clzll(us) : 0;
+	uint64_t max;
+
+	if (b >= SRDB_HIST_BUCKETS)
+		b = SRDB_HIST_BUCKETS - 1;
+
+	add(&h->buckets[b], 1);
+	add(&h->count, 1);
+	add(&h->sum, us);
+
+	max = load(&h->max);
+	while (us > max && !__atomic_compare_exchange_n(&h->max, &max, us,
+							 true,
+							 __ATOMIC_RELAXED,
+							 __ATOMIC_RELAXED))
+		;
+}
+
+/* Upper bound of the bucket holding the @p quantile (0 < @p <= 1) */
+uint64_t srdb_hist_percentile(const struct srdb_hist *h, double p)
+{
+	uint64_t count = load(&h->count), seen = 0, max;
+	unsigned int b;
+
+	if (!count)
+		return 0;
+
+	max = load(&h->max);
+
+	for (b = 0; b < SRDB_HIST_BUCKETS; b++) {
+		seen += load(&h->buckets[b]);
+		if (seen >= p * count)
+			break;
+	}
+
+	if (b >= 63 || (1ULL << b) > max)
+		return max;
+
+	return 1ULL << b;
+}
+
+static void dump_hist(FILE *out, const char *label, const struct srdb_hist *h)
+{
+	uint64_t count = load(&h->count);
+
+	if (!count)
+		return;
+
+	fprintf(out, "srdb: %-28s n %llu avg %llu p50 %llu p99 %llu max %llu us\n",
+		label, (unsigned long long)count,
+		(unsigned long long)(load(&h->sum) / count),
+		(unsigned long long)srdb_hist_percentile(h, 0.5),
+		(unsigned long long)srdb_hist_percentile(h, 0.99),
+		(unsigned long long)load(&h->max));
+}
+
+void srdb_stats_dump(struct srdb *srdb, FILE *out)
+{
+	struct srdb_stats *stats = &srdb->stats;
+	struct srdb_table *tbl;
+	char label[64];
+	int op;
+
+	fprintf(out, "srdb: transactions submitted %llu completed %llu failed %llu overflows %llu queue %u max %u workers %d\n",
+		(unsigned long long)load(&stats->submitted),
+		(unsigned long long)load(&stats->completed),
+		(unsigned long long)load(&stats->failed),
+		(unsigned long long)load(&stats->overflows),
+		load(&stats->queue_depth), load(&stats->queue_max),
+		srdb->conf->ntransacts);
+
+	dump_hist(out, "queue wait", &stats->wait);
+
+	for (tbl = srdb->tables; tbl->name; tbl++) {
+		for (op = 0; op < SRDB_STATS_OPS; op++) {
+			if (!op_names[op])
+				continue;
+
+			snprintf(label, sizeof(label), "%s %s", tbl->name,
+				 op_names[op]);
+			dump_hist(out, label, &tbl->stats.rtt[op]);
+		}
+
+		snprintf(label, sizeof(label), "%s monitor", tbl->name);
+		dump_hist(out, label, &tbl->stats.parse);
+
+		if (load(&tbl->stats.buffer_grows))
+			fprintf(out, "srdb: %-28s buffer grows %llu\n", label,
+				(unsigned long long)load(&tbl->stats.buffer_grows));
+	}
+
+	fflush(out);
+}
+
+static void dump_signal(int signum)
+{
+	char c = 'd';
+
+	(void)signum;
+
+	if (write(dump_pipe[1], &c, 1) < 0)
+		return;
+}
+
+static void *dump_worker(void *arg)
+{
+	struct srdb *srdb = arg;
+	char c;
+
+	while (read(dump_pipe[0], &c, 1) == 1 && c == 'd')
+		srdb_stats_dump(srdb, srdb->stats.dump_out);
+
+	return NULL;
+}
+
+/* Dump the statistics to @out whenever @signum is received. The dump
+ * happens in a dedicated thread, only one handle per process can
+ * register.
+ */
+int srdb_stats_dump_on_signal(struct srdb *srdb, int signum, FILE *out)
+{
+	struct sigaction sa;
+
+	if (dump_pipe[0] >= 0)
+		return -1;
+
+	if (pipe(dump_pipe) < 0)
+		return -1;
+
+	srdb->stats.dump_out = out;
+	srdb->stats.dump_signum = signum;
+
+	if (pthread_create(&srdb->stats.dump_thread, NULL, dump_worker, srdb))
+		goto out_close;
+
+	srdb->stats.dumping = true;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dump_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(signum, &sa, NULL) < 0) {
+		srdb_stats_stop(srdb);
+		return -1;
+	}
+
+	return 0;
+
+out_close:
+	close(dump_pipe[0]);
+	close(dump_pipe[1]);
+	dump_pipe[0] = dump_pipe[1] = -1;
+	return -1;
+}
+
+void srdb_stats_stop(struct srdb *srdb)
+{
+	char c = 'q';
+
+	if (!srdb->stats.dumping)
+		return;
+
+	signal(srdb->stats.dump_signum, SIG_IGN);
+
+	if (write(dump_pipe[1], &c, 1) == 1)
+		pthread_join(srdb->stats.dump_thread, NULL);
+
+	close(dump_pipe[0]);
+	close(dump_pipe[1]);
+	dump_pipe[0] = dump_pipe[1] = -1;
+
+	srdb->stats.dumping = false;
+}
@@ -0,0 +1,59 @@
+#ifndef _SRDB_STATS_H
+#define _SRDB_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Counters and latency histograms of a srdb handle. They are updated
+ * with atomic operations and can be read at any time, directly or
+ * through srdb_stats_dump().
+ */
+
+#define SRDB_HIST_BUCKETS	32
+#define SRDB_STATS_OPS		4 /* indexed by SRDB_OP_* */
+
+/* Bucket 0 counts the samples below 1 us, bucket i > 0 the samples in
+ * [2^(i-1), 2^i) us.
+ */
+struct srdb_hist {
+	uint64_t buckets[SRDB_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct srdb_table_stats {
+	struct srdb_hist rtt[SRDB_STATS_OPS]; /* execution of transactions */
+	struct srdb_hist parse; /* processing of a monitor message */
+	uint64_t buffer_grows; /* monitor receive buffer doublings */
+};
+
+struct srdb_stats {
+	uint64_t submitted;
+	uint64_t completed;
+	uint64_t failed; /* not sent or no reply */
+	uint64_t overflows; /* asynchronous, refused with a full queue */
+	unsigned int queue_depth; /* submitted, not started yet */
+	unsigned int queue_max;
+	struct srdb_hist wait; /* from submission to execution */
+
+	/* srdb_stats_dump_on_signal() */
+	pthread_t dump_thread;
+	bool dumping;
+	int dump_signum;
+	FILE *dump_out;
+};
+
+struct srdb;
+
+uint64_t srdb_now_us(void);
+void srdb_hist_add(struct srdb_hist *h, uint64_t us);
+uint64_t srdb_hist_percentile(const struct srdb_hist *h, double p);
+
+void srdb_stats_dump(struct srdb *srdb, FILE *out);
+int srdb_stats_dump_on_signal(struct srdb *srdb, int signum, FILE *out);
+void srdb_stats_stop(struct srdb *srdb);
+
+#endif
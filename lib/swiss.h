@@ -0,0 +1,313 @@
+#ifndef _SWISS_H
+#define _SWISS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Open addressing hash tables with typed, inline keys and values, as an
+ * alternative to struct hashmap for fixed-size keys.
+ *
+ * SWISS_DEFINE(name, key_t, val_t, hash, eq) defines struct name and its
+ * functions name_new(), name_destroy(), name_flush(), name_set(),
+ * name_lookup() (pointer to the value, NULL if absent), name_get() (the
+ * value, zero if absent) and name_delete(). @hash(key) returns a 64-bit
+ * hash, @eq(k1, k2) is true for equal keys; both may be macros.
+ *
+ * The slots are split in groups of SWISS_GROUP, each slot having a
+ * control byte: SWISS_EMPTY, SWISS_DELETED or the low 7 bits of the hash
+ * of its key. A lookup probes the groups from the one given by the other
+ * bits of the hash and compares the keys of the slots whose control byte
+ * matches, which SSE2 finds for a whole group with one comparison. It
+ * stops at the first group with an empty slot. The table grows at 7/8
+ * occupancy, tombstones included.
+ *
+ * swiss_foreach() goes through the used slots, which may be deleted
+ * meanwhile but not inserted.
+ */
+
+#define SWISS_GROUP	16
+#define SWISS_EMPTY	((int8_t)-128)
+#define SWISS_DELETED	((int8_t)-2)
+
+/* bit i set if the control byte i of @group is @h2 */
+static inline uint32_t swiss_match(const int8_t *group, int8_t h2)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_load_si128((const __m128i *)group);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+#else
+	uint32_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < SWISS_GROUP; i++) {
+		if (group[i] == h2)
+			mask |= 1U << i;
+	}
+
+	return mask;
+#endif
+}
+
+/* empty or deleted slots, the only control bytes with the sign bit */
+static inline uint32_t swiss_match_free(const int8_t *group)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+	uint32_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < SWISS_GROUP; i++) {
+		if (group[i] < 0)
+			mask |= 1U << i;
+	}
+
+	return mask;
+#endif
+}
+
+static inline uint64_t swiss_hash_u64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+
+	return x;
+}
+
+static inline uint64_t swiss_hash_in6(struct in6_addr addr)
+{
+	uint64_t hi, lo;
+
+	memcpy(&hi, addr.s6_addr, sizeof(hi));
+	memcpy(&lo, addr.s6_addr + 8, sizeof(lo));
+
+	return swiss_hash_u64(hi ^ swiss_hash_u64(lo));
+}
+
+static inline bool swiss_eq_in6(struct in6_addr a, struct in6_addr b)
+{
+	return !memcmp(&a, &b, sizeof(a));
+}
+
+#define swiss_eq(a, b)	((a) == (b))
+
+/* first used slot from @i, @cap if none */
+static inline size_t swiss_next(const int8_t *ctrl, size_t cap, size_t i)
+{
+	while (i < cap && ctrl[i] < 0)
+		i++;
+
+	return i;
+}
+
+#define swiss_foreach(t, s)						\
+	for ((s) = (t)->slots + swiss_next((t)->ctrl, (t)->cap, 0);	\
+	     (s) < (t)->slots + (t)->cap;				\
+	     (s) = (t)->slots + swiss_next((t)->ctrl, (t)->cap,		\
+					   (s) - (t)->slots + 1))
+
+#define SWISS_DEFINE(name, key_t, val_t, hash, eq)			\
+struct name##_slot {							\
+	key_t key;							\
+	val_t val;							\
+};									\
+									\
+struct name {								\
+	int8_t *ctrl;							\
+	struct name##_slot *slots;					\
+	size_t cap; /* power of two, at least SWISS_GROUP */		\
+	size_t size;							\
+	size_t growth_left; /* insertions into empty slots */		\
+};									\
+									\
+static inline int name##_alloc(struct name *t, size_t cap)		\
+{									\
+	t->ctrl = aligned_alloc(SWISS_GROUP, cap);			\
+	if (!t->ctrl)							\
+		return -1;						\
+									\
+	t->slots = malloc(cap * sizeof(*t->slots));			\
+	if (!t->slots) {						\
+		free(t->ctrl);						\
+		return -1;						\
+	}								\
+									\
+	memset(t->ctrl, SWISS_EMPTY, cap);				\
+	t->cap = cap;							\
+	t->size = 0;							\
+	t->growth_left = cap - cap / 8;					\
+									\
+	return 0;							\
+}									\
+									\
+static inline struct name *name##_new(void)				\
+{									\
+	struct name *t;							\
+									\
+	t = malloc(sizeof(*t));						\
+	if (!t)								\
+		return NULL;						\
+									\
+	if (name##_alloc(t, SWISS_GROUP) < 0) {				\
+		free(t);						\
+		return NULL;						\
+	}								\
+									\
+	return t;							\
+}									\
+									\
+static inline void name##_destroy(struct name *t)			\
+{									\
+	free(t->slots);							\
+	free(t->ctrl);							\
+	free(t);							\
+}									\
+									\
+static inline void name##_flush(struct name *t)				\
+{									\
+	memset(t->ctrl, SWISS_EMPTY, t->cap);				\
+	t->size = 0;							\
+	t->growth_left = t->cap - t->cap / 8;				\
+}									\
+									\
+static inline struct name##_slot *name##_find(const struct name *t,	\
+					      key_t key, uint64_t h)	\
+{									\
+	size_t gmask = t->cap / SWISS_GROUP - 1;			\
+	size_t g = (h >> 7) & gmask;					\
+	struct name##_slot *s;						\
+	const int8_t *group;						\
+	size_t step = 0;						\
+	uint32_t m;							\
+									\
+	for (;;) {							\
+		group = t->ctrl + g * SWISS_GROUP;			\
+		for (m = swiss_match(group, h & 0x7f); m; m &= m - 1) {	\
+			s = &t->slots[g * SWISS_GROUP + __builtin_ctz(m)]; \
+			if (eq(s->key, key))				\
+				return s;				\
+		}							\
+									\
+		if (swiss_match(group, SWISS_EMPTY))			\
+			return NULL;					\
+									\
+		g = (g + ++step) & gmask;				\
+	}								\
+}									\
+									\
+/* first empty or deleted slot on the probe sequence of @h */		\
+static inline struct name##_slot *name##_claim(struct name *t,		\
+					       uint64_t h)		\
+{									\
+	size_t gmask = t->cap / SWISS_GROUP - 1;			\
+	size_t g = (h >> 7) & gmask;					\
+	size_t step = 0, i;						\
+	uint32_t m;							\
+									\
+	while (!(m = swiss_match_free(t->ctrl + g * SWISS_GROUP)))	\
+		g = (g + ++step) & gmask;				\
+									\
+	i = g * SWISS_GROUP + __builtin_ctz(m);				\
+	if (t->ctrl[i] == SWISS_EMPTY)					\
+		t->growth_left--;					\
+	t->ctrl[i] = h & 0x7f;						\
+	t->size++;							\
+									\
+	return &t->slots[i];						\
+}									\
+									\
+/* doubles the table, or only drops the tombstones if they are many */	\
+static inline int name##_rehash(struct name *t)				\
+{									\
+	struct name old = *t;						\
+	struct name##_slot *s, *ns;					\
+	size_t cap = t->cap;						\
+									\
+	if (t->size >= cap / 2)						\
+		cap *= 2;						\
+									\
+	if (name##_alloc(t, cap) < 0) {					\
+		*t = old;						\
+		return -1;						\
+	}								\
+									\
+	swiss_foreach(&old, s) {					\
+		ns = name##_claim(t, hash(s->key));			\
+		*ns = *s;						\
+	}								\
+									\
+	free(old.slots);						\
+	free(old.ctrl);							\
+									\
+	return 0;							\
+}									\
+									\
+static inline int name##_set(struct name *t, key_t key, val_t val)	\
+{									\
+	uint64_t h = hash(key);						\
+	struct name##_slot *s;						\
+									\
+	s = name##_find(t, key, h);					\
+	if (!s) {							\
+		if (!t->growth_left && name##_rehash(t) < 0)		\
+			return -1;					\
+		s = name##_claim(t, h);					\
+		s->key = key;						\
+	}								\
+									\
+	s->val = val;							\
+									\
+	return 0;							\
+}									\
+									\
+static inline val_t *name##_lookup(const struct name *t, key_t key)	\
+{									\
+	struct name##_slot *s;						\
+									\
+	s = name##_find(t, key, hash(key));				\
+									\
+	return s ? &s->val : NULL;					\
+}									\
+									\
+static inline val_t name##_get(const struct name *t, key_t key)	\
+{									\
+	struct name##_slot *s;						\
+									\
+	s = name##_find(t, key, hash(key));				\
+									\
+	return s ? s->val : (val_t){ 0 };				\
+}									\
+									\
+/* A slot can be emptied again if no probe ever went past its group */	\
+static inline void name##_delete(struct name *t, key_t key)		\
+{									\
+	struct name##_slot *s;						\
+	size_t i;							\
+									\
+	s = name##_find(t, key, hash(key));				\
+	if (!s)								\
+		return;							\
+									\
+	i = s - t->slots;						\
+	if (swiss_match(t->ctrl + (i & ~(size_t)(SWISS_GROUP - 1)),	\
+			SWISS_EMPTY)) {					\
+		t->ctrl[i] = SWISS_EMPTY;				\
+		t->growth_left++;					\
+	} else {							\
+		t->ctrl[i] = SWISS_DELETED;				\
+	}								\
+	t->size--;							\
+}
+
+#endif
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "srdb.h"
+#include "sr-bench.h"
+
+#define DEFAULT_COUNT	1000000
+
+/* Reference decoder looking up every descriptor by name in the row, as
+ * fill_srdb_entry() used to do.
+ */
+static unsigned int lookup_fill(struct srdb_table *tbl,
+				struct srdb_entry *entry, const char *uuid,
+				json_t *line_json)
+{
+	struct srdb_descriptor *desc = tbl->desc;
+	unsigned int index_mask = 0;
+	json_t *column_value;
+	void *data;
+	int i;
+
+	for (i = 0; desc[i].name; i++) {
+		if (!strcmp(desc[i].name, "row")) {
+			strncpy(entry->row, uuid, desc[i].maxlen);
+			continue;
+		}
+
+		column_value = json_object_get(line_json, desc[i].name);
+		if (!column_value)
+			continue;
+
+		if (desc[i].index)
+			index_mask |= ENTRY_MASK(desc[i].index);
+
+		if (!strcmp(desc[i].name, "_version")) {
+			column_value = json_object_get(line_json, "_version");
+			column_value = json_array_get(column_value, 1);
+		}
+
+		data = (unsigned char *)entry + desc[i].offset;
+
+		switch (desc[i].type) {
+		case SRDB_STR:
+			if (json_is_string(column_value))
+				strncpy((char *)data,
+					json_string_value(column_value),
+					desc[i].maxlen);
+			break;
+		case SRDB_INT:
+			if (json_is_integer(column_value))
+				*(int *)data = json_integer_value(column_value);
+			break;
+		case SRDB_VARSTR:
+			if (json_is_string(column_value))
+				*(char **)data =
+					strndup(json_string_value(column_value),
+						desc[i].maxlen);
+			break;
+		}
+	}
+
+	return index_mask;
+}
+
+/* FlowState row as sent by the controller for a flow with one path */
+static json_t *flowstate_row(void)
+{
+	static const char *const strs[][2] = {
+		{ "destination", "www.example.com" },
+		{ "dstaddr", "2001:db8:1::10" },
+		{ "bsid", "[\"fc00:2::1\"]" },
+		{ "segments", "[[\"fc00:5::\",\"fc00:7::\"]]" },
+		{ "sourceIPs", "[[0,\"2001:db8:42::\",64]]" },
+		{ "source", "app" },
+		{ "router", "router-a" },
+		{ "proxy", "proxy-a" },
+		{ "interface", "eth0" },
+		{ "request", "c0ffee-1" },
+	};
+	static const char *const ints[] = {
+		"bandwidth", "delay", "ttl", "idle", "timestamp", "status",
+	};
+	json_t *row, *version;
+	unsigned int i;
+
+	row = json_object();
+	version = json_array();
+	if (!row || !version) {
+		json_decref(row);
+		json_decref(version);
+		return NULL;
+	}
+
+	for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++)
+		json_object_set_new(row, strs[i][0], json_string(strs[i][1]));
+
+	for (i = 0; i < sizeof(ints) / sizeof(ints[0]); i++)
+		json_object_set_new(row, ints[i], json_integer(i + 1));
+
+	json_array_append_new(version, json_string("uuid"));
+	json_array_append_new(version,
+			      json_string("6ad4f458-0000-4000-8000-000000000001"));
+	json_object_set_new(row, "_version", version);
+
+	return row;
+}
+
+static void run_decode(const char *label, struct srdb_table *tbl,
+		       json_t *row, long count,
+		       unsigned int (*fill)(struct srdb_table *,
+					    struct srdb_entry *, const char *,
+					    json_t *))
+{
+	struct srdb_entry *entry;
+	struct timespec t0, t1;
+	double us;
+	long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < count; i++) {
+		entry = alloc_srdb_entry(tbl);
+		if (!entry)
+			break;
+
+		fill(tbl, entry, "6ad4f458-0000-4000-8000-000000000002", row);
+		free_srdb_entry(tbl->desc, entry);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	us = elapsed_us(&t0, &t1);
+	printf("%-32s n %ld %.0f ns/row\n", label, i, us * 1e3 / i);
+}
+
+/* Decoding of @count FlowState rows into pooled entries, as srdb_read()
+ * does, with the former lookup of each descriptor and the compiled decoder.
+ */
+int bench_decode(int argc, char **argv)
+{
+	struct srdb_table *tables, *tbl;
+	long count = DEFAULT_COUNT;
+	int c, ret = -1;
+	json_t *row;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = atol(optarg);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (count <= 0) {
+		fprintf(stderr, "Usage: decode [-n count]\n");
+		return -1;
+	}
+
+	tables = srdb_get_tables();
+	if (!tables)
+		return -1;
+
+	tbl = srdb_table_by_name(tables, "FlowState");
+	row = flowstate_row();
+	if (!tbl || !row)
+		goto out_free;
+
+	run_decode("lookup", tbl, row, count, lookup_fill);
+	run_decode("compiled", tbl, row, count, fill_srdb_entry);
+	ret = 0;
+
+out_free:
+	json_decref(row);
+	srdb_free_tables(tables);
+	return ret;
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "lpm.h"
+#include "sr-bench.h"
+
+#define DEFAULT_COUNT		1000000
+#define DEFAULT_PREFIXES	100000
+
+/* Reference lookup comparing the bits as strings, as lpm used to do */
+static void addr_to_binary(struct in6_addr *addr, char *res)
+{
+	int i, j, k = 0;
+
+	for (i = 0; i < 16; i++) {
+		int val = addr->s6_addr[i];
+
+		for (j = 0; j < 8; j++) {
+			int bit = (val >> (7-j)) & 0x1;
+			res[k++] = bit ? '1' : '0';
+		}
+	}
+
+	res[k] = 0;
+}
+
+static bool string_match_node(struct lpm_node *node, struct in6_addr *addr,
+			      uint8_t cur_plen)
+{
+	char prefix_bin[129], addr_bin[129];
+
+	if (node->plen == 0)
+		return true;
+
+	addr_to_binary(&node->prefix, prefix_bin);
+	addr_to_binary(addr, addr_bin);
+
+	return !memcmp(&prefix_bin[cur_plen], &addr_bin[cur_plen],
+		       node->plen - cur_plen);
+}
+
+static void *string_lookup(struct lpm_tree *tree, struct in6_addr *addr)
+{
+	struct lpm_node *cur_node = &tree->head;
+	struct lpm_node *last_match = &tree->head;
+	int i;
+
+	for (;;) {
+		if (cur_node->data != (void *)-1)
+			last_match = cur_node;
+
+		for (i = 0; i < 2; i++) {
+			if (cur_node->children[i] &&
+			    string_match_node(cur_node->children[i], addr,
+					      cur_node->plen))
+				break;
+		}
+
+		if (i == 2)
+			break;
+
+		cur_node = cur_node->children[i];
+	}
+
+	return last_match->data;
+}
+
+static void *tree_lookup(struct lpm_tree *tree, struct in6_addr *addr)
+{
+	return lpm_lookup(tree, addr);
+}
+
+/* Prefixes from /16 to /64 under 2001::/16 and addresses half of which
+ * fall into one of them.
+ */
+static void random_addr(struct in6_addr *addr)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		addr->s6_addr[i] = rand();
+	addr->s6_addr[0] = 0x20;
+	addr->s6_addr[1] = 0x01;
+}
+
+static int fill_tree(struct lpm_tree *tree, struct in6_addr *addrs, long count,
+		     int nprefixes)
+{
+	struct in6_addr prefix;
+	int i;
+
+	for (i = 0; i < nprefixes; i++) {
+		random_addr(&prefix);
+		if (!lpm_insert(tree, &prefix, 16 + rand() % 49,
+				(void *)(long)(i + 1)))
+			return -1;
+
+		if (i < count / 2)
+			addrs[i] = prefix;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (i >= nprefixes || i >= count / 2)
+			random_addr(&addrs[i]);
+		else
+			addrs[i].s6_addr[15] ^= rand();
+	}
+
+	return 0;
+}
+
+static double run_lookups(const char *label,
+			  void *(*lookup)(struct lpm_tree *, struct in6_addr *),
+			  struct lpm_tree *tree, struct in6_addr *addrs,
+			  void **res, long count, bool check)
+{
+	struct timespec t0, t1;
+	long i, errors = 0;
+	void *data;
+	double us;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < count; i++) {
+		data = lookup(tree, &addrs[i]);
+		if (!check)
+			res[i] = data;
+		else if (data != res[i])
+			errors++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	us = elapsed_us(&t0, &t1);
+	printf("%-32s n %ld %.0f ns/op %.2f Mops/s\n", label, count,
+	       us * 1e3 / count, count / us);
+
+	if (errors)
+		fprintf(stderr, "%s: %ld results differ\n", label, errors);
+
+	return errors ? -1 : 0;
+}
+
+/* Lookups of @count addresses among @nprefixes prefixes, by the former
+ * string comparisons, the bitwise tree walk and the multibit trie.
+ */
+int bench_lpm(int argc, char **argv)
+{
+	int c, nprefixes = DEFAULT_PREFIXES, ret = -1;
+	long count = DEFAULT_COUNT;
+	struct timespec t0, t1;
+	struct in6_addr *addrs;
+	struct lpm_tree *tree;
+	void **res;
+
+	while ((c = getopt(argc, argv, "n:p:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'p':
+			nprefixes = atoi(optarg);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (count <= 0 || nprefixes < 0) {
+		fprintf(stderr, "Usage: lpm [-n count] [-p prefixes]\n");
+		return -1;
+	}
+
+	addrs = malloc(count * sizeof(*addrs));
+	res = malloc(count * sizeof(*res));
+	tree = lpm_new();
+	if (!addrs || !res || !tree)
+		goto out_free;
+
+	srand(1);
+	if (fill_tree(tree, addrs, count, nprefixes) < 0)
+		goto out_free;
+
+	ret = 0;
+
+	run_lookups("string", string_lookup, tree, addrs, res, count, false);
+	if (run_lookups("bitwise", tree_lookup, tree, addrs, res, count,
+			true) < 0)
+		ret = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (lpm_compile(tree) < 0) {
+		fprintf(stderr, "cannot compile the tree\n");
+		ret = -1;
+		goto out_free;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("%-32s %d prefixes %u nodes %u leaves %.1f ms\n", "compile",
+	       nprefixes, tree->mbt->nnodes, tree->mbt->nleaves,
+	       elapsed_us(&t0, &t1) / 1e3);
+
+	if (run_lookups("multibit", tree_lookup, tree, addrs, res, count,
+			true) < 0)
+		ret = -1;
+
+out_free:
+	if (tree)
+		lpm_destroy(tree);
+	free(res);
+	free(addrs);
+	return ret;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <semaphore.h>
+
+#include "srdb.h"
+#include "sr-bench.h"
+
+#define DEFAULT_COUNT	10000
+#define WARMUP_COUNT	100
+
+static int print_err(const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+
+	return ret;
+}
+
+static void update_done(json_t *res, void *arg)
+{
+	(void)res;
+	sem_post(arg);
+}
+
+/* Throughput of @count update transactions issued back to back and spread
+ * over the transaction workers.
+ */
+static void run_throughput(struct srdb *srdb, struct srdb_table *tbl,
+			   struct srdb_entry *entry, const char *server,
+			   int count)
+{
+	struct timespec t0, t1;
+	int i, waited = 0;
+	double us;
+	sem_t done;
+
+	sem_init(&done, 0, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	/* at most SRDB_TR_QUEUE transactions wait for the workers */
+	for (i = 0; i < count; i++) {
+		while (srdb_update_async(srdb, tbl, entry, FE_STATUS,
+					 update_done, &done) < 0) {
+			if (waited == i) {
+				sem_post(&done);
+				break;
+			}
+
+			sem_wait(&done);
+			waited++;
+		}
+	}
+
+	for (; waited < count; waited++)
+		sem_wait(&done);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sem_destroy(&done);
+
+	us = elapsed_us(&t0, &t1);
+	printf("%-32s n %d workers %d %.0f transactions/s\n", server, count,
+	       srdb->conf->ntransacts, count * 1e6 / us);
+}
+
+/* Round-trip latency of one update transaction. The row does not exist,
+ * so the server does not modify the database.
+ */
+static int run_server(const char *server, const char *database, int count,
+		      int workers)
+{
+	struct srdb_flow_entry fe;
+	struct timespec t0, t1;
+	struct ovsdb_config conf;
+	struct srdb_table *tbl;
+	struct srdb *srdb;
+	double *samples;
+	int i, n = 0;
+
+	memset(&conf, 0, sizeof(conf));
+	strncpy(conf.ovsdb_server, server, SLEN);
+	strncpy(conf.ovsdb_database, database, SLEN);
+	conf.ntransacts = workers;
+
+	samples = malloc(count * sizeof(*samples));
+	if (!samples)
+		return -1;
+
+	srdb = srdb_new(&conf, print_err);
+	if (!srdb) {
+		free(samples);
+		return -1;
+	}
+
+	tbl = srdb_table_by_name(srdb->tables, "FlowState");
+
+	memset(&fe, 0, sizeof(fe));
+	strcpy(fe.entry.row, "00000000-0000-0000-0000-000000000000");
+
+	for (i = 0; i < WARMUP_COUNT; i++) {
+		if (srdb_update_sync(srdb, tbl, (struct srdb_entry *)&fe,
+				     FE_STATUS, NULL) < 0)
+			break;
+	}
+
+	for (i = 0; i < count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (srdb_update_sync(srdb, tbl, (struct srdb_entry *)&fe,
+				     FE_STATUS, NULL) < 0)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+
+		samples[n++] = elapsed_us(&t0, &t1);
+	}
+
+	if (n < count)
+		fprintf(stderr, "%s: %d transactions failed\n", server,
+			count - n);
+
+	print_latency(server, samples, n);
+
+	if (n)
+		run_throughput(srdb, tbl, (struct srdb_entry *)&fe, server,
+			       count);
+
+	srdb_destroy(srdb);
+	free(samples);
+
+	return n ? 0 : -1;
+}
+
+/* Compare the transaction latency over several server specifications,
+ * e.g. tcp:[::1]:6640 unix:/var/run/openvswitch/db.sock
+ */
+int bench_ovsdb(int argc, char **argv)
+{
+	const char *database = "SR_test";
+	int count = DEFAULT_COUNT;
+	int workers = 1;
+	int c, i, ret = 0;
+
+	while ((c = getopt(argc, argv, "n:d:t:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 't':
+			workers = atoi(optarg);
+			break;
+		case 'd':
+			database = optarg;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (optind == argc || count <= 0 || workers <= 0) {
+		fprintf(stderr, "Usage: ovsdb [-n count] [-d database] [-t workers] server...\n");
+		return -1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (run_server(argv[i], database, count, workers) < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
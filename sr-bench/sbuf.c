@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "sbuf.h"
+#include "sr-bench.h"
+
+#define DEFAULT_COUNT		1000000
+#define DEFAULT_CAPACITY	1024
+
+/* Reference ring as sbuf used to be: a mutex protecting the indexes and
+ * two semaphores counting the free and the used cells.
+ */
+struct locked_ring {
+	pthread_mutex_t lock;
+	sem_t empty;
+	sem_t full;
+	void **data;
+	unsigned long capacity;
+	unsigned long read;
+	unsigned long write;
+};
+
+struct ring_ops {
+	const char *name;
+	void *(*create)(unsigned long capacity);
+	void (*destroy)(void *ring);
+	void (*push)(void *ring, void *elem);
+	void *(*pop)(void *ring);
+};
+
+struct ring_run {
+	const struct ring_ops *ops;
+	void *ring;
+	long count; /* per thread */
+};
+
+/* the indexes were masked, so the capacity is a power of two as in sbuf */
+static void *locked_create(unsigned long capacity)
+{
+	struct locked_ring *r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->capacity = 2;
+	while (r->capacity < capacity)
+		r->capacity <<= 1;
+
+	r->data = malloc(r->capacity * sizeof(void *));
+	if (!r->data) {
+		free(r);
+		return NULL;
+	}
+
+	pthread_mutex_init(&r->lock, NULL);
+	sem_init(&r->empty, 0, r->capacity);
+	sem_init(&r->full, 0, 0);
+
+	return r;
+}
+
+static void locked_destroy(void *ring)
+{
+	struct locked_ring *r = ring;
+
+	pthread_mutex_destroy(&r->lock);
+	sem_destroy(&r->empty);
+	sem_destroy(&r->full);
+	free(r->data);
+	free(r);
+}
+
+static void locked_push(void *ring, void *elem)
+{
+	struct locked_ring *r = ring;
+
+	sem_wait(&r->empty);
+	pthread_mutex_lock(&r->lock);
+	r->data[r->write++ & (r->capacity - 1)] = elem;
+	pthread_mutex_unlock(&r->lock);
+	sem_post(&r->full);
+}
+
+static void *locked_pop(void *ring)
+{
+	struct locked_ring *r = ring;
+	void *elem;
+
+	sem_wait(&r->full);
+	pthread_mutex_lock(&r->lock);
+	elem = r->data[r->read++ & (r->capacity - 1)];
+	pthread_mutex_unlock(&r->lock);
+	sem_post(&r->empty);
+
+	return elem;
+}
+
+static void *sbuf_create(unsigned long capacity)
+{
+	return sbuf_new(capacity);
+}
+
+static void sbuf_release(void *ring)
+{
+	sbuf_destroy(ring);
+}
+
+static void sbuf_push_elem(void *ring, void *elem)
+{
+	sbuf_push(ring, elem);
+}
+
+static void *sbuf_pop_elem(void *ring)
+{
+	return sbuf_pop(ring);
+}
+
+static const struct ring_ops rings[] = {
+	{
+		.name		= "sbuf",
+		.create		= sbuf_create,
+		.destroy	= sbuf_release,
+		.push		= sbuf_push_elem,
+		.pop		= sbuf_pop_elem,
+	},
+	{
+		.name		= "mutex+sem",
+		.create		= locked_create,
+		.destroy	= locked_destroy,
+		.push		= locked_push,
+		.pop		= locked_pop,
+	},
+	{ .name = NULL },
+};
+
+static void *producer(void *arg)
+{
+	struct ring_run *run = arg;
+	long i;
+
+	for (i = 1; i <= run->count; i++)
+		run->ops->push(run->ring, (void *)i);
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct ring_run *run = arg;
+	long i;
+
+	for (i = 0; i < run->count; i++)
+		run->ops->pop(run->ring);
+
+	return NULL;
+}
+
+/* @count elements go through the ring, spread over @producers and
+ * @consumers threads.
+ */
+static int run_ring(const struct ring_ops *ops, unsigned long capacity,
+		    long count, int producers, int consumers)
+{
+	struct ring_run prun, crun;
+	struct timespec t0, t1;
+	pthread_t *threads;
+	char label[64];
+	int i, n = 0;
+	double us;
+
+	threads = malloc((producers + consumers) * sizeof(*threads));
+	if (!threads)
+		return -1;
+
+	prun.ops = crun.ops = ops;
+	prun.ring = crun.ring = ops->create(capacity);
+	if (!prun.ring) {
+		free(threads);
+		return -1;
+	}
+
+	prun.count = count / producers;
+	crun.count = prun.count * producers / consumers;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < consumers; i++) {
+		if (pthread_create(&threads[n++], NULL, consumer, &crun))
+			goto out_threads;
+	}
+
+	for (i = 0; i < producers; i++) {
+		if (pthread_create(&threads[n++], NULL, producer, &prun))
+			goto out_threads;
+	}
+
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	us = elapsed_us(&t0, &t1);
+	snprintf(label, sizeof(label), "%s %dp/%dc", ops->name, producers,
+		 consumers);
+	printf("%-32s n %ld capacity %lu %.0f ns/op %.2f Mops/s\n", label,
+	       crun.count * consumers, capacity,
+	       us * 1e3 / (crun.count * consumers),
+	       crun.count * consumers / us);
+
+	ops->destroy(prun.ring);
+	free(threads);
+	return 0;
+
+out_threads:
+	/* the threads already started would block forever */
+	fprintf(stderr, "%s: cannot start threads\n", ops->name);
+	exit(EXIT_FAILURE);
+}
+
+/* Throughput of sbuf against its former mutex and semaphores under
+ * contention
+ */
+int bench_sbuf(int argc, char **argv)
+{
+	unsigned long capacity = DEFAULT_CAPACITY;
+	int producers = 1, consumers = 1;
+	long count = DEFAULT_COUNT;
+	const struct ring_ops *ops;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "n:s:p:c:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 's':
+			capacity = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			producers = atoi(optarg);
+			break;
+		case 'c':
+			consumers = atoi(optarg);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (count <= 0 || !capacity || producers <= 0 || consumers <= 0 ||
+	    count % ((long)producers * consumers)) {
+		fprintf(stderr, "Usage: sbuf [-n count] [-s capacity] [-p producers] [-c consumers]\n"
+				"count must be a multiple of producers * consumers\n");
+		return -1;
+	}
+
+	for (ops = rings; ops->name; ops++) {
+		if (run_ring(ops, capacity, count, producers, consumers) < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
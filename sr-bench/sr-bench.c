@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sr-bench.h"
+
+static struct bench benches[] = {
+	{
+		.name	= "decode",
+		.usage	= "[-n count]",
+		.run	= bench_decode,
+	},
+	{
+		.name	= "lpm",
+		.usage	= "[-n count] [-p prefixes]",
+		.run	= bench_lpm,
+	},
+	{
+		.name	= "ovsdb",
+		.usage	= "[-n count] [-d database] [-t workers] server...",
+		.run	= bench_ovsdb,
+	},
+	{
+		.name	= "sbuf",
+		.usage	= "[-n count] [-s capacity] [-p producers] [-c consumers]",
+		.run	= bench_sbuf,
+	},
+	{
+		.name	= "swiss",
+		.usage	= "[-n count] [-r rounds]",
+		.run	= bench_swiss,
+	},
+	{ .name = NULL },
+};
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Summary of latency samples in microseconds, @samples gets sorted */
+void print_latency(const char *label, double *samples, int count)
+{
+	double sum = 0;
+	int i;
+
+	if (!count)
+		return;
+
+	qsort(samples, count, sizeof(*samples), compare_double);
+
+	for (i = 0; i < count; i++)
+		sum += samples[i];
+
+	printf("%-32s n %d avg %.1f p50 %.1f p99 %.1f max %.1f us\n", label,
+	       count, sum / count, samples[count / 2],
+	       samples[(int)(count * 0.99)], samples[count - 1]);
+}
+
+static void usage(const char *prog)
+{
+	struct bench *b;
+
+	fprintf(stderr, "Usage:\n");
+	for (b = benches; b->name; b++)
+		fprintf(stderr, "  %s %s %s\n", prog, b->name, b->usage);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench *b;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	for (b = benches; b->name; b++) {
+		if (!strcmp(argv[1], b->name))
+			return b->run(argc - 1, argv + 1);
+	}
+
+	fprintf(stderr, "Unknown benchmark `%s'.\n", argv[1]);
+	usage(argv[0]);
+	return -1;
+}
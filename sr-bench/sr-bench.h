@@ -0,0 +1,26 @@
+#ifndef _SR_BENCH_H
+#define _SR_BENCH_H
+
+#include <time.h>
+
+struct bench {
+	const char *name;
+	const char *usage;
+	int (*run)(int argc, char **argv);
+};
+
+static inline double elapsed_us(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) * 1e6 +
+	       (t1->tv_nsec - t0->tv_nsec) / 1e3;
+}
+
+void print_latency(const char *label, double *samples, int count);
+
+int bench_decode(int argc, char **argv);
+int bench_lpm(int argc, char **argv);
+int bench_ovsdb(int argc, char **argv);
+int bench_sbuf(int argc, char **argv);
+int bench_swiss(int argc, char **argv);
+
+#endif
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hashmap.h"
+#include "swiss.h"
+#include "sr-bench.h"
+
+#define DEFAULT_COUNT	100000
+#define DEFAULT_ROUNDS	10
+
+SWISS_DEFINE(bench_in6map, struct in6_addr, void *, swiss_hash_in6,
+	     swiss_eq_in6)
+
+static void print_run(const char *label, long count, int rounds,
+		      struct timespec *t0, struct timespec *t1,
+		      struct timespec *t2, long errors)
+{
+	printf("%-32s n %ld rounds %d insert %.0f ns/op lookup %.0f ns/op total %.1f ms\n",
+	       label, count, rounds, elapsed_us(t0, t1) * 1e3 / count,
+	       elapsed_us(t1, t2) * 1e3 / (count * rounds),
+	       elapsed_us(t0, t2) / 1e3);
+
+	if (errors)
+		fprintf(stderr, "%s: %ld lookups failed\n", label, errors);
+}
+
+static int run_hashmap(struct in6_addr *keys, long count, int rounds)
+{
+	struct timespec t0, t1, t2;
+	struct hashmap *hm;
+	long i, errors = 0;
+	int r;
+
+	hm = hmap_new(hash_in6, compare_in6);
+	if (!hm)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < count; i++) {
+		if (hmap_set(hm, &keys[i], (void *)(i + 1)) < 0) {
+			hmap_destroy(hm);
+			return -1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < count; i++) {
+			if (hmap_get(hm, &keys[i]) != (void *)(i + 1))
+				errors++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	print_run("hashmap", count, rounds, &t0, &t1, &t2, errors);
+	hmap_destroy(hm);
+
+	return errors ? -1 : 0;
+}
+
+static int run_swiss(struct in6_addr *keys, long count, int rounds)
+{
+	struct timespec t0, t1, t2;
+	struct bench_in6map *t;
+	long i, errors = 0;
+	int r;
+
+	t = bench_in6map_new();
+	if (!t)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < count; i++) {
+		if (bench_in6map_set(t, keys[i], (void *)(i + 1)) < 0) {
+			bench_in6map_destroy(t);
+			return -1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < count; i++) {
+			if (bench_in6map_get(t, keys[i]) != (void *)(i + 1))
+				errors++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	print_run("swiss", count, rounds, &t0, &t1, &t2, errors);
+	bench_in6map_destroy(t);
+
+	return errors ? -1 : 0;
+}
+
+/* Insertion of @count distinct addresses, as the graph maps keyed by
+ * node, then @rounds lookups of each, with struct hashmap and with the
+ * open addressing table of swiss.h.
+ */
+int bench_swiss(int argc, char **argv)
+{
+	int c, rounds = DEFAULT_ROUNDS, ret = 0;
+	long count = DEFAULT_COUNT, i;
+	struct in6_addr *keys;
+
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (count <= 0 || rounds <= 0) {
+		fprintf(stderr, "Usage: swiss [-n count] [-r rounds]\n");
+		return -1;
+	}
+
+	keys = calloc(count, sizeof(*keys));
+	if (!keys)
+		return -1;
+
+	/* fc00::/16 addresses differing in their last 32 bits */
+	for (i = 0; i < count; i++) {
+		keys[i].s6_addr[0] = 0xfc;
+		keys[i].s6_addr[12] = i >> 24;
+		keys[i].s6_addr[13] = i >> 16;
+		keys[i].s6_addr[14] = i >> 8;
+		keys[i].s6_addr[15] = i;
+	}
+
+	if (run_hashmap(keys, count, rounds) < 0)
+		ret = -1;
+	if (run_swiss(keys, count, rounds) < 0)
+		ret = -1;
+
+	free(keys);
+	return ret;
+}
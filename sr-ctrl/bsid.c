@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsid.h"
+
+#define WORD_BITS	64
+#define RING_MIN	64
+
+static void addr_add(struct in6_addr *addr, uint32_t n)
+{
+	uint32_t carry = n;
+	int i;
+
+	for (i = 15; i >= 0 && carry; i--) {
+		carry += addr->s6_addr[i];
+		addr->s6_addr[i] = carry & 0xff;
+		carry >>= 8;
+	}
+}
+
+/* -1 if @addr is not in the pool */
+static int64_t bsid_index(struct bsid_pool *pool, const struct in6_addr *addr)
+{
+	uint8_t diff[16];
+	uint32_t idx;
+	int i, v, borrow = 0;
+
+	for (i = 15; i >= 0; i--) {
+		v = addr->s6_addr[i] - pool->base.s6_addr[i] - borrow;
+		borrow = v < 0;
+		diff[i] = v & 0xff;
+	}
+
+	if (borrow)
+		return -1;
+
+	for (i = 0; i < 12; i++) {
+		if (diff[i])
+			return -1;
+	}
+
+	idx = (uint32_t)diff[12] << 24 | (uint32_t)diff[13] << 16 |
+	      (uint32_t)diff[14] << 8 | diff[15];
+
+	if (idx >= pool->size)
+		return -1;
+
+	return idx;
+}
+
+static void mark_free(struct bsid_pool *pool, uint32_t idx)
+{
+	unsigned int lvl;
+
+	for (lvl = 0; lvl < BSID_LEVELS; lvl++) {
+		pool->bitmap[lvl][idx / WORD_BITS] |= 1ULL << (idx % WORD_BITS);
+		idx /= WORD_BITS;
+	}
+}
+
+static void mark_used(struct bsid_pool *pool, uint32_t idx)
+{
+	unsigned int lvl;
+	uint64_t *word;
+
+	for (lvl = 0; lvl < BSID_LEVELS; lvl++) {
+		word = &pool->bitmap[lvl][idx / WORD_BITS];
+		*word &= ~(1ULL << (idx % WORD_BITS));
+		if (*word)
+			break;
+		idx /= WORD_BITS;
+	}
+}
+
+static bool is_free(struct bsid_pool *pool, uint32_t idx)
+{
+	return pool->bitmap[0][idx / WORD_BITS] & (1ULL << (idx % WORD_BITS));
+}
+
+/* first free index, -1 if none */
+static int64_t find_free(struct bsid_pool *pool)
+{
+	uint32_t idx = 0;
+	int lvl;
+
+	if (!pool->bitmap[BSID_LEVELS - 1][0])
+		return -1;
+
+	for (lvl = BSID_LEVELS - 1; lvl >= 0; lvl--)
+		idx = idx * WORD_BITS + __builtin_ctzll(pool->bitmap[lvl][idx]);
+
+	return idx;
+}
+
+/* called with the pool lock */
+static void reclaim(struct bsid_pool *pool, time_t now)
+{
+	struct bsid_quarantine *q;
+
+	while (pool->qcount) {
+		q = &pool->ring[pool->qhead];
+		if (q->expires > now)
+			break;
+
+		mark_free(pool, q->index);
+		pool->qhead = (pool->qhead + 1) % pool->qsize;
+		pool->qcount--;
+	}
+}
+
+/* called with the pool lock, when the ring is full */
+static int grow_ring(struct bsid_pool *pool)
+{
+	struct bsid_quarantine *ring;
+	uint32_t qsize, i;
+
+	qsize = pool->qsize < RING_MIN ? RING_MIN : 2 * pool->qsize;
+	if (qsize > pool->size)
+		qsize = pool->size;
+
+	ring = malloc(qsize * sizeof(*ring));
+	if (!ring)
+		return -1;
+
+	for (i = 0; i < pool->qcount; i++)
+		ring[i] = pool->ring[(pool->qhead + i) % pool->qsize];
+
+	free(pool->ring);
+	pool->ring = ring;
+	pool->qsize = qsize;
+	pool->qhead = 0;
+
+	return 0;
+}
+
+/* The pool covers @size BSIDs from @offset in @prefix/@plen, or less if
+ * the prefix is too small.
+ */
+struct bsid_pool *bsid_pool_new(const struct in6_addr *prefix, int plen,
+				uint32_t offset, uint32_t size,
+				unsigned int quarantine)
+{
+	struct bsid_pool *pool;
+	unsigned int lvl;
+	uint32_t words;
+	uint64_t avail;
+	int i, hostbits;
+
+	if (plen < 0 || plen > 128)
+		return NULL;
+
+	hostbits = 128 - plen;
+	if (hostbits < 32) {
+		avail = 1ULL << hostbits;
+		if (offset >= avail)
+			return NULL;
+		if (size > avail - offset)
+			size = avail - offset;
+	}
+
+	if (size > BSID_POOL_MAX)
+		size = BSID_POOL_MAX;
+	if (!size)
+		return NULL;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	words = size;
+	for (lvl = 0; lvl < BSID_LEVELS; lvl++) {
+		words = (words + WORD_BITS - 1) / WORD_BITS;
+		pool->bitmap[lvl] = calloc(words, sizeof(uint64_t));
+		if (!pool->bitmap[lvl])
+			goto out_bitmap;
+	}
+
+	pool->base = *prefix;
+	for (i = 0; i < 16; i++) {
+		if (i * 8 >= plen)
+			pool->base.s6_addr[i] = 0;
+		else if (i * 8 + 8 > plen)
+			pool->base.s6_addr[i] &= 0xff << (8 - (plen - i * 8));
+	}
+	addr_add(&pool->base, offset);
+
+	pool->size = size;
+	pool->quarantine = quarantine;
+	pthread_mutex_init(&pool->lock, NULL);
+
+	while (size--)
+		mark_free(pool, size);
+
+	return pool;
+
+out_bitmap:
+	for (lvl = 0; lvl < BSID_LEVELS; lvl++)
+		free(pool->bitmap[lvl]);
+	free(pool);
+	return NULL;
+}
+
+void bsid_pool_destroy(struct bsid_pool *pool)
+{
+	unsigned int lvl;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->ring);
+	for (lvl = 0; lvl < BSID_LEVELS; lvl++)
+		free(pool->bitmap[lvl]);
+	free(pool);
+}
+
+/* Returns -1 if @pool is NULL or exhausted */
+int bsid_alloc(struct bsid_pool *pool, struct in6_addr *res)
+{
+	int64_t idx;
+
+	if (!pool)
+		return -1;
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->qcount)
+		reclaim(pool, time(NULL));
+
+	idx = find_free(pool);
+	if (idx < 0) {
+		pthread_mutex_unlock(&pool->lock);
+		return -1;
+	}
+
+	mark_used(pool, idx);
+	pool->used++;
+
+	pthread_mutex_unlock(&pool->lock);
+
+	*res = pool->base;
+	addr_add(res, idx);
+
+	return 0;
+}
+
+/* Quarantines @bsid, or frees it right away without quarantine period.
+ * If the quarantine ring cannot grow, @bsid stays allocated.
+ */
+int bsid_release(struct bsid_pool *pool, const struct in6_addr *bsid)
+{
+	struct bsid_quarantine *q;
+	time_t now;
+	int64_t idx;
+	int ret = 0;
+
+	if (!pool)
+		return -1;
+
+	idx = bsid_index(pool, bsid);
+	if (idx < 0)
+		return -1;
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (is_free(pool, idx)) {
+		ret = -1;
+		goto out_unlock;
+	}
+
+	if (!pool->quarantine) {
+		pool->used--;
+		mark_free(pool, idx);
+		goto out_unlock;
+	}
+
+	now = time(NULL);
+	if (pool->qcount == pool->qsize)
+		reclaim(pool, now);
+
+	if (pool->qcount == pool->qsize && grow_ring(pool) < 0) {
+		ret = -1;
+		goto out_unlock;
+	}
+
+	pool->used--;
+
+	q = &pool->ring[(pool->qhead + pool->qcount) % pool->qsize];
+	q->index = idx;
+	q->expires = now + pool->quarantine;
+	pool->qcount++;
+
+out_unlock:
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
+
+/* The BSIDs whose quarantine expired count as free, although they are
+ * only reclaimed by the next allocation.
+ */
+void bsid_pool_stats(struct bsid_pool *pool, struct bsid_pool_stats *st)
+{
+	time_t now = time(NULL);
+	uint32_t i;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (i = 0; i < pool->qcount; i++) {
+		if (pool->ring[(pool->qhead + i) % pool->qsize].expires > now)
+			break;
+	}
+
+	st->size = pool->size;
+	st->used = pool->used;
+	st->quarantined = pool->qcount - i;
+
+	pthread_mutex_unlock(&pool->lock);
+}
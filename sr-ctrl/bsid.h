@@ -0,0 +1,59 @@
+#ifndef _BSID_H
+#define _BSID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+/* Binding SIDs of a router, allocated from a range of its BSID prefix.
+ *
+ * The free BSIDs are tracked by a hierarchical bitmap: a bit of level 0
+ * is set when its BSID is free, a bit of level n > 0 when its word of level
+ * n - 1 has a bit set. The last level is a single word. Allocating or
+ * freeing a BSID costs BSID_LEVELS word operations whatever the occupancy.
+ *
+ * A released BSID may still be installed on the router until the flow
+ * expiry reaches it, so it only becomes free again after a quarantine.
+ * The quarantined BSIDs are kept oldest first in a ring, reclaimed by
+ * the next allocations. The ring grows with the releases, up to the pool
+ * size.
+ */
+
+#define BSID_LEVELS	4
+#define BSID_POOL_MAX	(1 << 24) /* 64^BSID_LEVELS */
+
+struct bsid_quarantine {
+	uint32_t index;
+	time_t expires;
+};
+
+struct bsid_pool {
+	pthread_mutex_t lock;
+	struct in6_addr base; /* BSID of index 0 */
+	uint32_t size;
+	uint32_t used; /* allocated, quarantined BSIDs excluded */
+	unsigned int quarantine; /* seconds */
+	uint64_t *bitmap[BSID_LEVELS];
+	struct bsid_quarantine *ring;
+	uint32_t qsize; /* entries allocated in the ring */
+	uint32_t qhead;
+	uint32_t qcount;
+};
+
+struct bsid_pool_stats {
+	uint32_t size;
+	uint32_t used;
+	uint32_t quarantined;
+};
+
+struct bsid_pool *bsid_pool_new(const struct in6_addr *prefix, int plen,
+				uint32_t offset, uint32_t size,
+				unsigned int quarantine);
+void bsid_pool_destroy(struct bsid_pool *pool);
+int bsid_alloc(struct bsid_pool *pool, struct in6_addr *res);
+int bsid_release(struct bsid_pool *pool, const struct in6_addr *bsid);
+void bsid_pool_stats(struct bsid_pool *pool, struct bsid_pool_stats *st);
+
+#endif
@@ -5,9 +5,40 @@
 #include <string.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "graph.h"
 #include "misc.h"
+#include "slab.h"
+
+static struct slab *segment_slab;
+static pthread_once_t segment_slab_once = PTHREAD_ONCE_INIT;
+
+static void segment_slab_init(void)
+{
+	segment_slab = slab_new_cached(sizeof(struct segment), 0);
+}
+
+static struct segment *segment_alloc(void)
+{
+	pthread_once(&segment_slab_once, segment_slab_init);
+	if (!segment_slab)
+		return NULL;
+
+	return slab_alloc(segment_slab);
+}
+
+/* scratch memory from @arena if any, released with it */
+static void *scratch_alloc(struct arena *arena, size_t size)
+{
+	return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+static void scratch_free(struct arena *arena, void *ptr)
+{
+	if (!arena)
+		free(ptr);
+}
 
 static bool node_equals_default(struct node *n1, struct node *n2)
 {
@@ -27,21 +58,6 @@ static struct graph_ops g_ops_default = {
 	.edge_destroy		= NULL,
 };
 
-static unsigned int hash_nodepair(void *key)
-{
-	struct nodepair *p = key;
-
-	return hashint((p->local->id << 16) | p->remote->id);
-}
-
-static int compare_nodepair(void *k1, void *k2)
-{
-	struct nodepair *p1 = k1, *p2 = k2;
-
-	return !((p1->local->id == p2->local->id &&
-		  p1->remote->id == p2->remote->id));
-}
-
 struct graph *graph_new(struct graph_ops *ops)
 {
 	struct graph *g;
@@ -63,15 +79,15 @@ struct graph *graph_new(struct graph_ops *ops)
 	if (!g->edges)
 		goto out_free_nodes;
 
-	g->min_edges = hmap_new(hash_nodepair, compare_nodepair);
+	g->min_edges = edge_map_new();
 	if (!g->min_edges)
 		goto out_free_edges;
 
-	g->neighs = hmap_new(hash_node, compare_node);
+	g->neighs = node_map_new();
 	if (!g->neighs)
 		goto out_free_minedges;
 
-	g->dcache = hmap_new(hash_node, compare_node);
+	g->dcache = node_map_new();
 	if (!g->dcache)
 		goto out_free_neighs;
 
@@ -85,9 +101,9 @@ struct graph *graph_new(struct graph_ops *ops)
 	return g;
 
 out_free_neighs:
-	hmap_destroy(g->neighs);
+	node_map_destroy(g->neighs);
 out_free_minedges:
-	hmap_destroy(g->min_edges);
+	edge_map_destroy(g->min_edges);
 out_free_edges:
 	llist_node_destroy(g->edges);
 out_free_nodes:
@@ -99,23 +115,21 @@ out_free_graph:
 
 void graph_destroy(struct graph *g, bool shallow)
 {
-	struct llist_node *nhead, *tmp, *iter;
-	struct hmap_entry *he;
+	struct llist_node *tmp, *iter;
+	struct node_map_slot *s;
 	struct edge *e;
 	struct node *n;
 
 	graph_flush_cache(g);
-	hmap_destroy(g->dcache);
+	node_map_destroy(g->dcache);
 
 	pthread_rwlock_destroy(&g->lock);
 
-	hmap_foreach(g->neighs, he) {
-		nhead = he->elem;
-		llist_node_destroy(nhead);
-	}
+	swiss_foreach(g->neighs, s)
+		llist_node_destroy(s->val);
 
-	hmap_destroy(g->min_edges);
-	hmap_destroy(g->neighs);
+	edge_map_destroy(g->min_edges);
+	node_map_destroy(g->neighs);
 
 	llist_node_foreach_safe(g->edges, iter, tmp) {
 		e = iter->data;
@@ -328,7 +342,7 @@ void graph_compute_minimal_edges(struct graph *g)
 	struct node *node1, *node2;
 	struct edge *edge;
 
-	hmap_flush(g->min_edges);
+	edge_map_flush(g->min_edges);
 
 	llist_node_foreach(g->nodes, iter1) {
 		node1 = iter1->data;
@@ -342,7 +356,8 @@ void graph_compute_minimal_edges(struct graph *g)
 			if (!edge)
 				continue;
 
-			hmap_set(g->min_edges, (struct nodepair *)edge, edge);
+			edge_map_set(g->min_edges, nodepair_key(node1, node2),
+				     edge);
 		}
 	}
 }
@@ -378,20 +393,18 @@ static struct llist_node *graph_compute_neighbors(struct graph *g,
 void graph_compute_all_neighbors(struct graph *g)
 {
 	struct llist_node *neighs, *iter;
-	struct hmap_entry *he;
+	struct node_map_slot *s;
 	struct node *node;
 
-	hmap_foreach(g->neighs, he) {
-		neighs = he->elem;
-		llist_node_destroy(neighs);
-	}
+	swiss_foreach(g->neighs, s)
+		llist_node_destroy(s->val);
 
-	hmap_flush(g->neighs);
+	node_map_flush(g->neighs);
 
 	llist_node_foreach(g->nodes, iter) {
 		node = iter->data;
 		neighs = graph_compute_neighbors(g, node);
-		hmap_set(g->neighs, node, neighs);
+		node_map_set(g->neighs, node->id, neighs);
 	}
 }
 
@@ -470,12 +483,12 @@ struct graph *graph_deepcopy(struct graph *g)
  * @tmp: list(node)
  */
 static void __compute_paths(struct llist_node *res, struct llist_node *tmp,
-			    struct hashmap *prev, struct node *u)
+			    struct node_map *prev, struct node *u)
 {
 	struct llist_node *w, *iter;
 	struct node *p;
 
-	w = hmap_get(prev, u);
+	w = node_map_get(prev, u->id);
 	if (llist_node_empty(w)) {
 		llist_node_insert_tail(res, tmp);
 		return;
@@ -490,7 +503,7 @@ static void __compute_paths(struct llist_node *res, struct llist_node *tmp,
 
 	llist_node_destroy(tmp);
 }
-static void compute_paths(struct llist_node *res, struct hashmap *prev,
+static void compute_paths(struct llist_node *res, struct node_map *prev,
 			  struct node *u)
 {
 	struct llist_node *tmp;
@@ -514,11 +527,30 @@ static void destroy_pathres(struct llist_node *p)
 	llist_node_destroy(p);
 }
 
-void graph_dijkstra(const struct graph *g, struct node *src, struct dres *res,
-		    struct d_ops *ops, void *data)
+static bool in_queue(struct node **Q, unsigned int nq, struct node *node)
 {
-	struct hashmap *dist, *prev, *path;
-	struct llist_node *Q, *iter;
+	unsigned int i;
+
+	for (i = 0; i < nq; i++) {
+		if (Q[i] == node)
+			return true;
+	}
+
+	return false;
+}
+
+/* Only the queue is scratch memory from @arena, or malloc'ed without
+ * arena: the maps are the result, which the callers may keep. Returns -1
+ * if the maps or the queue cannot be allocated, @res is then unusable.
+ */
+int graph_dijkstra(const struct graph *g, struct node *src, struct dres *res,
+		   struct d_ops *ops, void *data, struct arena *arena)
+{
+	struct llist_node *iter, *prev_list, *path_list;
+	struct node_map *prev, *path;
+	unsigned int nq = 0, qi;
+	struct node_dist *dist;
+	struct node **Q;
 	struct node *node;
 	void *state;
 
@@ -527,47 +559,64 @@ void graph_dijkstra(const struct graph *g, struct node *src, struct dres *res,
 	 * path: node -> list(list(node))
 	 */
 
-	dist = hmap_new(hash_node, compare_node);
-	prev = hmap_new(hash_node, compare_node);
-	path = hmap_new(hash_node, compare_node);
+	res->dist = dist = node_dist_new();
+	res->prev = prev = node_map_new();
+	res->path = path = node_map_new();
+	if (!dist || !prev || !path)
+		goto out_maps;
 
-	Q = llist_node_alloc();
+	Q = scratch_alloc(arena, llist_node_size(g->nodes) * sizeof(*Q));
+	if (!Q)
+		goto out_maps;
 
 	llist_node_foreach(g->nodes, iter) {
 		node = iter->data;
 
-		if (node->id == src->id)
-			hmap_set(dist, node, (void *)(uintptr_t)0);
-		else
-			hmap_set(dist, node, (void *)(uintptr_t)UINT32_MAX);
+		prev_list = llist_node_alloc();
+		path_list = llist_node_alloc();
+		if (!prev_list || !path_list ||
+		    node_map_set(prev, node->id, prev_list) < 0) {
+			if (prev_list)
+				llist_node_destroy(prev_list);
+			if (path_list)
+				llist_node_destroy(path_list);
+			goto out_queue;
+		}
+
+		if (node_map_set(path, node->id, path_list) < 0) {
+			llist_node_destroy(path_list);
+			goto out_queue;
+		}
 
-		hmap_set(prev, node, llist_node_alloc());
-		hmap_set(path, node, llist_node_alloc());
+		if (node_dist_set(dist, node->id,
+				  node->id == src->id ? 0 : UINT32_MAX) < 0)
+			goto out_queue;
 
-		llist_node_insert_tail(Q, node);
+		Q[nq++] = node;
 	}
 
 	if (ops && ops->init)
 		ops->init(g, src, &state, data);
 
-	while (!llist_node_empty(Q)) {
-		struct llist_node *S, *u_iter;
+	while (nq) {
+		struct llist_node *S;
 		struct llist_node *neighs;
 		uint32_t cost, tmpcost;
+		unsigned int i;
 		struct node *u, *v;
 
 		tmpcost = UINT32_MAX;
-		u_iter = NULL;
 		S = NULL;
 		u = NULL;
+		qi = 0;
 
-		llist_node_foreach(Q, iter) {
-			v = iter->data;
-			cost = (uintptr_t)hmap_get(dist, v);
+		for (i = 0; i < nq; i++) {
+			v = Q[i];
+			cost = node_dist_get(dist, v->id);
 			if (cost < tmpcost) {
 				tmpcost = cost;
 				u = v;
-				u_iter = iter;
+				qi = i;
 			}
 		}
 
@@ -576,34 +625,33 @@ void graph_dijkstra(const struct graph *g, struct node *src, struct dres *res,
 
 		S = llist_node_alloc();
 
-		destroy_pathres(hmap_get(path, u));
+		destroy_pathres(node_map_get(path, u->id));
 		compute_paths(S, prev, u);
-		hmap_set(path, u, S);
+		node_map_set(path, u->id, S);
 
-		llist_node_remove(Q, u_iter);
+		/* the order of the queue breaks the ties */
+		memmove(&Q[qi], &Q[qi + 1], (nq - qi - 1) * sizeof(*Q));
+		nq--;
 
-		neighs = hmap_get(g->neighs, u);
+		neighs = node_map_get(g->neighs, u->id);
 
 		llist_node_foreach(neighs, iter) {
-			struct llist_node *prev_list;
 			uint32_t alt, u_dist, v_dist;
 			struct edge *min_edge;
-			struct nodepair pair;
 
 			v = iter->data;
-			if (!llist_node_exist(Q, v))
+			if (!in_queue(Q, nq, v))
 				continue;
 
-			pair.local = u;
-			pair.remote = v;
-			min_edge = hmap_get(g->min_edges, &pair);
+			min_edge = edge_map_get(g->min_edges,
+						nodepair_key(u, v));
 
 			assert(min_edge);
 			if (!min_edge)
 				continue;
 
-			u_dist = (uintptr_t)hmap_get(dist, u);
-			v_dist = (uintptr_t)hmap_get(dist, v);
+			u_dist = node_dist_get(dist, u->id);
+			v_dist = node_dist_get(dist, v->id);
 
 			if (ops && ops->cost)
 				alt = ops->cost(u_dist, min_edge, state, data);
@@ -611,15 +659,15 @@ void graph_dijkstra(const struct graph *g, struct node *src, struct dres *res,
 				alt = u_dist + min_edge->metric;
 
 			if (alt < v_dist) {
-				prev_list = hmap_get(prev, v);
+				prev_list = node_map_get(prev, v->id);
 				llist_node_flush(prev_list);
 				llist_node_insert_tail(prev_list, u);
-				hmap_set(dist, v, (void *)(uintptr_t)alt);
+				node_dist_set(dist, v->id, alt);
 
 				if (ops && ops->update)
 					ops->update(min_edge, state, data);
 			} else if (alt == v_dist) {
-				prev_list = hmap_get(prev, v);
+				prev_list = node_map_get(prev, v->id);
 				llist_node_insert_tail(prev_list, u);
 			}
 		}
@@ -628,31 +676,40 @@ void graph_dijkstra(const struct graph *g, struct node *src, struct dres *res,
 	if (ops && ops->destroy)
 		ops->destroy(state);
 
-	llist_node_destroy(Q);
+	scratch_free(arena, Q);
+
+	return 0;
 
-	res->dist = dist;
-	res->path = path;
-	res->prev = prev;
+out_queue:
+	scratch_free(arena, Q);
+out_maps:
+	if (dist && prev && path) {
+		graph_dijkstra_free(res);
+		return -1;
+	}
+
+	if (dist)
+		node_dist_destroy(dist);
+	if (prev)
+		node_map_destroy(prev);
+	if (path)
+		node_map_destroy(path);
+	return -1;
 }
 
 void graph_dijkstra_free(struct dres *res)
 {
-	struct llist_node *nhead;
-	struct hmap_entry *he;
+	struct node_map_slot *s;
 
-	hmap_foreach(res->path, he) {
-		nhead = he->elem;
-		destroy_pathres(nhead);
-	}
+	swiss_foreach(res->path, s)
+		destroy_pathres(s->val);
 
-	hmap_foreach(res->prev, he) {
-		nhead = he->elem;
-		llist_node_destroy(nhead);
-	}
+	swiss_foreach(res->prev, s)
+		llist_node_destroy(s->val);
 
-	hmap_destroy(res->prev);
-	hmap_destroy(res->path);
-	hmap_destroy(res->dist);
+	node_map_destroy(res->prev);
+	node_map_destroy(res->path);
+	node_dist_destroy(res->dist);
 }
 
 unsigned int graph_prune(struct graph *g,
@@ -681,7 +738,7 @@ static int insert_node_segment(struct node *node_i, struct llist_node *res)
 {
 	struct segment *s;
 
-	s = malloc(sizeof(*s));
+	s = segment_alloc();
 	if (!s)
 		return -1;
 
@@ -698,18 +755,15 @@ static int insert_node_segment(struct node *node_i, struct llist_node *res)
 static int insert_adj_segment(struct graph *g, struct node *node_i,
 			      struct node *node_ii, struct llist_node *res)
 {
-	struct nodepair pair;
 	struct edge *edge;
 	struct segment *s;
 
-	s = malloc(sizeof(*s));
-	if (!s)
+	edge = edge_map_get(g->min_edges, nodepair_key(node_i, node_ii));
+	if (!edge)
 		return -1;
 
-	pair.local = node_i;
-	pair.remote = node_ii;
-	edge = hmap_get(g->min_edges, &pair);
-	if (!edge)
+	s = segment_alloc();
+	if (!s)
 		return -1;
 
 	s->adjacency = true;
@@ -733,75 +787,31 @@ void free_segments(struct llist_node *segs)
 			edge_release(s->edge);
 		else
 			node_release(s->node);
-		free(s);
+		slab_free(segment_slab, s);
 	}
 
 	llist_node_destroy(segs);
 }
 
-struct llist_node *copy_segments(struct llist_node *segs)
-{
-	struct llist_node *nhead, *iter;
-	struct segment *s, *s2;
-
-	nhead = llist_node_alloc();
-	if (!nhead)
-		return NULL;
-
-	llist_node_foreach(segs, iter) {
-		s = iter->data;
-
-		s2 = malloc(sizeof(*s2));
-		if (!s2)
-			goto out_free;
-
-		memcpy(s2, s, sizeof(*s2));
-		if (s->adjacency)
-			edge_hold(s->edge);
-		else
-			node_hold(s->node);
-		llist_node_insert_tail(nhead, s2);
-	}
-
-	return nhead;
-
-out_free:
-	free_segments(nhead);
-	return NULL;
-}
-
-bool compare_segments(struct llist_node *segs1, struct llist_node *segs2)
+/* Store @res, computed by graph_dijkstra() without sp-ops, as the cached
+ * SP-DAG of @node. The cache takes ownership of @res.
+ */
+void graph_cache_set(struct graph *g, struct node *node, struct dres *res)
 {
-	struct llist_node *iter1, *iter2;
-	struct segment *s1, *s2;
-
-	iter2 = llist_node_first_entry(segs2);
-
-	if (llist_node_size(segs1) != llist_node_size(segs2))
-		return false;
-
-	llist_node_foreach(segs1, iter1) {
-		s1 = iter1->data;
-		s2 = iter2->data;
+	struct dres *old_res;
 
-		if (s1->adjacency != s2->adjacency)
-			return false;
-
-		if (s1->adjacency && (s1->edge->id != s2->edge->id))
-			return false;
-
-		if (!s1->adjacency && (s1->node->id != s2->node->id))
-			return false;
-
-		iter2 = llist_node_next_entry(iter2);
+	old_res = node_map_get(g->dcache, node->id);
+	if (old_res) {
+		graph_dijkstra_free(old_res);
+		free(old_res);
 	}
 
-	return true;
+	node_map_set(g->dcache, node->id, res);
 }
 
 int graph_build_cache_one(struct graph *g, struct node *node)
 {
-	struct dres *res, *old_res;
+	struct dres *res;
 
 	res = malloc(sizeof(*res));
 	if (!res)
@@ -811,13 +821,12 @@ int graph_build_cache_one(struct graph *g, struct node *node)
 	 * because it can unpredictably affect the result
 	 * and yield wrong cache entries.
 	 */
-	graph_dijkstra(g, node, res, NULL, NULL);
-
-	old_res = hmap_get(g->dcache, node);
-	if (old_res)
-		graph_dijkstra_free(old_res);
+	if (graph_dijkstra(g, node, res, NULL, NULL, NULL) < 0) {
+		free(res);
+		return -1;
+	}
 
-	hmap_set(g->dcache, node, res);
+	graph_cache_set(g, node, res);
 
 	return 0;
 }
@@ -838,18 +847,18 @@ int graph_build_cache(struct graph *g)
 
 void graph_flush_cache(struct graph *g)
 {
-	struct hmap_entry *he;
+	struct node_map_slot *s;
 
-	hmap_foreach(g->dcache, he) {
-		graph_dijkstra_free(he->elem);
-		free(he->elem);
+	swiss_foreach(g->dcache, s) {
+		graph_dijkstra_free(s->val);
+		free(s->val);
 	}
 
-	hmap_flush(g->dcache);
+	node_map_flush(g->dcache);
 }
 
 int graph_minseg(struct graph *g, struct llist_node *path,
-		 struct llist_node *res)
+		 struct llist_node *res, struct arena *arena)
 {
 	struct dres *cache_res_r, *cache_res_i;
 	struct node *node_r, *node_i, *node_ii;
@@ -873,22 +882,27 @@ int graph_minseg(struct graph *g, struct llist_node *path,
 		if (!node_r)
 			node_r = node_i;
 
-		cache_res_i = hmap_get(g->dcache, node_i);
-		cache_res_r = hmap_get(g->dcache, node_r);
+		cache_res_i = node_map_get(g->dcache, node_i->id);
+		cache_res_r = node_map_get(g->dcache, node_r->id);
 
 		if (cache_res_i)
 			res_i = *cache_res_i;
-		else
-			graph_dijkstra(g, node_i, &res_i, NULL, NULL);
+		else if (graph_dijkstra(g, node_i, &res_i, NULL, NULL,
+					arena) < 0)
+			return -1;
 
-		if (cache_res_r)
+		if (cache_res_r) {
 			res_r = *cache_res_r;
-		else
-			graph_dijkstra(g, node_r, &res_r, NULL, NULL);
+		} else if (graph_dijkstra(g, node_r, &res_r, NULL, NULL,
+					  arena) < 0) {
+			if (!cache_res_i)
+				graph_dijkstra_free(&res_i);
+			return -1;
+		}
 
-		prev = hmap_get(res_r.prev, node_ii);
+		prev = node_map_get(res_r.prev, node_ii->id);
 		if (!llist_node_exist(prev, node_i)) { /* MinSegECMP:4 */
-			prev = hmap_get(res_i.prev, node_ii);
+			prev = node_map_get(res_i.prev, node_ii->id);
 			if (llist_node_size(prev) == 1) { /* MinSegECMP:5 */
 				insert_node_segment(node_i, res);
 				node_r = node_i;
@@ -900,11 +914,11 @@ int graph_minseg(struct graph *g, struct llist_node *path,
 				node_r = node_ii;
 			}
 		} else {
-			prev = hmap_get(res_r.prev, node_ii);
+			prev = node_map_get(res_r.prev, node_ii->id);
 			if (llist_node_size(prev) <= 1) /* !MinSegECMP:11 */
 				goto next_free;
 
-			prev = hmap_get(res_i.prev, node_ii);
+			prev = node_map_get(res_i.prev, node_ii->id);
 			if (llist_node_size(prev) > 1) { /* MinSegECMP:12 */
 				insert_node_segment(node_i, res);
 				if (insert_adj_segment(g, node_i, node_ii,
@@ -940,7 +954,6 @@ static struct llist_node *nodes_to_edges(struct graph *g,
 {
 	struct llist_node *res, *iter;
 	struct node *node_i, *node_ii;
-	struct nodepair pair;
 	struct edge *edge;
 
 	res = llist_node_alloc();
@@ -954,10 +967,8 @@ static struct llist_node *nodes_to_edges(struct graph *g,
 		node_i = iter->data;
 		node_ii = llist_node_next_entry(iter)->data;
 
-		pair.local = node_i;
-		pair.remote = node_ii;
-
-		edge = hmap_get(g->min_edges, &pair);
+		edge = edge_map_get(g->min_edges,
+				    nodepair_key(node_i, node_ii));
 		if (!edge)
 			goto out_err;
 
@@ -1056,8 +1067,11 @@ struct llist_node *build_segpath(struct graph *g, struct pathspec *pspec,
 
 		tmp_node = iter->data;
 
-		graph_dijkstra(gc, cur_node, &gres, pspec->d_ops, pspec->data);
-		tmp_paths = hmap_get(gres.path, tmp_node);
+		if (graph_dijkstra(gc, cur_node, &gres, pspec->d_ops,
+				   pspec->data, pspec->arena) < 0)
+			goto out_graph;
+
+		tmp_paths = node_map_get(gres.path, tmp_node->id);
 		if (llist_node_empty(tmp_paths))
 			goto out_error;
 
@@ -1068,7 +1082,7 @@ struct llist_node *build_segpath(struct graph *g, struct pathspec *pspec,
 		rev_path = llist_node_copy_reverse(tmp_path);
 		llist_node_insert_head(rev_path, cur_node);
 
-		if (graph_minseg(g, rev_path, res) < 0)
+		if (graph_minseg(g, rev_path, res, pspec->arena) < 0)
 			goto out_error;
 
 		if (fpath)
@@ -1101,6 +1115,7 @@ struct llist_node *build_segpath(struct graph *g, struct pathspec *pspec,
 
 out_error:
 	graph_dijkstra_free(&gres);
+out_graph:
 	if (gc->cloned)
 		graph_destroy(gc, true);
 	if (fpath)
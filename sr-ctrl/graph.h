@@ -4,9 +4,10 @@
 #include <stdint.h>
 #include <pthread.h>
 
+#include "arena.h"
 #include "atomic.h"
 #include "llist.h"
-#include "hashmap.h"
+#include "swiss.h"
 
 /* The refcounting system used in nodes and edges enables them to be referenced
  * outside of graph critical sections. It is the programmer's responsibility
@@ -45,10 +46,15 @@ struct edge {
 	atomic_t refcount __refcount_aligned;
 };
 
-struct nodepair {
-	struct node *local;
-	struct node *remote;
-};
+/* node id => pointer, distance; (local id, remote id) => edge */
+SWISS_DEFINE(node_map, unsigned int, void *, swiss_hash_u64, swiss_eq)
+SWISS_DEFINE(node_dist, unsigned int, uint32_t, swiss_hash_u64, swiss_eq)
+SWISS_DEFINE(edge_map, uint64_t, struct edge *, swiss_hash_u64, swiss_eq)
+
+static inline uint64_t nodepair_key(struct node *local, struct node *remote)
+{
+	return (uint64_t)local->id << 32 | remote->id;
+}
 
 struct segment {
 	union {
@@ -107,9 +113,9 @@ struct graph {
 	struct llist_node *edges;
 	unsigned int last_node;
 	unsigned int last_edge;
-	struct hashmap *min_edges;
-	struct hashmap *neighs;
-	struct hashmap *dcache;
+	struct edge_map *min_edges;
+	struct node_map *neighs;
+	struct node_map *dcache;
 	pthread_rwlock_t lock;
 	bool dirty;
 	struct graph_ops *ops;
@@ -117,9 +123,9 @@ struct graph {
 };
 
 struct dres {
-	struct hashmap *dist;
-	struct hashmap *path;
-	struct hashmap *prev;
+	struct node_dist *dist;
+	struct node_map *path;
+	struct node_map *prev;
 };
 
 struct d_ops {
@@ -147,17 +153,16 @@ struct edge *graph_get_edge_data(struct graph *g, void *data);
 void graph_compute_minimal_edges(struct graph *g);
 void graph_compute_all_neighbors(struct graph *g);
 struct graph *graph_clone(struct graph *g);
-void graph_dijkstra(const struct graph *g, struct node *src, struct dres *res,
-		    struct d_ops *d_ops, void *data);
+int graph_dijkstra(const struct graph *g, struct node *src, struct dres *res,
+		   struct d_ops *d_ops, void *data, struct arena *arena);
 void graph_dijkstra_free(struct dres *res);
 unsigned int graph_prune(struct graph *g,
 			 bool (*prune)(struct edge *e, void *arg), void *_arg);
 int graph_minseg(struct graph *g, struct llist_node *path,
-		 struct llist_node *res);
+		 struct llist_node *res, struct arena *arena);
 
 void free_segments(struct llist_node *segs);
-struct llist_node *copy_segments(struct llist_node *segs);
-bool compare_segments(struct llist_node *segs1, struct llist_node *segs2);
+void graph_cache_set(struct graph *g, struct node *node, struct dres *res);
 int graph_build_cache_one(struct graph *g, struct node *node);
 int graph_build_cache(struct graph *g);
 void graph_flush_cache(struct graph *g);
@@ -172,6 +177,7 @@ struct pathspec {
 	void (*prune)(struct graph *g, struct pathspec *pspec);
 	struct d_ops *d_ops;
 	void *data;
+	struct arena *arena; /* scratch memory, NULL to malloc it */
 };
 
 struct llist_node *build_segpath(struct graph *g, struct pathspec *pspec,
@@ -199,14 +205,4 @@ static inline void graph_unlock(struct graph *g)
 	pthread_rwlock_unlock(&g->lock);
 }
 
-static inline int compare_node(void *k1, void *k2)
-{
-	return !(((struct node *)k1)->id == ((struct node *)k2)->id);
-}
-
-static inline unsigned int hash_node(void *key)
-{
-	return hashint(((struct node *)key)->id);
-}
-
 #endif
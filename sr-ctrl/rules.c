@@ -2,8 +2,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <arpa/inet.h>
 
 #include "llist.h"
+#include "hashmap.h"
+#include "lpm.h"
 #include "rules.h"
 #include "misc.h"
 
@@ -46,6 +49,73 @@ static int parse_path(struct rule *rule, char *buf)
 	return 0;
 }
 
+static int compile_regex(regex_t *re, const char *str)
+{
+	char buf[SLEN + 5];
+	int ret;
+
+	/* the whole name must match */
+	snprintf(buf, sizeof(buf), "^(%s)$", str);
+
+	ret = regcomp(re, buf, REG_EXTENDED | REG_NOSUB);
+	if (ret) {
+		regerror(ret, re, buf, sizeof(buf));
+		pr_err("invalid regular expression `%s' (%s).", str, buf);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int parse_prefix(struct rule *rule)
+{
+	char buf[SLEN + 1], *s, *end;
+	int i;
+
+	strcpy(buf, rule->from);
+	rule->from_plen = 128;
+
+	s = strchr(buf, '/');
+	if (s) {
+		*s++ = 0;
+		rule->from_plen = strtol(s, &end, 10);
+		if (*end || end == s || rule->from_plen < 0 ||
+		    rule->from_plen > 128)
+			goto out_err;
+	}
+
+	if (inet_pton(AF_INET6, buf, &rule->from_prefix) != 1)
+		goto out_err;
+
+	for (i = rule->from_plen; i < 128; i++)
+		rule->from_prefix.s6_addr[i / 8] &= ~(0x80 >> (i % 8));
+
+	return 0;
+
+out_err:
+	pr_err("invalid prefix `%s'.", rule->from);
+	return -1;
+}
+
+static int compile_rule(struct rule *rule)
+{
+	if (rule->from_type == MATCH_PREFIX && parse_prefix(rule) < 0)
+		return -1;
+
+	if (rule->from_type == MATCH_REGEX &&
+	    compile_regex(&rule->from_re, rule->from) < 0)
+		return -1;
+
+	if (rule->to_type == MATCH_REGEX &&
+	    compile_regex(&rule->to_re, rule->to) < 0) {
+		if (rule->from_type == MATCH_REGEX)
+			regfree(&rule->from_re);
+		return -1;
+	}
+
+	return 0;
+}
+
 static struct rule *parse_rule(const char *line)
 {
 	char **vargs, **orig_vargs;
@@ -57,6 +127,10 @@ static struct rule *parse_rule(const char *line)
 	if (!rule)
 		return NULL;
 
+	rule->priority = RULE_PRIO_NORMAL;
+	rule->from_type = MATCH_NAME;
+	rule->to_type = MATCH_NAME;
+
 	buf = strdup(line);
 	if (!buf) {
 		free(rule);
@@ -80,9 +154,23 @@ static struct rule *parse_rule(const char *line)
 			rule->type = RULE_DENY;
 		} else if (!strcmp(*vargs, "from")) {
 			NEXT_ARG();
+			if (!strcmp(*vargs, "regex")) {
+				NEXT_ARG();
+				rule->from_type = MATCH_REGEX;
+			} else if (!strcmp(*vargs, "prefix")) {
+				NEXT_ARG();
+				rule->from_type = MATCH_PREFIX;
+			}
 			strncpy(rule->from, *vargs, SLEN);
 		} else if (!strcmp(*vargs, "to")) {
 			NEXT_ARG();
+			if (!strcmp(*vargs, "regex")) {
+				NEXT_ARG();
+				rule->to_type = MATCH_REGEX;
+			} else if (!strcmp(*vargs, "prefix")) {
+				pr_err("prefixes only match sources.");
+				goto out_err;
+			}
 			strncpy(rule->to, *vargs, SLEN);
 		} else if (!strcmp(*vargs, "via")) {
 			NEXT_ARG();
@@ -105,6 +193,18 @@ static struct rule *parse_rule(const char *line)
 		} else if (!strcmp(*vargs, "idle")) {
 			NEXT_ARG();
 			rule->idle = strtol(*vargs, NULL, 10);
+		} else if (!strcmp(*vargs, "priority")) {
+			NEXT_ARG();
+			if (!strcmp(*vargs, "high")) {
+				rule->priority = RULE_PRIO_HIGH;
+			} else if (!strcmp(*vargs, "normal")) {
+				rule->priority = RULE_PRIO_NORMAL;
+			} else if (!strcmp(*vargs, "low")) {
+				rule->priority = RULE_PRIO_LOW;
+			} else {
+				pr_err("unknown priority `%s'.", *vargs);
+				goto out_err;
+			}
 		} else {
 			pr_err("unknown argument `%s'.", *vargs);
 			goto out_err;
@@ -126,6 +226,9 @@ static struct rule *parse_rule(const char *line)
 		goto out_err;
 	}
 
+	if (compile_rule(rule) < 0)
+		goto out_err;
+
 	free(orig_vargs);
 	free(buf);
 	return rule;
@@ -137,6 +240,17 @@ out_err:
 	return NULL;
 }
 
+/* Rules sharing a source, with a destination name or regex. The others
+ * are the destination regexes, or any rule of a source regex.
+ */
+struct rule_bucket {
+	struct rule **names; /* sorted by destination, one rule per name */
+	unsigned int nnames;
+	struct rule **others; /* last rule first */
+	unsigned int nothers;
+	char key[SLEN + 1];
+};
+
 void destroy_rule(struct rule *rule)
 {
 	struct llist_node *iter;
@@ -147,37 +261,251 @@ void destroy_rule(struct rule *rule)
 		llist_node_destroy(rule->path);
 	}
 
+	if (rule->from_type == MATCH_REGEX)
+		regfree(&rule->from_re);
+	if (rule->to_type == MATCH_REGEX)
+		regfree(&rule->to_re);
+
 	free(rule);
 }
 
-void destroy_rules(struct llist_node *rules, struct rule *defrule)
+static void destroy_bucket(struct rule_bucket *b)
+{
+	free(b->names);
+	free(b->others);
+	free(b);
+}
+
+void destroy_rules(struct ruleset *rs)
 {
 	struct llist_node *iter;
 
-	if (rules) {
-		llist_node_foreach(rules, iter)
+	if (rs->buckets) {
+		llist_node_foreach(rs->buckets, iter)
+			destroy_bucket(iter->data);
+		llist_node_destroy(rs->buckets);
+	}
+	if (rs->names)
+		hmap_destroy(rs->names);
+	if (rs->prefixes)
+		lpm_destroy(rs->prefixes);
+	if (rs->regexes)
+		hmap_destroy(rs->regexes);
+
+	if (rs->rules) {
+		llist_node_foreach(rs->rules, iter)
 			destroy_rule(iter->data);
-		llist_node_destroy(rules);
+		llist_node_destroy(rs->rules);
+	}
+	if (rs->defrule)
+		destroy_rule(rs->defrule);
+
+	free(rs);
+}
+
+static int rules_append(struct rule ***array, unsigned int *n,
+			struct rule *rule)
+{
+	struct rule **tmp;
+
+	/* grown on powers of two */
+	if (!(*n & (*n - 1))) {
+		tmp = realloc(*array, (*n ? *n * 2 : 1) * sizeof(*tmp));
+		if (!tmp)
+			return -1;
+		*array = tmp;
+	}
+
+	(*array)[(*n)++] = rule;
+	return 0;
+}
+
+static void rules_reverse(struct rule **array, unsigned int n)
+{
+	struct rule *tmp;
+	unsigned int i;
+
+	for (i = 0; i < n / 2; i++) {
+		tmp = array[i];
+		array[i] = array[n - i - 1];
+		array[n - i - 1] = tmp;
+	}
+}
+
+static struct rule_bucket *find_prefix_bucket(struct lpm_tree *tree,
+					      struct in6_addr *prefix,
+					      int plen)
+{
+	struct lpm_node *node;
+
+	for (node = lpm_lookup_node(tree, prefix); node; node = node->parent) {
+		if (node->plen == plen && node->data &&
+		    node->data != (void *)-1)
+			return node->data;
 	}
-	if (defrule)
-		destroy_rule(defrule);
+
+	return NULL;
 }
 
-struct llist_node *load_rules(const char *fname, struct rule **defrule)
+/* Characters that any name matching @re starts with. A regex with an
+ * alternation has none.
+ */
+static void regex_literal_prefix(const char *re, char *buf)
 {
-	struct llist_node *rules;
+	const char *meta = ".[]()*+?{}|^$\\";
+	size_t i;
+
+	if (strchr(re, '|')) {
+		*buf = 0;
+		return;
+	}
+
+	for (i = 0; re[i] && !strchr(meta, re[i]); i++)
+		buf[i] = re[i];
+
+	/* the last literal may be repeated zero times */
+	if (i && re[i] && strchr("*?{", re[i]))
+		i--;
+
+	buf[i] = 0;
+}
+
+static struct rule_bucket *get_bucket(struct ruleset *rs, struct rule *rule)
+{
+	char prefix[SLEN + 1];
+	struct rule_bucket *b;
+
+	if (rule->from_type == MATCH_NAME) {
+		b = hmap_get(rs->names, rule->from);
+	} else if (rule->from_type == MATCH_REGEX) {
+		regex_literal_prefix(rule->from, prefix);
+		b = hmap_get(rs->regexes, prefix);
+	} else {
+		b = find_prefix_bucket(rs->prefixes, &rule->from_prefix,
+				       rule->from_plen);
+	}
+	if (b)
+		return b;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+
+	if (!llist_node_insert_tail(rs->buckets, b)) {
+		free(b);
+		return NULL;
+	}
+
+	if (rule->from_type == MATCH_NAME) {
+		if (hmap_set(rs->names, rule->from, b) < 0)
+			return NULL;
+	} else if (rule->from_type == MATCH_REGEX) {
+		strcpy(b->key, prefix);
+		if (hmap_set(rs->regexes, b->key, b) < 0)
+			return NULL;
+		rs->regex_lens[strlen(prefix)] = true;
+	} else {
+		if (!lpm_insert(rs->prefixes, &rule->from_prefix,
+				rule->from_plen, b))
+			return NULL;
+		rs->nprefixes++;
+	}
+
+	return b;
+}
+
+/* by destination, the last rule first */
+static int compare_names(const void *a, const void *b)
+{
+	const struct rule *r1 = *(struct rule **)a, *r2 = *(struct rule **)b;
+	int ret;
+
+	ret = strcmp(r1->to, r2->to);
+	if (ret)
+		return ret;
+
+	return r1->id < r2->id ? 1 : -1;
+}
+
+static void finalize_bucket(struct rule_bucket *b)
+{
+	unsigned int i, n = 0;
+
+	qsort(b->names, b->nnames, sizeof(*b->names), compare_names);
+
+	/* only the last rule of a destination can match */
+	for (i = 0; i < b->nnames; i++) {
+		if (n && !strcmp(b->names[n - 1]->to, b->names[i]->to))
+			continue;
+		b->names[n++] = b->names[i];
+	}
+	b->nnames = n;
+
+	rules_reverse(b->others, b->nothers);
+}
+
+/* Rules are indexed by source name, prefix or regex literal prefix, and
+ * then by destination name. A request only tries the rules of the
+ * buckets of its source, the last rule first, and the rules defined
+ * before the best match found so far are skipped.
+ */
+static int build_index(struct ruleset *rs)
+{
+	struct llist_node *iter;
+	struct rule_bucket *b;
+	struct rule *rule;
+	int ret;
+
+	rs->names = hmap_new(hash_str, compare_str);
+	rs->prefixes = lpm_new();
+	rs->regexes = hmap_new(hash_str, compare_str);
+	rs->buckets = llist_node_alloc();
+	if (!rs->names || !rs->prefixes || !rs->regexes || !rs->buckets)
+		return -1;
+
+	llist_node_foreach(rs->rules, iter) {
+		rule = iter->data;
+
+		b = get_bucket(rs, rule);
+		if (!b)
+			return -1;
+
+		if (rule->from_type == MATCH_REGEX ||
+		    rule->to_type == MATCH_REGEX)
+			ret = rules_append(&b->others, &b->nothers, rule);
+		else
+			ret = rules_append(&b->names, &b->nnames, rule);
+		if (ret < 0)
+			return -1;
+	}
+
+	llist_node_foreach(rs->buckets, iter)
+		finalize_bucket(iter->data);
+
+	return 0;
+}
+
+struct ruleset *load_rules(const char *fname)
+{
+	struct ruleset *rs;
 	struct rule *rule;
 	char line[1024];
 	int ln = 0;
 	FILE *fp;
 
-	*defrule = NULL;
-
 	fp = fopen(fname, "r");
 	if (!fp)
 		return NULL;
 
-	rules = llist_node_alloc();
+	rs = calloc(1, sizeof(*rs));
+	if (!rs) {
+		fclose(fp);
+		return NULL;
+	}
+
+	rs->rules = llist_node_alloc();
+	if (!rs->rules)
+		goto out_err;
 
 	while (fgets(line, 1024, fp)) {
 		ln++;
@@ -192,9 +520,10 @@ struct llist_node *load_rules(const char *fname, struct rule **defrule)
 		}
 
 		if (rule->is_default) {
-			if (!*defrule) {
-				*defrule = rule;
+			if (!rs->defrule) {
+				rs->defrule = rule;
 			} else {
+				destroy_rule(rule);
 				pr_err("duplicate default rule at %s line %d.", fname, ln);
 				goto out_err;
 			}
@@ -202,48 +531,122 @@ struct llist_node *load_rules(const char *fname, struct rule **defrule)
 			continue;
 		}
 
-		if (!llist_node_insert_tail(rules, rule)) {
+		rule->id = rs->nrules;
+
+		if (!llist_node_insert_tail(rs->rules, rule)) {
+			destroy_rule(rule);
 			pr_err("failed to insert rule at %s line %d.", fname, ln);
 			goto out_err;
 		}
+
+		rs->nrules++;
 	}
 
 	fclose(fp);
+	fp = NULL;
 
-	if (!*defrule) {
+	if (!rs->defrule) {
 		rule = calloc(1, sizeof(*rule));
+		if (!rule)
+			goto out_err;
 		rule->is_default = true;
 		rule->type = RULE_DENY;
-		*defrule = rule;
+		rule->priority = RULE_PRIO_NORMAL;
+		rs->defrule = rule;
 	}
 
-	return rules;
+	if (build_index(rs) < 0) {
+		pr_err("failed to index rules of %s.", fname);
+		goto out_err;
+	}
+
+	rs->refcount = 1;
+
+	return rs;
 
 out_err:
-	destroy_rules(rules, *defrule);
-	fclose(fp);
+	destroy_rules(rs);
+	if (fp)
+		fclose(fp);
 	return NULL;
 }
 
+static int compare_dest(const void *key, const void *elem)
+{
+	return strcmp(key, (*(struct rule **)elem)->to);
+}
+
 static bool match_rule(struct rule *rule, const char *from, const char *to)
 {
-	if (!strcmp(rule->from, from) && !strcmp(rule->to, to))
-		return true;
+	if (rule->from_type == MATCH_REGEX &&
+	    regexec(&rule->from_re, from, 0, NULL, 0))
+		return false;
 
-	return false;
+	if (rule->to_type == MATCH_REGEX)
+		return !regexec(&rule->to_re, to, 0, NULL, 0);
+
+	return !strcmp(rule->to, to);
 }
 
-struct rule *match_rules(struct llist_node *rules, const char *from, const char *to)
+static struct rule *match_bucket(struct rule_bucket *b, const char *from,
+				 const char *to, struct rule *best)
 {
-	struct rule *match = NULL;
-	struct llist_node *iter;
-	struct rule *r;
+	struct rule **r;
+	unsigned int i;
+
+	r = bsearch(to, b->names, b->nnames, sizeof(*b->names), compare_dest);
+	if (r && (!best || (*r)->id > best->id))
+		best = *r;
+
+	for (i = 0; i < b->nothers; i++) {
+		if (best && b->others[i]->id < best->id)
+			break;
+
+		if (match_rule(b->others[i], from, to))
+			return b->others[i];
+	}
+
+	return best;
+}
+
+/* Last rule of the file matching the request, or the default rule.
+ * @srcaddr is only used by the source prefixes and can be NULL.
+ */
+struct rule *match_rules(struct ruleset *rs, const char *from, const char *to,
+			 const char *srcaddr)
+{
+	char prefix[SLEN + 1];
+	struct rule *best = NULL;
+	struct rule_bucket *b;
+	struct lpm_node *node;
+	struct in6_addr addr;
+	size_t len;
+
+	b = hmap_get(rs->names, (void *)from);
+	if (b)
+		best = match_bucket(b, from, to, best);
+
+	if (rs->nprefixes && srcaddr &&
+	    inet_pton(AF_INET6, srcaddr, &addr) == 1) {
+		node = lpm_lookup_node(rs->prefixes, &addr);
+		for (; node; node = node->parent) {
+			if (node->data && node->data != (void *)-1)
+				best = match_bucket(node->data, from, to,
+						    best);
+		}
+	}
+
+	for (len = 0; len <= SLEN && (!len || from[len - 1]); len++) {
+		if (!rs->regex_lens[len])
+			continue;
+
+		memcpy(prefix, from, len);
+		prefix[len] = 0;
 
-	llist_node_foreach(rules, iter) {
-		r = iter->data;
-		if (match_rule(r, from, to))
-			match = r;
+		b = hmap_get(rs->regexes, prefix);
+		if (b)
+			best = match_bucket(b, from, to, best);
 	}
 
-	return match;
+	return best ?: rs->defrule;
 }
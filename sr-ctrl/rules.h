@@ -1,14 +1,25 @@
 #ifndef _RULES_H
 #define _RULES_H
 
+#include <regex.h>
 #include <srdb.h>
 
+#include "atomic.h"
+
 enum ruletype {
 	RULE_NONE,
 	RULE_ALLOW,
 	RULE_DENY,
 };
 
+/* admission class of the requests matching a rule */
+enum rule_priority {
+	RULE_PRIO_HIGH,
+	RULE_PRIO_NORMAL,
+	RULE_PRIO_LOW,
+	RULE_PRIO_MAX,
+};
+
 enum matchtype {
 	MATCH_NONE,
 	MATCH_NAME,
@@ -21,16 +32,57 @@ struct rule {
 	enum ruletype type;
 	char from[SLEN + 1];
 	char to[SLEN + 1];
+	enum matchtype from_type;
+	enum matchtype to_type;
+	regex_t from_re;
+	regex_t to_re;
+	struct in6_addr from_prefix;
+	int from_plen;
 	struct llist_node *path;
 	char last[SLEN + 1];
 	int bw;
 	int delay;
 	int ttl;
 	int idle;
+	enum rule_priority priority;
+	unsigned int id; /* position in the file, the last matching rule wins */
+};
+
+struct rule_bucket;
+
+/* The rules of a file, indexed by source: exact names in a hash table,
+ * source prefixes in a trie and precompiled regular expressions by their
+ * literal prefix. A ruleset is held by the requests that use its rules
+ * and destroyed when the last reference is released.
+ */
+struct ruleset {
+	atomic_t refcount;
+	struct llist_node *rules;
+	struct rule *defrule;
+	unsigned int nrules;
+	struct hashmap *names; /* source name -> struct rule_bucket */
+	struct lpm_tree *prefixes; /* source prefix -> struct rule_bucket */
+	unsigned int nprefixes;
+	struct hashmap *regexes; /* literal prefix -> struct rule_bucket */
+	bool regex_lens[SLEN + 1]; /* lengths of the literal prefixes */
+	struct llist_node *buckets;
 };
 
-struct llist_node *load_rules(const char *fname, struct rule **defrule);
-void destroy_rules(struct llist_node *rules, struct rule *defrule);
-struct rule *match_rules(struct llist_node *rules, const char *from, const char *to);
+struct ruleset *load_rules(const char *fname);
+void destroy_rules(struct ruleset *rs);
+struct rule *match_rules(struct ruleset *rs, const char *from, const char *to,
+			 const char *srcaddr);
+
+static inline struct ruleset *ruleset_hold(struct ruleset *rs)
+{
+	atomic_inc(&rs->refcount);
+	return rs;
+}
+
+static inline void ruleset_release(struct ruleset *rs)
+{
+	if (atomic_dec(&rs->refcount) == 0)
+		destroy_rules(rs);
+}
 
 #endif
@@ -4,7 +4,15 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <signal.h>
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <libgen.h>
 #include <zlog.h>
 
 #include "llist.h"
@@ -12,10 +20,12 @@
 #include "srdb.h"
 #include "rules.h"
 #include "hashmap.h"
+#include "shmap.h"
 #include "graph.h"
 #include "lpm.h"
 #include "sr-ctrl.h"
-#include "sbuf.h"
+#include "executor.h"
+#include "rcu.h"
 
 #define DEFAULT_CONFIG	"sr-ctrl.conf"
 
@@ -34,36 +44,101 @@ struct provider internal_provider = {
 	.priority = 0
 };
 
+/* Adaptive debounce of the staging graph synchronization (us). The
+ * event fields are updated with the staging graph lock, the others by
+ * the network monitor only.
+ */
+struct gsync_sched {
+	uint64_t window; /* soft timeout */
+	uint64_t hard; /* hard timeout */
+	uint64_t interval; /* moving average between topology events */
+	uint64_t cost; /* moving average of a rebuild */
+	uint64_t last_event;
+	uint64_t gap; /* before the last event */
+	unsigned int batch; /* events since the last rebuild */
+
+	uint64_t events;
+	uint64_t rebuilds;
+	uint64_t rebuild_time;
+	uint64_t rebuild_max;
+};
+
 struct netstate {
 	struct graph *graph;
 	struct graph *graph_staging;
-	struct timeval gs_mod;
-	struct timeval gs_dirty;
+	uint64_t gs_mod; /* us, CLOCK_MONOTONIC */
+	uint64_t gs_dirty;
+	struct gsync_sched gsync;
+	int event_fd; /* wakes up the network monitor */
+	bool stop;
 	struct hashmap *routers;
-	struct lpm_tree *prefixes;
+	struct lpm_tree *prefixes; /* updated under the write lock */
+	struct lpm_mbt *prefix_trie; /* compiled @prefixes, read under RCU */
+	struct rcu prefix_rcu;
 	pthread_rwlock_t lock;
 };
 
+/* Classes of the tasks run by the executor, served in this order */
+enum task_class {
+	TASK_CACHE,		/* SP-DAG cache of a new network graph */
+	TASK_REQ_HIGH,
+	TASK_RECOMPUTE,		/* flows affected by a topology change */
+	TASK_REQ_NORMAL,
+	TASK_REQ_LOW,
+	TASK_REEVALUATE,	/* flows checked against reloaded rules */
+	TASK_EXPIRY,		/* status update of expired flows */
+	TASK_REJECT,		/* rejections that could not be queued */
+	TASK_CLASSES,
+};
+
+static const enum task_class req_class[RULE_PRIO_MAX] = {
+	[RULE_PRIO_HIGH]	= TASK_REQ_HIGH,
+	[RULE_PRIO_NORMAL]	= TASK_REQ_NORMAL,
+	[RULE_PRIO_LOW]		= TASK_REQ_LOW,
+};
+
+/* Requests waiting for a worker, at most req_buffer_size per rule
+ * priority. Above the high watermark of queued requests, only the high
+ * priority ones are admitted until the queues drain below the low
+ * watermark.
+ */
+struct admission {
+	unsigned int queued[RULE_PRIO_MAX];
+	unsigned int total;
+	bool overload; /* only accessed by the FlowReq monitor */
+	unsigned long rejected;
+};
+
 struct config {
 	char rules_file[SLEN + 1];
+	int rules_watch;
+	int rules_reevaluate;
+	unsigned int bsid_offset;
+	unsigned int bsid_count;
+	unsigned int bsid_quarantine;
 	struct ovsdb_config ovsdb_conf;
 	unsigned int worker_threads;
 	unsigned int req_buffer_size;
+	unsigned int req_high_watermark;
+	unsigned int req_low_watermark;
 	struct provider *providers;
 	unsigned int nb_providers;
 	char zlog_conf_file[SLEN + 1];
 
 	/* internal data */
 	struct srdb *srdb;
-	struct llist_node *rules;
-	struct rule *defrule;
-	struct sbuf *req_buffer;
+	struct ruleset *rules; /* replaced on reload, see rules_rcu */
+	struct rcu rules_rcu;
+	struct admission adm;
+	struct executor *ex;
+	struct task_group recompute;
 	struct netstate ns;
-	struct hashmap *flows;
+	struct shmap *flows; /* keyed by BSID */
 };
 
 static struct config _cfg;
 static zlog_category_t *zc;
+static pthread_key_t arena_key;
 
 static int srdb_print(const char *fmt, ...)
 {
@@ -92,17 +167,135 @@ static void net_state_unlock(struct netstate *ns)
 static void config_set_defaults(struct config *cfg)
 {
 	strcpy(cfg->rules_file, "rules.conf");
+	cfg->rules_watch = 0;
+	cfg->rules_reevaluate = 0;
+	cfg->bsid_offset = 1;
+	cfg->bsid_count = 65536;
+	cfg->bsid_quarantine = 30;
 	strcpy(cfg->ovsdb_conf.ovsdb_client, "ovsdb-client");
 	strcpy(cfg->ovsdb_conf.ovsdb_server, "tcp:[::1]:6640");
 	strcpy(cfg->ovsdb_conf.ovsdb_database, "SR_test");
 	cfg->ovsdb_conf.ntransacts = 1;
 	cfg->worker_threads = 1;
 	cfg->req_buffer_size = 16;
+	cfg->req_high_watermark = 0;
+	cfg->req_low_watermark = 0;
 	cfg->providers = &internal_provider;
 	cfg->nb_providers = 1;
 	*cfg->zlog_conf_file = '\0';
 }
 
+#define GSYNC_WINDOW_INIT	5000
+#define GSYNC_WINDOW_MIN	1000
+#define GSYNC_WINDOW_MAX	100000
+#define GSYNC_HARD_MIN		50000
+#define GSYNC_HARD_MAX		1000000
+#define GSYNC_HARD_FACTOR	10 /* hard timeout in windows */
+#define GSYNC_DUTY_FACTOR	4 /* hard timeout in rebuild costs */
+#define GSYNC_CHURN		4 /* event interval in windows under churn */
+#define GSYNC_ISOLATED		8 /* event interval in windows when isolated */
+#define GSYNC_QUIET		1000000 /* gap resetting the window */
+#define GSYNC_EWMA_SHIFT	3
+
+static void gsync_init(struct gsync_sched *gs)
+{
+	memset(gs, 0, sizeof(*gs));
+	gs->window = GSYNC_WINDOW_INIT;
+	gs->hard = GSYNC_HARD_MIN;
+	gs->interval = GSYNC_HARD_MAX;
+}
+
+static uint64_t ewma(uint64_t avg, uint64_t sample)
+{
+	return avg - (avg >> GSYNC_EWMA_SHIFT) + (sample >> GSYNC_EWMA_SHIFT);
+}
+
+static void gsync_event(struct gsync_sched *gs, uint64_t now)
+{
+	uint64_t delta;
+
+	delta = gs->last_event ? now - gs->last_event : GSYNC_HARD_MAX;
+	if (delta > GSYNC_HARD_MAX)
+		delta = GSYNC_HARD_MAX;
+
+	gs->interval = ewma(gs->interval, delta);
+	gs->last_event = now;
+	__atomic_store_n(&gs->gap, delta, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&gs->batch, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&gs->events, 1, __ATOMIC_RELAXED);
+}
+
+/* A single event after a quiet period is handled with the minimum window */
+static uint64_t gsync_window(struct gsync_sched *gs)
+{
+	if (__atomic_load_n(&gs->batch, __ATOMIC_RELAXED) == 1 &&
+	    __atomic_load_n(&gs->gap, __ATOMIC_RELAXED) >= GSYNC_QUIET)
+		return GSYNC_WINDOW_MIN;
+
+	return gs->window;
+}
+
+/* Called after a rebuild that merged @batch events and took @cost us.
+ * The window doubles while events are merged or close to each other and
+ * halves once they are isolated again. The hard timeout follows the
+ * window, but leaves at least GSYNC_DUTY_FACTOR rebuild costs between two
+ * rebuilds so that a flap storm cannot keep the controller rebuilding.
+ */
+static void gsync_adapt(struct gsync_sched *gs, unsigned int batch,
+			uint64_t cost)
+{
+	uint64_t window = gs->window, hard;
+
+	gs->cost = gs->rebuilds ? ewma(gs->cost, cost) : cost;
+
+	__atomic_add_fetch(&gs->rebuilds, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&gs->rebuild_time, cost, __ATOMIC_RELAXED);
+	if (cost > gs->rebuild_max)
+		__atomic_store_n(&gs->rebuild_max, cost, __ATOMIC_RELAXED);
+
+	if (batch == 1 && gs->gap >= GSYNC_QUIET)
+		window = GSYNC_WINDOW_MIN;
+	else if (batch > 1 || gs->interval < window * GSYNC_CHURN)
+		window *= 2;
+	else if (gs->gap > window * GSYNC_ISOLATED &&
+		 gs->interval > window * GSYNC_ISOLATED)
+		window /= 2;
+
+	if (window < GSYNC_WINDOW_MIN)
+		window = GSYNC_WINDOW_MIN;
+	if (window > GSYNC_WINDOW_MAX)
+		window = GSYNC_WINDOW_MAX;
+
+	hard = window * GSYNC_HARD_FACTOR;
+	if (hard < gs->cost * GSYNC_DUTY_FACTOR)
+		hard = gs->cost * GSYNC_DUTY_FACTOR;
+	if (hard < GSYNC_HARD_MIN)
+		hard = GSYNC_HARD_MIN;
+	if (hard > GSYNC_HARD_MAX)
+		hard = GSYNC_HARD_MAX;
+
+	__atomic_store_n(&gs->window, window, __ATOMIC_RELAXED);
+	__atomic_store_n(&gs->hard, hard, __ATOMIC_RELAXED);
+}
+
+static void gsync_dump(struct gsync_sched *gs, FILE *out)
+{
+	uint64_t rebuilds = __atomic_load_n(&gs->rebuilds, __ATOMIC_RELAXED);
+	uint64_t time = __atomic_load_n(&gs->rebuild_time, __ATOMIC_RELAXED);
+
+	fprintf(out, "netmon: window %llu us hard %llu us events %llu interval %llu us rebuilds %llu rebuild avg %llu us ewma %llu us max %llu us\n",
+		(unsigned long long)__atomic_load_n(&gs->window, __ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&gs->hard, __ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&gs->events, __ATOMIC_RELAXED),
+		(unsigned long long)gs->interval,
+		(unsigned long long)rebuilds,
+		(unsigned long long)(rebuilds ? time / rebuilds : 0),
+		(unsigned long long)gs->cost,
+		(unsigned long long)__atomic_load_n(&gs->rebuild_max,
+						    __ATOMIC_RELAXED));
+	fflush(out);
+}
+
 static int init_netstate(struct netstate *ns)
 {
 	ns->graph = graph_new(&g_ops_srdns);
@@ -121,10 +314,25 @@ static int init_netstate(struct netstate *ns)
 	if (!ns->prefixes)
 		goto out_free_rt;
 
+	ns->prefix_trie = lpm_mbt_build(ns->prefixes);
+	if (!ns->prefix_trie)
+		goto out_free_lpm;
+
+	ns->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ns->event_fd < 0)
+		goto out_free_trie;
+
+	gsync_init(&ns->gsync);
+	rcu_init(&ns->prefix_rcu);
+
 	pthread_rwlock_init(&ns->lock, NULL);
 
 	return 0;
 
+out_free_trie:
+	lpm_mbt_free(ns->prefix_trie);
+out_free_lpm:
+	lpm_destroy(ns->prefixes);
 out_free_rt:
 	hmap_destroy(ns->routers);
 out_free_graph2:
@@ -139,9 +347,6 @@ static void destroy_netstate(void)
 	struct netstate *ns = &_cfg.ns;
 	struct hmap_entry *he;
 
-	hmap_foreach(_cfg.flows, he)
-		flow_release(he->elem);
-
 	graph_destroy(ns->graph, false);
 	graph_destroy(ns->graph_staging, false);
 
@@ -151,28 +356,151 @@ static void destroy_netstate(void)
 	hmap_destroy(ns->routers);
 
 	lpm_destroy(ns->prefixes);
+	lpm_mbt_free(ns->prefix_trie);
+	rcu_destroy(&ns->prefix_rcu);
+
+	close(ns->event_fd);
+}
+
+/* The flows hold their routers, they go before the network state */
+static void destroy_flows(void)
+{
+	struct hmap_entry *he;
+	struct hashmap *hm;
+	unsigned int i;
+
+	shmap_foreach_shard(_cfg.flows, i, hm) {
+		hmap_foreach(hm, he)
+			flow_release(he->elem);
+	}
+
+	shmap_destroy(_cfg.flows);
+}
+
+static void netmon_wakeup(struct netstate *ns)
+{
+	uint64_t one = 1;
+
+	if (write(ns->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		zlog_error(zc, "failed to wake up network monitor.\n");
 }
 
 static void mark_graph_dirty(void)
 {
-	if (!_cfg.ns.graph_staging->dirty)
-		gettimeofday(&_cfg.ns.gs_dirty, NULL);
+	struct netstate *ns = &_cfg.ns;
+
+	ns->gs_mod = srdb_now_us();
+
+	if (!ns->graph_staging->dirty)
+		ns->gs_dirty = ns->gs_mod;
+
+	ns->graph_staging->dirty = true;
+
+	gsync_event(&ns->gsync, ns->gs_mod);
+
+	netmon_wakeup(ns);
+}
+
+#define CACHE_CHUNK	8
+
+struct cache_chunk {
+	struct graph *g;
+	struct node **nodes;
+	struct dres **res;
+	unsigned int count;
+};
+
+static void cache_chunk_build(void *arg)
+{
+	struct cache_chunk *cc = arg;
+	unsigned int i;
+
+	for (i = 0; i < cc->count; i++) {
+		cc->res[i] = malloc(sizeof(struct dres));
+		if (cc->res[i] && graph_dijkstra(cc->g, cc->nodes[i],
+						 cc->res[i], NULL, NULL,
+						 NULL) < 0) {
+			free(cc->res[i]);
+			cc->res[i] = NULL;
+		}
+	}
+}
+
+/* Same as graph_build_cache(), with the SP-DAGs computed in parallel by
+ * the executor. @g must not be shared yet.
+ */
+static int build_cache(struct graph *g)
+{
+	struct cache_chunk *chunks;
+	struct task_group group;
+	struct llist_node *iter;
+	struct node **nodes;
+	struct dres **res;
+	unsigned int n, i;
+
+	n = llist_node_size(g->nodes);
+	if (!n)
+		return 0;
+
+	nodes = malloc(n * sizeof(*nodes));
+	res = calloc(n, sizeof(*res));
+	chunks = malloc((n / CACHE_CHUNK + 1) * sizeof(*chunks));
+	if (!nodes || !res || !chunks) {
+		free(nodes);
+		free(res);
+		free(chunks);
+		return graph_build_cache(g);
+	}
+
+	i = 0;
+	llist_node_foreach(g->nodes, iter)
+		nodes[i++] = iter->data;
+
+	task_group_init(&group);
+
+	for (i = 0; i < n; i += CACHE_CHUNK) {
+		struct cache_chunk *cc = &chunks[i / CACHE_CHUNK];
+
+		cc->g = g;
+		cc->nodes = &nodes[i];
+		cc->res = &res[i];
+		cc->count = n - i < CACHE_CHUNK ? n - i : CACHE_CHUNK;
+
+		if (executor_submit(_cfg.ex, TASK_CACHE, cache_chunk_build, cc,
+				    &group) < 0)
+			cache_chunk_build(cc);
+	}
+
+	task_group_wait(_cfg.ex, &group);
+	task_group_destroy(&group);
+
+	for (i = 0; i < n; i++) {
+		if (res[i])
+			graph_cache_set(g, nodes[i], res[i]);
+	}
 
-	gettimeofday(&_cfg.ns.gs_mod, NULL);
+	free(chunks);
+	free(res);
+	free(nodes);
 
-	_cfg.ns.graph_staging->dirty = true;
+	return 0;
 }
 
+/* The new graph is finalized and its cache built outside of the netstate
+ * lock, which is only taken to swap the graphs.
+ */
 static int netstate_graph_sync(struct netstate *ns)
 {
 	struct graph *g, *old_g;
+	unsigned int batch;
+	uint64_t start;
+
+	start = srdb_now_us();
 
-	net_state_write_lock(ns);
 	graph_write_lock(ns->graph_staging);
 
 	if (!ns->graph_staging->dirty) {
 		graph_unlock(ns->graph_staging);
-		net_state_unlock(ns);
 		return 0;
 	}
 
@@ -180,22 +508,30 @@ static int netstate_graph_sync(struct netstate *ns)
 
 	if (!g) {
 		graph_unlock(ns->graph_staging);
-		net_state_unlock(ns);
 		return -1;
 	}
 
+	ns->graph_staging->dirty = false;
+	batch = ns->gsync.batch;
+	ns->gsync.batch = 0;
+
+	graph_unlock(ns->graph_staging);
+
 	graph_finalize(g);
-	graph_build_cache(g);
+	build_cache(g);
 
+	net_state_write_lock(ns);
 	old_g = ns->graph;
 	ns->graph = g;
+	net_state_unlock(ns);
 
 	graph_destroy(old_g, false);
 
-	ns->graph_staging->dirty = false;
+	gsync_adapt(&ns->gsync, batch, srdb_now_us() - start);
 
-	graph_unlock(ns->graph_staging);
-	net_state_unlock(ns);
+	zlog_debug(zc, "graph rebuilt after %u events, window %llu us hard %llu us.\n",
+		   batch, (unsigned long long)ns->gsync.window,
+		   (unsigned long long)ns->gsync.hard);
 
 	return 0;
 }
@@ -269,11 +605,29 @@ static json_t *pref_srcips_to_json(struct flow *fl)
 	return json;
 }
 
+/* Addresses of the segments built by build_segpath(), which are freed */
+static struct seglist *resolve_segments(struct llist_node *segs)
+{
+	struct llist_node *iter;
+	struct seglist *sl;
+	unsigned int i = 0;
+
+	sl = seglist_new(llist_node_size(segs));
+	if (sl) {
+		llist_node_foreach(segs, iter)
+			sl->segs[i++] = *segment_addr(iter->data);
+	}
+
+	free_segments(segs);
+
+	return sl;
+}
+
 static json_t *pref_segs_to_json(struct flow *fl)
 {
 	char ip[INET6_ADDRSTRLEN];
-	struct llist_node *iter;
-	unsigned int i;
+	struct seglist *sl;
+	unsigned int i, j;
 	json_t *json;
 
 	json = json_array();
@@ -281,13 +635,10 @@ static json_t *pref_segs_to_json(struct flow *fl)
 	for (i = 0; i < fl->nb_prefixes; i++) {
 		json_t *segs;
 
+		sl = fl->src_prefixes[i].segs;
 		segs = json_array();
-		llist_node_foreach(fl->src_prefixes[i].segs, iter) {
-			struct segment *s = iter->data;
-			struct in6_addr *addr;
-
-			addr = segment_addr(s);
-			inet_ntop(AF_INET6, addr, ip, INET6_ADDRSTRLEN);
+		for (j = 0; j < sl->count; j++) {
+			inet_ntop(AF_INET6, &sl->segs[j], ip, INET6_ADDRSTRLEN);
 			json_array_append_new(segs, json_string(ip));
 		}
 		json_array_append_new(json, segs);
@@ -371,7 +722,7 @@ static int commit_flow(struct flow *fl)
 	struct srdb_table *tbl;
 	int ret;
 
-	fe = malloc(sizeof(*fe));
+	fe = calloc(1, sizeof(*fe));
 	if (!fe)
 		return -1;
 
@@ -389,18 +740,11 @@ static int commit_flow(struct flow *fl)
 	return ret;
 }
 
-static void generate_bsid(struct router *rt, struct in6_addr *res)
-{
-	int len = (128 - rt->pbsid.len) >> 3;
-	memcpy(res, &rt->pbsid.addr, sizeof(struct in6_addr));
-	get_random_bytes((unsigned char *)res + (16 - len), len);
-}
-
-static void generate_unique_bsid(struct router *rt, struct in6_addr *res)
+/* false if the prefix @i shares the BSID of the first one */
+static bool own_bsid(struct flow *fl, unsigned int i)
 {
-	do {
-		generate_bsid(rt, res);
-	} while (hmap_get(_cfg.flows, res));
+	return !i || memcmp(&fl->src_prefixes[i].bsid,
+			    &fl->src_prefixes[0].bsid, sizeof(struct in6_addr));
 }
 
 static bool prune_bw(struct edge *e, void *arg)
@@ -425,18 +769,18 @@ static void delay_init(const struct graph *g, struct node *src, void **state,
 		       void *data __unused__)
 {
 	struct llist_node *iter;
-	struct hashmap *dist;
+	struct node_dist *dist;
 	struct node *n;
 
-	dist = hmap_new(hash_node, compare_node);
+	dist = node_dist_new();
 
 	llist_node_foreach(g->nodes, iter) {
 		n = iter->data;
 
 		if (n->id == src->id)
-			hmap_set(dist, n, (void *)(uintptr_t)0);
+			node_dist_set(dist, n->id, 0);
 		else
-			hmap_set(dist, n, (void *)(uintptr_t)UINT32_MAX);
+			node_dist_set(dist, n->id, UINT32_MAX);
 	}
 
 	*state = dist;
@@ -444,19 +788,19 @@ static void delay_init(const struct graph *g, struct node *src, void **state,
 
 static void delay_destroy(void *state)
 {
-	hmap_destroy(state);
+	node_dist_destroy(state);
 }
 
 static uint32_t delay_below_cost(uint32_t cur_cost, struct edge *e, void *state,
 				 void *data)
 {
-	struct hashmap *dist = state;
+	struct node_dist *dist = state;
 	struct flow *fl = data;
 	uint32_t cur_delay;
 	struct link *l;
 
 	l = e->data;
-	cur_delay = (uintptr_t)hmap_get(dist, e->local);
+	cur_delay = node_dist_get(dist, e->local->id);
 
 	if (cur_delay + l->delay > fl->delay)
 		return UINT32_MAX;
@@ -466,13 +810,13 @@ static uint32_t delay_below_cost(uint32_t cur_cost, struct edge *e, void *state,
 
 static void delay_update(struct edge *e, void *state, void *data __unused__)
 {
-	struct hashmap *dist = state;
+	struct node_dist *dist = state;
 	uint32_t cur_delay;
 	struct link *l;
 
 	l = e->data;
-	cur_delay = (uintptr_t)hmap_get(dist, e->local);
-	hmap_set(dist, e->remote, (void *)(uintptr_t)(cur_delay + l->delay));
+	cur_delay = node_dist_get(dist, e->local->id);
+	node_dist_set(dist, e->remote->id, cur_delay + l->delay);
 }
 
 struct d_ops delay_below_ops = {
@@ -580,27 +924,73 @@ static int select_providers(struct flow *fl)
 	return fl->nb_prefixes;
 }
 
-static void process_request(struct srdb_entry *entry)
+/* Router owning the prefix of @addr, NULL if none. The netstate lock is
+ * not needed: the routers are only released with the netstate.
+ */
+static struct router *lookup_router(const char *addr)
+{
+	struct in6_addr in6;
+	struct router *rt;
+	unsigned int idx;
+
+	inet_pton(AF_INET6, addr, &in6);
+
+	idx = rcu_read_lock(&_cfg.ns.prefix_rcu);
+	rt = lpm_mbt_lookup(rcu_dereference(_cfg.ns.prefix_trie), &in6);
+	rcu_read_unlock(&_cfg.ns.prefix_rcu, idx);
+
+	return rt;
+}
+
+static void arena_key_destroy(void *arena)
+{
+	arena_destroy(arena);
+}
+
+/* Scratch memory of the path computations of the current thread,
+ * released in one shot after each request or recomputed flow.
+ */
+static struct arena *thread_arena(void)
+{
+	struct arena *arena;
+
+	arena = pthread_getspecific(arena_key);
+	if (arena)
+		return arena;
+
+	arena = arena_new(0);
+	if (arena && pthread_setspecific(arena_key, arena)) {
+		arena_destroy(arena);
+		return NULL;
+	}
+
+	return arena;
+}
+
+static void thread_arena_reset(void)
+{
+	struct arena *arena;
+
+	arena = pthread_getspecific(arena_key);
+	if (arena)
+		arena_reset(arena);
+}
+
+static void process_request(struct srdb_entry *entry, struct rule *rule)
 {
 	struct srdb_flowreq_entry *req = (struct srdb_flowreq_entry *)entry;
 	struct node *src_node, *dst_node;
 	struct router *rt, *dstrt;
 	enum flowreq_status rstat;
-	struct llist_node *epath;
-	struct llist_node *segs;
+	struct llist_node *epath, *path;
 	struct pathspec pspec;
-	struct in6_addr addr;
-	struct rule *rule;
+	struct seglist *segs;
 	struct flow *fl;
 	unsigned int i;
 
 	if (req->status != REQ_STATUS_PENDING)
 		return;
 
-	rule = match_rules(_cfg.rules, req->source, req->destination);
-	if (!rule)
-		rule = _cfg.defrule;
-
 	if (rule->type == RULE_ALLOW)
 		rstat = REQ_STATUS_ALLOWED;
 	else
@@ -613,6 +1003,14 @@ static void process_request(struct srdb_entry *entry)
 		return;
 	}
 
+	rt = lookup_router(req->srcaddr);
+	dstrt = lookup_router(req->dstaddr);
+
+	if (!rt || !dstrt) {
+		set_flowreq_status(req, REQ_STATUS_NOPREFIX);
+		return;
+	}
+
 	fl = calloc(1, sizeof(*fl));
 	if (!fl) {
 		set_flowreq_status(req, REQ_STATUS_ERROR);
@@ -620,6 +1018,7 @@ static void process_request(struct srdb_entry *entry)
 	}
 
 	strncpy(fl->src, req->source, SLEN);
+	strncpy(fl->srcaddr, req->srcaddr, SLEN);
 	strncpy(fl->dst, req->destination, SLEN);
 	strncpy(fl->proxy, req->proxy, SLEN);
 	strncpy(fl->request_id, req->request_id, SLEN);
@@ -631,22 +1030,6 @@ static void process_request(struct srdb_entry *entry)
 
 	net_state_read_lock(&_cfg.ns);
 
-	inet_pton(AF_INET6, req->srcaddr, &addr);
-	rt = lpm_lookup(_cfg.ns.prefixes, &addr);
-
-	if (!rt) {
-		set_flowreq_status(req, REQ_STATUS_NOPREFIX);
-		goto free_flow;
-	}
-
-	inet_pton(AF_INET6, req->dstaddr, &addr);
-	dstrt = lpm_lookup(_cfg.ns.prefixes, &addr);
-
-	if (!dstrt) {
-		set_flowreq_status(req, REQ_STATUS_NOPREFIX);
-		goto free_flow;
-	}
-
 	src_node = graph_get_node_noref(_cfg.ns.graph, rt->node_id);
 	dst_node = graph_get_node_noref(_cfg.ns.graph, dstrt->node_id);
 
@@ -678,14 +1061,28 @@ static void process_request(struct srdb_entry *entry)
 	pspec.via = rule->path;
 	pspec.data = fl;
 	pspec.prune = pre_prune;
+	pspec.arena = thread_arena();
 	if (fl->delay)
 		pspec.d_ops = &delay_min_ops;
 
 	epath = NULL;
-	segs = build_segpath(_cfg.ns.graph, &pspec, &epath);
+	segs = NULL;
+	path = build_segpath(_cfg.ns.graph, &pspec, &epath);
+	if (path)
+		segs = resolve_segments(path);
 
 	if (!segs) {
-		set_flowreq_status(req, REQ_STATUS_UNAVAILABLE);
+		set_flowreq_status(req, path ? REQ_STATUS_ERROR :
+				   REQ_STATUS_UNAVAILABLE);
+		destroy_edgepath(epath);
+		goto free_src_prefixes;
+	}
+
+	if (bsid_alloc(rt->bsids, &fl->src_prefixes[0].bsid) < 0) {
+		zlog_warn(zc, "no binding SID available on router %s.\n",
+			  rt->name);
+		set_flowreq_status(req, REQ_STATUS_ERROR);
+		seglist_release(segs);
 		destroy_edgepath(epath);
 		goto free_src_prefixes;
 	}
@@ -696,24 +1093,22 @@ static void process_request(struct srdb_entry *entry)
 	fl->timestamp = time(NULL);
 	fl->status = FLOW_STATUS_ACTIVE;
 
-	hmap_write_lock(_cfg.flows);
-	generate_unique_bsid(rt, &fl->src_prefixes[0].bsid);
-	hmap_set(_cfg.flows, &fl->src_prefixes[0].bsid, fl);
-
 	for (i = 1; i < fl->nb_prefixes; i++) {
-		fl->src_prefixes[i].segs = copy_segments(segs);
+		fl->src_prefixes[i].segs = seglist_hold(segs);
 		fl->src_prefixes[i].epath = copy_edgepath(epath);
 
-		if (dstrt) {
+		if (dstrt || bsid_alloc(rt->bsids,
+					&fl->src_prefixes[i].bsid) < 0)
 			fl->src_prefixes[i].bsid = fl->src_prefixes[0].bsid;
-		} else {
-			generate_unique_bsid(rt, &fl->src_prefixes[i].bsid);
+		else
 			fl->refcount++;
-			hmap_set(_cfg.flows, &fl->src_prefixes[i].bsid, fl);
-		}
 	}
 
-	hmap_unlock(_cfg.flows);
+	/* the flow is complete before the scans can see it */
+	for (i = 0; i < fl->nb_prefixes; i++) {
+		if (own_bsid(fl, i))
+			shmap_set(_cfg.flows, &fl->src_prefixes[i].bsid, fl);
+	}
 
 	if (commit_flow(fl)) {
 		set_flowreq_status(req, REQ_STATUS_ERROR);
@@ -727,13 +1122,15 @@ static void process_request(struct srdb_entry *entry)
 	return;
 
 free_segs:
-	hmap_write_lock(_cfg.flows);
-	for (i = 0; i < fl->nb_prefixes; i++)
-		hmap_delete(_cfg.flows, &fl->src_prefixes[i].bsid);
-	hmap_unlock(_cfg.flows);
+	for (i = 0; i < fl->nb_prefixes; i++) {
+		if (!own_bsid(fl, i))
+			continue;
+		shmap_delete(_cfg.flows, &fl->src_prefixes[i].bsid);
+		bsid_release(rt->bsids, &fl->src_prefixes[i].bsid);
+	}
 
 	for (i = 0; i < fl->nb_prefixes; i++) {
-		free_segments(fl->src_prefixes[i].segs);
+		seglist_release(fl->src_prefixes[i].segs);
 		destroy_edgepath(fl->src_prefixes[i].epath);
 	}
 
@@ -744,108 +1141,367 @@ free_flow:
 	net_state_unlock(&_cfg.ns);
 }
 
-static int flowreq_read(struct srdb_entry *entry)
+/* The rule matched at admission, valid while the task holds @rules */
+struct req_task {
+	struct srdb_entry *entry;
+	struct ruleset *rules;
+	struct rule *rule;
+};
+
+static void request_task(void *arg)
 {
-	struct srdb_flowreq_entry *req = (struct srdb_flowreq_entry *)entry;
+	struct admission *adm = &_cfg.adm;
+	struct req_task *rt = arg;
+	struct srdb_table *tbl;
 
-	sbuf_push(_cfg.req_buffer, req);
+	__atomic_sub_fetch(&adm->queued[rt->rule->priority], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&adm->total, 1, __ATOMIC_RELAXED);
 
-	return 0;
+	tbl = srdb_table_by_name(_cfg.srdb->tables, "FlowReq");
+
+	process_request(rt->entry, rt->rule);
+	ruleset_release(rt->rules);
+
+	thread_arena_reset();
+
+	free_srdb_entry(tbl->desc, rt->entry);
+	free(rt);
 }
 
-static int nodestate_read(struct srdb_entry *entry)
+/* Submit @req to the executor without blocking. Returns -1 if the
+ * request is shed.
+ */
+static int admit_request(struct admission *adm,
+			 struct srdb_flowreq_entry *req)
 {
-	struct srdb_nodestate_entry *node_entry;
-	struct node *rt_node;
-	struct router *rt;
-	struct prefix *p;
-	char **vargs;
-	char **pref;
-	int ret = 0;
-	int vargc;
+	enum rule_priority prio;
+	struct req_task *rt;
+	struct ruleset *rs;
+	struct rule *rule;
+	unsigned int total;
+	unsigned int idx;
 
-	node_entry = (struct srdb_nodestate_entry *)entry;
+	/* the match is kept until the flow is committed, outside of the
+	 * read section so that a reload does not wait for OVSDB.
+	 */
+	idx = rcu_read_lock(&_cfg.rules_rcu);
+	rs = ruleset_hold(rcu_dereference(_cfg.rules));
+	rcu_read_unlock(&_cfg.rules_rcu, idx);
+
+	rule = match_rules(rs, req->source, req->destination, req->srcaddr);
+	prio = rule->priority;
+
+	total = __atomic_load_n(&adm->total, __ATOMIC_RELAXED);
+
+	if (!adm->overload && total >= _cfg.req_high_watermark) {
+		adm->overload = true;
+		zlog_warn(zc, "%u queued requests, shedding the requests below high priority.\n",
+			  total);
+	} else if (adm->overload && total <= _cfg.req_low_watermark) {
+		adm->overload = false;
+		zlog_info(zc, "%u queued requests, admitting all priorities.\n",
+			  total);
+	}
 
-	net_state_write_lock(&_cfg.ns);
+	if (adm->overload && prio != RULE_PRIO_HIGH)
+		goto out_release;
 
-	rt = hmap_get(_cfg.ns.routers, node_entry->name);
-	if (rt) {
-		zlog_error(zc, "duplicate router entry `%s'.\n", node_entry->name);
-		goto out_err;
-	}
+	if (__atomic_load_n(&adm->queued[prio], __ATOMIC_RELAXED) >=
+	    _cfg.req_buffer_size)
+		goto out_release;
 
 	rt = malloc(sizeof(*rt));
 	if (!rt)
-		goto out_err;
+		goto out_release;
 
-	memcpy(rt->name, node_entry->name, SLEN);
-	inet_pton(AF_INET6, node_entry->addr, &rt->addr);
+	rt->entry = (struct srdb_entry *)req;
+	rt->rules = rs;
+	rt->rule = rule;
 
-	if (*node_entry->pbsid)
-		pref_pton(node_entry->pbsid, &rt->pbsid);
+	__atomic_add_fetch(&adm->queued[prio], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&adm->total, 1, __ATOMIC_RELAXED);
 
-	rt->prefixes = llist_node_alloc();
+	if (executor_submit(_cfg.ex, req_class[prio], request_task, rt,
+			    NULL) < 0) {
+		__atomic_sub_fetch(&adm->queued[prio], 1, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&adm->total, 1, __ATOMIC_RELAXED);
+		free(rt);
+		goto out_release;
+	}
 
-	vargs = strsplit(node_entry->prefix, &vargc, ';');
-	for (pref = vargs; *pref; pref++) {
-		if (!**pref)
-			continue;
+	return 0;
 
-		p = malloc(sizeof(*p));
-		pref_pton(*pref, p);
-		llist_node_insert_tail(rt->prefixes, p);
+out_release:
+	ruleset_release(rs);
+	return -1;
+}
 
-		lpm_insert(_cfg.ns.prefixes, &p->addr, p->len, rt);
-	}
-	free(vargs);
+struct reject_batch {
+	unsigned int count;
+	struct srdb_entry *entries[];
+};
 
-	graph_write_lock(_cfg.ns.graph_staging);
+static void free_reject_batch(struct reject_batch *rb)
+{
+	struct srdb_table *tbl;
+	unsigned int i;
 
-	mark_graph_dirty();
+	tbl = srdb_table_by_name(_cfg.srdb->tables, "FlowReq");
 
-	rt_node = graph_add_node(_cfg.ns.graph_staging, rt);
-	rt->node_id = rt_node->id;
+	for (i = 0; i < rb->count; i++)
+		free_srdb_entry(tbl->desc, rb->entries[i]);
+	free(rb);
+}
 
-	graph_unlock(_cfg.ns.graph_staging);
+static void reject_batch_done(json_t *res, void *arg)
+{
+	struct reject_batch *rb = arg;
+	unsigned int i, failed = 0;
 
-	rt->refcount = 1;
+	/* one operation per request, in the order of the batch */
+	for (i = 0; i < rb->count; i++) {
+		if (!srdb_result_op_count(res, i, NULL))
+			continue;
 
-	hmap_set(_cfg.ns.routers, rt->name, rt);
+		zlog_error(zc, "failed to reject request uuid %s.\n",
+			   rb->entries[i]->row);
+		failed++;
+	}
 
-out_unlock:
-	net_state_unlock(&_cfg.ns);
-	return ret;
-out_err:
-	ret = -1;
-	goto out_unlock;
+	if (failed)
+		zlog_error(zc, "failed to reject %u of %u requests.\n", failed,
+			   rb->count);
+
+	free_reject_batch(rb);
 }
 
-static int linkstate_read(struct srdb_entry *entry)
+/* Rejection of a batch that did not fit in the transaction queue. It
+ * waits for a free slot in an executor worker instead of the monitor.
+ */
+static void reject_batch_task(void *arg)
 {
-	struct srdb_linkstate_entry *link_entry;
-	struct node *rt1_node, *rt2_node;
-	struct link *link, *link2;
-	struct router *rt1, *rt2;
-	uint32_t metric;
-	int ret = 0;
+	struct reject_batch *rb = arg;
+	struct transaction *tr;
+	struct srdb_table *tbl;
+	json_t *res = NULL;
 
-	link_entry = (struct srdb_linkstate_entry *)entry;
+	tbl = srdb_table_by_name(_cfg.srdb->tables, "FlowReq");
 
-	link = malloc(sizeof(*link));
-	if (!link)
-		return -1;
+	tr = srdb_update_rows(_cfg.srdb, tbl, rb->entries, rb->count,
+			      FREQ_STATUS);
+	if (tr)
+		res = srdb_transaction_reply(tr);
 
-	link2 = malloc(sizeof(*link2));
-	if (!link2)
-		return -1;
+	reject_batch_done(res, rb);
+	json_decref(res);
+}
 
-	net_state_read_lock(&_cfg.ns);
+/* The FlowReq monitor never blocks: the requests that cannot be queued
+ * are rejected with REQ_STATUS_OVERLOAD, in one transaction per update.
+ */
+static int flowreq_batch(struct srdb_row_change *changes, unsigned int n)
+{
+	struct srdb_flowreq_entry *req;
+	struct admission *adm = &_cfg.adm;
+	struct srdb_table *tbl;
+	struct reject_batch *rb;
+	unsigned int i;
 
-	rt1 = hmap_get(_cfg.ns.routers, link_entry->name1);
-	rt2 = hmap_get(_cfg.ns.routers, link_entry->name2);
-	if (!rt1 || !rt2) {
-		zlog_error(zc, "unknown router entry for link (`%s', `%s').\n",
-			   link_entry->name1, link_entry->name2);
+	tbl = srdb_table_by_name(_cfg.srdb->tables, "FlowReq");
+
+	rb = malloc(sizeof(*rb) + n * sizeof(*rb->entries));
+	if (rb)
+		rb->count = 0;
+
+	for (i = 0; i < n; i++) {
+		req = (struct srdb_flowreq_entry *)changes[i].entry;
+
+		if (changes[i].diff)
+			free_srdb_entry(tbl->desc, changes[i].diff);
+
+		if (changes[i].op != SRDB_OP_INSERT ||
+		    req->status != REQ_STATUS_PENDING) {
+			free_srdb_entry(tbl->desc, changes[i].entry);
+			continue;
+		}
+
+		if (!admit_request(adm, req))
+			continue;
+
+		if (!rb) {
+			free_srdb_entry(tbl->desc, changes[i].entry);
+			continue;
+		}
+
+		req->status = REQ_STATUS_OVERLOAD;
+		rb->entries[rb->count++] = changes[i].entry;
+	}
+
+	if (!rb) {
+		zlog_error(zc, "failed to allocate request rejections.\n");
+		return -1;
+	}
+
+	if (!rb->count) {
+		free(rb);
+		return 0;
+	}
+
+	adm->rejected += rb->count;
+	zlog_warn(zc, "overload: rejected %u requests (%lu total).\n",
+		  rb->count, adm->rejected);
+
+	if (!srdb_update_rows_async(_cfg.srdb, tbl, rb->entries, rb->count,
+				    FREQ_STATUS, reject_batch_done, rb))
+		return 0;
+
+	if (!executor_submit(_cfg.ex, TASK_REJECT, reject_batch_task, rb,
+			     NULL))
+		return 0;
+
+	zlog_error(zc, "failed to reject %u requests.\n", rb->count);
+	free_reject_batch(rb);
+	return -1;
+}
+
+/* called with the netstate and staging graph write locks */
+static int nodestate_read(struct srdb_entry *entry)
+{
+	struct srdb_nodestate_entry *node_entry;
+	struct node *rt_node;
+	struct router *rt;
+	struct prefix *p;
+	char **vargs;
+	char **pref;
+	int vargc;
+
+	node_entry = (struct srdb_nodestate_entry *)entry;
+
+	rt = hmap_get(_cfg.ns.routers, node_entry->name);
+	if (rt) {
+		zlog_error(zc, "duplicate router entry `%s'.\n", node_entry->name);
+		return -1;
+	}
+
+	rt = malloc(sizeof(*rt));
+	if (!rt)
+		return -1;
+
+	memcpy(rt->name, node_entry->name, SLEN);
+	inet_pton(AF_INET6, node_entry->addr, &rt->addr);
+
+	memset(&rt->pbsid, 0, sizeof(rt->pbsid));
+	rt->bsids = NULL;
+
+	if (*node_entry->pbsid) {
+		pref_pton(node_entry->pbsid, &rt->pbsid);
+		rt->bsids = bsid_pool_new(&rt->pbsid.addr, rt->pbsid.len,
+					  _cfg.bsid_offset, _cfg.bsid_count,
+					  _cfg.bsid_quarantine);
+		if (!rt->bsids)
+			zlog_warn(zc, "no binding SID range for router %s.\n",
+				  rt->name);
+	}
+
+	rt->prefixes = llist_node_alloc();
+
+	vargs = strsplit(node_entry->prefix, &vargc, ';');
+	for (pref = vargs; *pref; pref++) {
+		if (!**pref)
+			continue;
+
+		p = malloc(sizeof(*p));
+		pref_pton(*pref, p);
+		llist_node_insert_tail(rt->prefixes, p);
+
+		lpm_insert(_cfg.ns.prefixes, &p->addr, p->len, rt);
+	}
+	free(vargs);
+
+	rt_node = graph_add_node(_cfg.ns.graph_staging, rt);
+	rt->node_id = rt_node->id;
+
+	rt->refcount = 1;
+
+	hmap_set(_cfg.ns.routers, rt->name, rt);
+
+	return 0;
+}
+
+static int nodestate_batch(struct srdb_row_change *changes, unsigned int n)
+{
+	struct lpm_mbt *trie, *old = NULL;
+	bool dirty = false;
+	unsigned int i;
+	int ret = 0;
+
+	net_state_write_lock(&_cfg.ns);
+	graph_write_lock(_cfg.ns.graph_staging);
+
+	for (i = 0; i < n; i++) {
+		if (changes[i].op != SRDB_OP_INSERT)
+			continue;
+
+		if (nodestate_read(changes[i].entry) < 0)
+			ret = -1;
+		else
+			dirty = true;
+	}
+
+	if (dirty) {
+		/* rebuilt aside, the requests keep the previous trie meanwhile */
+		trie = lpm_mbt_build(_cfg.ns.prefixes);
+		if (trie) {
+			old = _cfg.ns.prefix_trie;
+			rcu_assign_pointer(_cfg.ns.prefix_trie, trie);
+		} else {
+			zlog_error(zc, "cannot compile the router prefixes.\n");
+			ret = -1;
+		}
+		mark_graph_dirty();
+	}
+
+	graph_unlock(_cfg.ns.graph_staging);
+	net_state_unlock(&_cfg.ns);
+
+	if (old) {
+		synchronize_rcu(&_cfg.ns.prefix_rcu);
+		lpm_mbt_free(old);
+	}
+
+	return ret;
+}
+
+/* linkstate_read/update/delete are called with the netstate read lock
+ * and the staging graph write lock.
+ */
+static int linkstate_read(struct srdb_entry *entry)
+{
+	struct srdb_linkstate_entry *link_entry;
+	struct node *rt1_node, *rt2_node;
+	struct link *link, *link2;
+	struct router *rt1, *rt2;
+	uint32_t metric;
+	int ret = 0;
+
+	link_entry = (struct srdb_linkstate_entry *)entry;
+
+	link = malloc(sizeof(*link));
+	if (!link)
+		return -1;
+
+	link2 = malloc(sizeof(*link2));
+	if (!link2) {
+		free(link);
+		return -1;
+	}
+
+	rt1 = hmap_get(_cfg.ns.routers, link_entry->name1);
+	rt2 = hmap_get(_cfg.ns.routers, link_entry->name2);
+	if (!rt1 || !rt2) {
+		zlog_error(zc, "unknown router entry for link (`%s', `%s').\n",
+			   link_entry->name1, link_entry->name2);
 
 		goto out_free;
 	}
@@ -866,26 +1522,18 @@ static int linkstate_read(struct srdb_entry *entry)
 
 	metric = (uint32_t)link_entry->metric ?: UINT32_MAX;
 
-	graph_write_lock(_cfg.ns.graph_staging);
-
 	if (graph_get_edge_data(_cfg.ns.graph_staging, link)) {
 		zlog_error(zc, "duplicate link entry %s -> %s.\n", link_entry->addr1,
 			   link_entry->addr2);
-
-		graph_unlock(_cfg.ns.graph_staging);
 		goto out_free;
 	}
 
 	if (graph_get_edge_data(_cfg.ns.graph_staging, link2)) {
 		zlog_error(zc, "duplicate link entry %s -> %s.\n", link_entry->addr2,
 			   link_entry->addr1);
-
-		graph_unlock(_cfg.ns.graph_staging);
 		goto out_free;
 	}
 
-	mark_graph_dirty();
-
 	rt1_node = graph_get_node_noref(_cfg.ns.graph_staging, rt1->node_id);
 	rt2_node = graph_get_node_noref(_cfg.ns.graph_staging, rt2->node_id);
 
@@ -896,17 +1544,14 @@ static int linkstate_read(struct srdb_entry *entry)
 	graph_add_edge(_cfg.ns.graph_staging, rt2_node, rt1_node, metric,
 		       false, link2);
 
-	graph_unlock(_cfg.ns.graph_staging);
-
-out_nsunlock:
-	net_state_unlock(&_cfg.ns);
+out:
 	return ret;
 
 out_free:
 	free(link);
 	free(link2);
 	ret = -1;
-	goto out_nsunlock;
+	goto out;
 }
 
 static int linkstate_update(struct srdb_entry *entry,
@@ -927,8 +1572,6 @@ static int linkstate_update(struct srdb_entry *entry,
 	inet_pton(AF_INET6, link_entry->addr1, &lp2.remote);
 	inet_pton(AF_INET6, link_entry->addr2, &lp2.local);
 
-	graph_write_lock(_cfg.ns.graph_staging);
-
 	edge = graph_get_edge_data(_cfg.ns.graph_staging, &lp1);
 	if (!edge)
 		goto out_err;
@@ -972,17 +1615,12 @@ static int linkstate_update(struct srdb_entry *entry,
 		fmask &= ~ENTRY_MASK(LS_DELAY);
 	}
 
-	mark_graph_dirty();
-
-	graph_unlock(_cfg.ns.graph_staging);
-
 	if (fmask)
 		zlog_error(zc, "non-empty field mask after update (%u).\n", fmask);
 
 out:
 	return ret;
 out_err:
-	graph_unlock(_cfg.ns.graph_staging);
 	ret = -1;
 	goto out;
 }
@@ -1001,8 +1639,6 @@ static int linkstate_delete(struct srdb_entry *entry)
 	inet_pton(AF_INET6, link_entry->addr1, &lp2.remote);
 	inet_pton(AF_INET6, link_entry->addr2, &lp2.local);
 
-	graph_write_lock(_cfg.ns.graph_staging);
-
 	edge = graph_get_edge_data(_cfg.ns.graph_staging, &lp1);
 	if (edge)
 		graph_remove_edge(_cfg.ns.graph_staging, edge);
@@ -1011,11 +1647,48 @@ static int linkstate_delete(struct srdb_entry *entry)
 	if (edge)
 		graph_remove_edge(_cfg.ns.graph_staging, edge);
 
-	mark_graph_dirty();
+	return 0;
+}
+
+static int linkstate_batch(struct srdb_row_change *changes, unsigned int n)
+{
+	struct srdb_row_change *rc;
+	bool dirty = false;
+	unsigned int i;
+	int ret = 0;
+	int err = 0;
+
+	net_state_read_lock(&_cfg.ns);
+	graph_write_lock(_cfg.ns.graph_staging);
+
+	for (i = 0; i < n; i++) {
+		rc = &changes[i];
+
+		switch (rc->op) {
+		case SRDB_OP_INSERT:
+			err = linkstate_read(rc->entry);
+			break;
+		case SRDB_OP_UPDATE:
+			err = linkstate_update(rc->entry, rc->diff, rc->fmask);
+			break;
+		case SRDB_OP_DELETE:
+			err = linkstate_delete(rc->entry);
+			break;
+		}
+
+		if (err < 0)
+			ret = -1;
+		else
+			dirty = true;
+	}
+
+	if (dirty)
+		mark_graph_dirty();
 
 	graph_unlock(_cfg.ns.graph_staging);
+	net_state_unlock(&_cfg.ns);
 
-	return 0;
+	return ret;
 }
 
 #define READ_STRING(b, arg, dst) sscanf(b, #arg " \"%[^\"]\"", (dst)->arg)
@@ -1048,6 +1721,16 @@ static int load_config(const char *fname, struct config *cfg)
 		}
 		if (READ_STRING(buf, rules_file, cfg))
 			continue;
+		if (READ_INT(buf, rules_watch, cfg))
+			continue;
+		if (READ_INT(buf, rules_reevaluate, cfg))
+			continue;
+		if (READ_INT(buf, bsid_offset, cfg))
+			continue;
+		if (READ_INT(buf, bsid_count, cfg))
+			continue;
+		if (READ_INT(buf, bsid_quarantine, cfg))
+			continue;
 		if (READ_INT(buf, worker_threads, cfg)) {
 			if (!cfg->worker_threads)
 				cfg->worker_threads = 1;
@@ -1058,6 +1741,10 @@ static int load_config(const char *fname, struct config *cfg)
 				cfg->req_buffer_size = 1;
 			continue;
 		}
+		if (READ_INT(buf, req_high_watermark, cfg))
+			continue;
+		if (READ_INT(buf, req_low_watermark, cfg))
+			continue;
 		if (!strncmp(buf, "providers ", 10)) {
 			unsigned int i = 0;
 			char *ptr = buf + 10;
@@ -1088,40 +1775,97 @@ static int load_config(const char *fname, struct config *cfg)
 		break;
 	}
 
+	if (!cfg->req_high_watermark)
+		cfg->req_high_watermark = cfg->req_buffer_size;
+	if (!cfg->req_low_watermark ||
+	    cfg->req_low_watermark > cfg->req_high_watermark)
+		cfg->req_low_watermark = cfg->req_high_watermark / 2;
+
 	fclose(fp);
 	return ret;
 }
 
-static void *thread_worker(void *arg __unused__)
+#define FLOW_BATCH	32
+#define FLOW_SHARDS_PER_WORKER	4
+
+struct flow_batch {
+	void (*fn)(struct flow_batch *fb);
+	unsigned int count;
+	struct flow *flows[FLOW_BATCH];
+};
+
+static void flow_batch_task(void *arg)
 {
-	struct srdb_entry *entry;
-	struct srdb_table *tbl;
+	struct flow_batch *fb = arg;
 
-	tbl = srdb_table_by_name(_cfg.srdb->tables, "FlowReq");
+	fb->fn(fb);
+	free(fb);
+}
 
-	for (;;) {
-		entry = sbuf_pop(_cfg.req_buffer);
-		if (!entry)
-			break;
-		process_request(entry);
-		free_srdb_entry(tbl->desc, entry);
+/* Run @fn over @flows, FLOW_BATCH flows per task of class @class. The
+ * flows that cannot be submitted are processed inline.
+ */
+static void submit_flow_batches(struct llist_node *flows,
+				enum task_class class,
+				void (*fn)(struct flow_batch *fb),
+				struct task_group *group)
+{
+	struct flow_batch *fb = NULL;
+	struct llist_node *iter;
+
+	llist_node_foreach(flows, iter) {
+		if (!fb) {
+			fb = malloc(sizeof(*fb));
+			if (!fb) {
+				struct flow_batch one = {
+					.count = 1,
+					.flows = { iter->data },
+				};
+
+				fn(&one);
+				continue;
+			}
+			fb->fn = fn;
+			fb->count = 0;
+		}
+
+		fb->flows[fb->count++] = iter->data;
+
+		if (fb->count == FLOW_BATCH ||
+		    iter == llist_node_last_entry(flows)) {
+			if (executor_submit(_cfg.ex, class, flow_batch_task, fb,
+					    group) < 0)
+				flow_batch_task(fb);
+			fb = NULL;
+		}
 	}
+}
 
-	return NULL;
+static void expire_flows(struct flow_batch *fb)
+{
+	unsigned int i;
+
+	for (i = 0; i < fb->count; i++) {
+		set_flow_status(fb->flows[i], FLOW_STATUS_EXPIRED);
+		flow_release(fb->flows[i]);
+	}
 }
 
 static void gc_flows(void)
 {
-	struct llist_node *nhead, *iter;
+	struct llist_node *nhead;
 	struct hmap_entry *he, *tmp;
+	struct in6_addr *bsid;
+	struct hashmap *hm;
 	struct flow *fl;
+	unsigned int i;
 	time_t now;
 
 	/* Using a temporary list to store flows to be removed enables to
 	 * minimize the work performed with the flows write lock held.
 	 * The most expensive function is set_flow_status() which performs
 	 * a synchronous SRDB transaction and must be realised outside the
-	 * critical section.
+	 * critical section. The shards are locked one at a time.
 	 */
 	nhead = llist_node_alloc();
 	if (!nhead)
@@ -1129,42 +1873,51 @@ static void gc_flows(void)
 
 	now = time(NULL);
 
-	hmap_write_lock(_cfg.flows);
-
-	hmap_foreach_safe(_cfg.flows, he, tmp) {
-		fl = he->elem;
-
-		/* Flows are orphaned when the source or destination router's
-		 * node is removed from the network.
-		 */
-		if ((fl->ttl && now > fl->timestamp + fl->ttl) ||
-		    fl->status == FLOW_STATUS_ORPHAN) {
-			hmap_delete(_cfg.flows, he->key);
-			llist_node_insert_tail(nhead, fl);
+	shmap_foreach_shard(_cfg.flows, i, hm) {
+		hmap_write_lock(hm);
+
+		hmap_foreach_safe(hm, he, tmp) {
+			fl = he->elem;
+
+			/* Flows are orphaned when the source or destination
+			 * router's node is removed from the network.
+			 */
+			if ((fl->ttl && now > fl->timestamp + fl->ttl) ||
+			    fl->status == FLOW_STATUS_ORPHAN ||
+			    fl->status == FLOW_STATUS_REVOKED) {
+				bsid = he->key;
+				hmap_delete(hm, bsid);
+				bsid_release(fl->srcrt->bsids, bsid);
+				llist_node_insert_tail(nhead, fl);
+			}
 		}
-	}
-
-	hmap_unlock(_cfg.flows);
 
-	llist_node_foreach(nhead, iter) {
-		fl = iter->data;
-		set_flow_status(fl, FLOW_STATUS_EXPIRED);
-		flow_release(fl);
+		hmap_unlock(hm);
 	}
 
+	submit_flow_batches(nhead, TASK_EXPIRY, expire_flows, NULL);
+
 	llist_node_destroy(nhead);
 }
 
+static void commit_segments_done(json_t *res, void *arg __unused__)
+{
+	if (srdb_result_count(res, NULL) < 0)
+		zlog_error(zc, "failed to commit recomputed segments.\n");
+}
+
+/* The segments update is not awaited, so that recompute_flows() does not
+ * pay one OVSDB round-trip per affected flow.
+ */
 static void recompute_flow(struct flow *fl)
 {
 	struct node *src_node, *dst_node;
 	struct srdb_update_transact *utr;
 	struct srdb_flow_entry fe;
-	struct llist_node *epath;
-	struct llist_node *segs;
+	struct llist_node *epath, *path;
 	struct srdb_table *tbl;
-	struct transaction *tr;
 	struct pathspec pspec;
+	struct seglist *segs;
 	bool diff = false;
 	unsigned int i;
 
@@ -1184,35 +1937,36 @@ static void recompute_flow(struct flow *fl)
 	pspec.dst = dst_node;
 	pspec.data = fl;
 	pspec.prune = pre_prune;
+	pspec.arena = thread_arena();
 	if (fl->delay)
 		pspec.d_ops = &delay_min_ops;
 
 	epath = NULL;
-	segs = build_segpath(_cfg.ns.graph, &pspec, &epath);
+	path = build_segpath(_cfg.ns.graph, &pspec, &epath);
 
-	if (!segs)
+	if (!path)
 		goto out_unlock;
 
-	/* commit flow with updated segments */
-
-	if (!compare_segments(segs, fl->src_prefixes[0].segs))
-		diff = true;
+	segs = resolve_segments(path);
+	if (!segs) {
+		destroy_edgepath(epath);
+		goto out_unlock;
+	}
 
-	free_segments(fl->src_prefixes[0].segs);
-	destroy_edgepath(fl->src_prefixes[0].epath);
-	fl->src_prefixes[0].segs = segs;
-	fl->src_prefixes[0].epath = epath;
+	/* commit flow with updated segments, shared by the prefixes */
 
-	for (i = 1; i < fl->nb_prefixes; i++) {
-		if (!compare_segments(segs, fl->src_prefixes[i].segs))
+	for (i = 0; i < fl->nb_prefixes; i++) {
+		if (!seglist_equal(segs, fl->src_prefixes[i].segs))
 			diff = true;
 
-		free_segments(fl->src_prefixes[i].segs);
+		seglist_release(fl->src_prefixes[i].segs);
 		destroy_edgepath(fl->src_prefixes[i].epath);
-		fl->src_prefixes[i].segs = copy_segments(segs);
-		fl->src_prefixes[i].epath = copy_edgepath(epath);
+		fl->src_prefixes[i].segs = seglist_hold(segs);
+		fl->src_prefixes[i].epath = i ? copy_edgepath(epath) : epath;
 	}
 
+	seglist_release(segs);
+
 	/* do not update srdb if segments are unchanged */
 	if (!diff)
 		goto out_unlock;
@@ -1223,13 +1977,12 @@ static void recompute_flow(struct flow *fl)
 	utr = srdb_update_prepare(_cfg.srdb, tbl, (struct srdb_entry *)&fe);
 	srdb_update_append(utr, FE_SEGMENTS);
 
-	tr = srdb_update_commit(utr);
-
-	if (srdb_update_result(tr, NULL) < 0)
+	if (srdb_update_commit_async(utr, commit_segments_done, NULL) < 0)
 		zlog_error(zc, "failed to commit recomputed segments.\n");
 
 out_unlock:
 	net_state_unlock(&_cfg.ns);
+	thread_arena_reset();
 }
 
 static bool flow_affected(struct flow *fl)
@@ -1255,115 +2008,425 @@ static bool flow_affected(struct flow *fl)
 	return false;
 }
 
+static void recompute_batch(struct flow_batch *fb)
+{
+	unsigned int i;
+
+	for (i = 0; i < fb->count; i++) {
+		recompute_flow(fb->flows[i]);
+		flow_release(fb->flows[i]);
+	}
+}
+
+/* Flows are recomputed by the executor. The next recomputation waits for
+ * the previous one to complete, so that a flow is never recomputed
+ * concurrently.
+ */
 static void recompute_flows(void)
 {
-	struct llist_node *nhead, *iter;
+	struct llist_node *nhead;
 	struct hmap_entry *he;
+	struct hashmap *hm;
 	struct flow *fl;
+	unsigned int i;
 
 	nhead = llist_node_alloc();
 	if (!nhead)
 		return;
 
 	net_state_read_lock(&_cfg.ns);
-	hmap_read_lock(_cfg.flows);
 
-	hmap_foreach(_cfg.flows, he) {
-		fl = he->elem;
+	shmap_foreach_shard(_cfg.flows, i, hm) {
+		hmap_read_lock(hm);
 
-		if (flow_affected(fl)) {
-			flow_hold(fl);
-			llist_node_insert_tail(nhead, fl);
+		hmap_foreach(hm, he) {
+			fl = he->elem;
+
+			if (flow_affected(fl)) {
+				flow_hold(fl);
+				llist_node_insert_tail(nhead, fl);
+			}
 		}
+
+		hmap_unlock(hm);
 	}
 
-	hmap_unlock(_cfg.flows);
 	net_state_unlock(&_cfg.ns);
 
 	zlog_debug(zc, "%lu affected flows.\n", llist_node_size(nhead));
 
-	llist_node_foreach(nhead, iter) {
-		fl = iter->data;
-		recompute_flow(fl);
+	submit_flow_batches(nhead, TASK_RECOMPUTE, recompute_batch,
+			    &_cfg.recompute);
+
+	llist_node_destroy(nhead);
+}
+
+/* A flow denied by the new rules is revoked and expired by the next
+ * gc_flows(), the others get the lifetimes and constraints of their new
+ * rule. Their paths are left as is.
+ */
+static void reevaluate_batch(struct flow_batch *fb)
+{
+	unsigned int i, idx;
+	struct rule *rule;
+	struct flow *fl;
+
+	idx = rcu_read_lock(&_cfg.rules_rcu);
+
+	for (i = 0; i < fb->count; i++) {
+		fl = fb->flows[i];
+
+		rule = match_rules(rcu_dereference(_cfg.rules), fl->src,
+				   fl->dst, fl->srcaddr);
+
+		if (rule->type != RULE_ALLOW) {
+			fl->status = FLOW_STATUS_REVOKED;
+		} else {
+			fl->ttl = rule->ttl;
+			fl->idle = rule->idle;
+			if (rule->bw)
+				fl->bw = rule->bw;
+			if (rule->delay)
+				fl->delay = rule->delay;
+		}
+
 		flow_release(fl);
 	}
 
+	rcu_read_unlock(&_cfg.rules_rcu, idx);
+}
+
+static void reevaluate_flows(void)
+{
+	struct llist_node *nhead;
+	struct hmap_entry *he;
+	struct hashmap *hm;
+	struct flow *fl;
+	unsigned int i;
+
+	nhead = llist_node_alloc();
+	if (!nhead)
+		return;
+
+	shmap_foreach_shard(_cfg.flows, i, hm) {
+		hmap_read_lock(hm);
+
+		hmap_foreach(hm, he) {
+			fl = he->elem;
+			flow_hold(fl);
+			llist_node_insert_tail(nhead, fl);
+		}
+
+		hmap_unlock(hm);
+	}
+
+	zlog_debug(zc, "re-evaluating %lu flows.\n", llist_node_size(nhead));
+
+	submit_flow_batches(nhead, TASK_REEVALUATE, reevaluate_batch, NULL);
+
 	llist_node_destroy(nhead);
 }
 
-#define NETMON_LOOP_SLEEP	1
-#define GSYNC_SOFT_TIMEOUT	5
-#define GSYNC_HARD_TIMEOUT	50
+/* The requests processed from now on use the new rules, the old ones
+ * are destroyed once the requests that hold them are done. Only the
+ * network monitor replaces the rules.
+ */
+static void reload_rules(void)
+{
+	struct ruleset *rs, *old;
+
+	rs = load_rules(_cfg.rules_file);
+	if (!rs) {
+		zlog_error(zc, "failed to reload rules file %s, keeping the current rules.\n",
+			   _cfg.rules_file);
+		return;
+	}
+
+	old = _cfg.rules;
+	rcu_assign_pointer(_cfg.rules, rs);
+	synchronize_rcu(&_cfg.rules_rcu);
+	ruleset_release(old);
+
+	zlog_info(zc, "reloaded %u rules from %s.\n", rs->nrules,
+		  _cfg.rules_file);
+
+	if (_cfg.rules_reevaluate)
+		reevaluate_flows();
+}
+
+/* Editors usually replace the file, so its directory is watched */
+static int watch_rules(void)
+{
+	char dir[SLEN + 1];
+	int fd;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	strcpy(dir, _cfg.rules_file);
+	if (inotify_add_watch(fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Returns true if the rules file was written or replaced */
+static bool rules_changed(int fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	char name[SLEN + 1], *base;
+	bool changed = false;
+	ssize_t len;
+	char *ptr;
+
+	strcpy(name, _cfg.rules_file);
+	base = basename(name);
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)ptr;
+			if (ev->len && !strcmp(ev->name, base))
+				changed = true;
+		}
+	}
+
+	return changed;
+}
+
+#define GSYNC_RETRY		1
 #define GC_FLOWS_TIMEOUT	1000
 
+static int timer_arm(int fd, uint64_t us, bool periodic)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = us / 1000000;
+	its.it_value.tv_nsec = (us % 1000000) * 1000;
+	if (periodic)
+		its.it_interval = its.it_value;
+
+	return timerfd_settime(fd, 0, &its, NULL);
+}
+
+static void fd_drain(int fd)
+{
+	uint64_t val;
+
+	if (read(fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		zlog_error(zc, "failed to read timer or event.\n");
+}
+
+/* The staging graph is synchronized once it has not been modified for
+ * the debounce window, or after the hard timeout since it became dirty.
+ * Returns the delay until then in us, 0 if it is due.
+ */
+static uint64_t gsync_delay(struct netstate *ns, uint64_t now)
+{
+	uint64_t soft, hard, deadline;
+
+	soft = ns->gs_mod + gsync_window(&ns->gsync);
+	hard = ns->gs_dirty + ns->gsync.hard;
+	deadline = soft < hard ? soft : hard;
+
+	return deadline > now ? deadline - now : 0;
+}
+
+enum netmon_fd {
+	NETMON_EVENT,
+	NETMON_GC,
+	NETMON_GSYNC,
+	NETMON_SIGNAL,
+	NETMON_RULES,
+	NETMON_FDS,
+};
+
+static void bsid_dump(FILE *out)
+{
+	struct bsid_pool_stats st;
+	struct hmap_entry *he;
+	struct router *rt;
+
+	net_state_read_lock(&_cfg.ns);
+
+	hmap_foreach(_cfg.ns.routers, he) {
+		rt = he->elem;
+		if (!rt->bsids)
+			continue;
+
+		bsid_pool_stats(rt->bsids, &st);
+		fprintf(out, "bsid: router %s used %u quarantined %u free %u size %u (%u%%)\n",
+			rt->name, st.used, st.quarantined,
+			st.size - st.used - st.quarantined, st.size,
+			(unsigned int)((uint64_t)(st.used + st.quarantined) *
+				       100 / st.size));
+	}
+
+	net_state_unlock(&_cfg.ns);
+	fflush(out);
+}
+
+static void netmon_signal(int fd)
+{
+	struct signalfd_siginfo si;
+
+	while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+		if (si.ssi_signo == SIGUSR1) {
+			gsync_dump(&_cfg.ns.gsync, stderr);
+			bsid_dump(stderr);
+		}
+		else if (si.ssi_signo == SIGHUP)
+			reload_rules();
+	}
+}
+
+/* Sleeps until a topology change is signalled or a timer expires: the
+ * graph sync deadline, or the periodic flow garbage collection. It also
+ * reloads the rules. @arg is the set of signals it handles, blocked by
+ * main().
+ */
 static void *thread_netmon(void *arg)
 {
 	struct netstate *ns = &_cfg.ns;
-	struct timeval gc_time, now;
-	sem_t *stop = arg;
+	struct pollfd fds[NETMON_FDS];
+	int gc_fd, gsync_fd, sig_fd;
+	int rules_fd = -1;
+	uint64_t delay;
+	unsigned int i;
 
-	gettimeofday(&gc_time, NULL);
+	gc_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	gsync_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (gc_fd < 0 || gsync_fd < 0) {
+		zlog_error(zc, "failed to create network monitor timers.\n");
+		goto out_close;
+	}
+
+	sig_fd = signalfd(-1, arg, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sig_fd < 0)
+		zlog_warn(zc, "cannot handle SIGUSR1 and SIGHUP.\n");
+
+	if (_cfg.rules_watch) {
+		rules_fd = watch_rules();
+		if (rules_fd < 0)
+			zlog_warn(zc, "cannot watch rules file %s.\n",
+				  _cfg.rules_file);
+	}
+
+	timer_arm(gc_fd, GC_FLOWS_TIMEOUT * 1000, true);
+
+	fds[NETMON_EVENT].fd = ns->event_fd;
+	fds[NETMON_GC].fd = gc_fd;
+	fds[NETMON_GSYNC].fd = gsync_fd;
+	fds[NETMON_SIGNAL].fd = sig_fd;
+	fds[NETMON_RULES].fd = rules_fd;
+	for (i = 0; i < NETMON_FDS; i++)
+		fds[i].events = POLLIN;
 
-	while (sem_trywait(stop)) {
-		gettimeofday(&now, NULL);
+	/* a change may have been signalled before */
+	goto check_gsync;
 
-		if (getmsdiff(&now, &gc_time) > GC_FLOWS_TIMEOUT) {
+	while (!__atomic_load_n(&ns->stop, __ATOMIC_ACQUIRE)) {
+		if (poll(fds, NETMON_FDS, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			zlog_error(zc, "network monitor poll failed.\n");
+			break;
+		}
+
+		if (fds[NETMON_GC].revents & POLLIN) {
+			fd_drain(gc_fd);
 			gc_flows();
-			gc_time = now;
 		}
 
-		/* attempt to resync graph if dirty and either:
-		 * - last graph mod > NS_GSYNC_SOFT_TIMEOUT
-		 * - dirty set time > NS_GSYNC_HARD_TIMEOUT
-		 */
+		if (fds[NETMON_SIGNAL].revents & POLLIN)
+			netmon_signal(sig_fd);
 
-		if (!_cfg.ns.graph_staging->dirty)
-			goto next;
+		if (fds[NETMON_RULES].revents & POLLIN && rules_changed(rules_fd))
+			reload_rules();
 
-		/* check adversely affected flows. Normally, by constraint but
-		 * for benchmarks, consider link-down events as adverse
+		if (fds[NETMON_EVENT].revents & POLLIN)
+			fd_drain(ns->event_fd);
+		else if (!(fds[NETMON_GSYNC].revents & POLLIN))
+			continue;
+
+		if (fds[NETMON_GSYNC].revents & POLLIN)
+			fd_drain(gsync_fd);
+
+check_gsync:
+		if (!ns->graph_staging->dirty)
+			continue;
+
+		delay = gsync_delay(ns, srdb_now_us());
+
+		/* a flow must not be recomputed concurrently: the sync
+		 * waits for the previous recomputation to complete
 		 */
+		if (!delay && !task_group_done(&_cfg.recompute))
+			delay = GSYNC_RETRY * 1000;
 
-		if (getmsdiff(&now, &_cfg.ns.gs_mod) > GSYNC_SOFT_TIMEOUT ||
-		    getmsdiff(&now, &_cfg.ns.gs_dirty) > GSYNC_HARD_TIMEOUT) {
-			if (netstate_graph_sync(ns) < 0) {
-				zlog_error(zc, "failed to synchronize staging network graph.\n");
-				goto next;
-			}
+		if (delay) {
+			timer_arm(gsync_fd, delay, false);
+			continue;
+		}
 
-			recompute_flows();
+		if (netstate_graph_sync(ns) < 0) {
+			zlog_error(zc, "failed to synchronize staging network graph.\n");
+			timer_arm(gsync_fd, GSYNC_RETRY * 1000, false);
+			continue;
 		}
 
-next:
-		usleep(NETMON_LOOP_SLEEP * 1000);
+		/* check adversely affected flows. Normally, by constraint but
+		 * for benchmarks, consider link-down events as adverse
+		 */
+		recompute_flows();
 	}
 
+	if (rules_fd >= 0)
+		close(rules_fd);
+	if (sig_fd >= 0)
+		close(sig_fd);
+out_close:
+	if (gc_fd >= 0)
+		close(gc_fd);
+	if (gsync_fd >= 0)
+		close(gsync_fd);
+
 	return NULL;
 }
 
+static void netmon_stop(struct netstate *ns)
+{
+	__atomic_store_n(&ns->stop, true, __ATOMIC_RELEASE);
+	netmon_wakeup(ns);
+}
+
 static int launch_srdb(void)
 {
 	unsigned int mon_flags;
 
 	mon_flags = MON_INITIAL | MON_INSERT | MON_UPDATE | MON_DELETE;
 
-	if (srdb_monitor(_cfg.srdb, "NodeState", mon_flags, nodestate_read,
-			 NULL, NULL, false, true) < 0) {
+	if (srdb_monitor_batch(_cfg.srdb, "NodeState", mon_flags,
+			       nodestate_batch, false, true) < 0) {
 		zlog_error(zc, "failed to start NodeState monitor.\n");
 		return -1;
 	}
 
 
-	if (srdb_monitor(_cfg.srdb, "LinkState", mon_flags, linkstate_read,
-			 linkstate_update, linkstate_delete, false, true) < 0) {
+	if (srdb_monitor_batch(_cfg.srdb, "LinkState", mon_flags,
+			       linkstate_batch, false, true) < 0) {
 		zlog_error(zc, "failed to start LinkState monitor.\n");
 		return -1;
 	}
 
 	mon_flags = MON_INITIAL | MON_INSERT;
 
-	if (srdb_monitor(_cfg.srdb, "FlowReq", mon_flags, flowreq_read, NULL,
-			 NULL, true, true) < 0) {
+	if (srdb_monitor_batch(_cfg.srdb, "FlowReq", mon_flags, flowreq_batch,
+			       true, true) < 0) {
 		zlog_error(zc, "failed to start FlowReq monitor.\n");
 		return -1;
 	}
@@ -1399,10 +2462,8 @@ int load_args(int argc, char **argv, const char **conf, int *dryrun)
 int main(int argc, char **argv)
 {
 	const char *conf = DEFAULT_CONFIG;
-	pthread_t *workers;
 	pthread_t netmon;
-	unsigned int i;
-	sem_t mon_stop;
+	sigset_t netmon_sigs;
 	int ret = 0;
 	int dryrun = 0;
 
@@ -1411,6 +2472,12 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	/* delivered to the network monitor, blocked before any thread */
+	sigemptyset(&netmon_sigs);
+	sigaddset(&netmon_sigs, SIGUSR1);
+	sigaddset(&netmon_sigs, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &netmon_sigs, NULL);
+
 	config_set_defaults(&_cfg);
 
 	if (load_config(conf, &_cfg) < 0) {
@@ -1418,19 +2485,27 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	_cfg.rules = load_rules(_cfg.rules_file, &_cfg.defrule);
+	_cfg.rules = load_rules(_cfg.rules_file);
 	if (!_cfg.rules) {
 		fprintf(stderr, "failed to load rules file.");
 		ret = -1;
 		goto free_conf;
 	}
+	rcu_init(&_cfg.rules_rcu);
+
+	/* the arenas of the workers are released when they exit */
+	if (pthread_key_create(&arena_key, arena_key_destroy)) {
+		fprintf(stderr, "failed to create the arena key.");
+		ret = -1;
+		goto free_rules;
+	}
 
 	/* Logs setup */
 	int rc = zlog_init(*_cfg.zlog_conf_file ? _cfg.zlog_conf_file : NULL);
 	if (rc) {
 		fprintf(stderr, "Initiating logs failed\n");
 		ret = -1;
- 		goto free_rules;
+ 		goto free_key;
  	}
 	zc = zlog_get_category("sr-ctrl");
 	if (!zc) {
@@ -1451,70 +2526,64 @@ int main(int argc, char **argv)
 		goto free_logs;
 	}
 
+	if (srdb_stats_dump_on_signal(_cfg.srdb, SIGUSR2, stderr) < 0)
+		zlog_warn(zc, "cannot dump SRDB statistics on SIGUSR2.\n");
+
 	if (init_netstate(&_cfg.ns) < 0) {
 		zlog_error(zc, "failed to initialize network state.");
 		ret = -1;
 		goto free_srdb;
 	}
 
-	_cfg.flows = hmap_new(hash_in6, compare_in6);
+	/* a few shards per worker keep them from colliding */
+	_cfg.flows = shmap_new(FLOW_SHARDS_PER_WORKER * _cfg.worker_threads,
+			       hash_in6, compare_in6);
 	if (!_cfg.flows) {
 		zlog_error(zc, "failed to initialize flow map.\n");
 		ret = -1;
-		goto free_srdb;
+		goto free_netstate;
 	}
 
-	_cfg.req_buffer = sbuf_new(_cfg.req_buffer_size);
-	if (!_cfg.req_buffer) {
-		zlog_error(zc, "failed to initialize request queue.\n");
-		ret = -1;
-		goto free_flows;
-	}
+	task_group_init(&_cfg.recompute);
 
-	workers = malloc(_cfg.worker_threads * sizeof(pthread_t));
-	if (!workers) {
-		zlog_error(zc, "failed to allocate space for worker threads.\n");
+	_cfg.ex = executor_new(_cfg.worker_threads, TASK_CLASSES);
+	if (!_cfg.ex) {
+		zlog_error(zc, "failed to start worker threads.\n");
 		ret = -1;
-		goto free_req_buffer;
+		goto free_flows;
 	}
 
-	for (i = 0; i < _cfg.worker_threads; i++)
-		pthread_create(&workers[i], NULL, thread_worker, NULL);
-
 	if (launch_srdb() < 0) {
 		zlog_error(zc, "failed to start srdb monitors.\n");
-		goto free_workers;
+		ret = -1;
+		goto free_executor;
 	}
 
-	sem_init(&mon_stop, 0, 0);
-	pthread_create(&netmon, NULL, thread_netmon, &mon_stop);
+	pthread_create(&netmon, NULL, thread_netmon, &netmon_sigs);
 
 	srdb_monitor_join_all(_cfg.srdb);
 
-	for (i = 0; i < _cfg.worker_threads; i++)
-		sbuf_push(_cfg.req_buffer, NULL);
-
-	for (i = 0; i < _cfg.worker_threads; i++)
-		pthread_join(workers[i], NULL);
-
-	sem_post(&mon_stop);
+	netmon_stop(&_cfg.ns);
 
 	pthread_join(netmon, NULL);
 
-	destroy_netstate();
-
-free_workers:
-	free(workers);
-free_req_buffer:
-	sbuf_destroy(_cfg.req_buffer);
+free_executor:
+	/* runs the requests and flow updates still queued */
+	executor_destroy(_cfg.ex);
+	task_group_destroy(&_cfg.recompute);
 free_flows:
-	hmap_destroy(_cfg.flows);
+	destroy_flows();
+free_netstate:
+	destroy_netstate();
 free_srdb:
 	srdb_destroy(_cfg.srdb);
 free_logs:
 	zlog_fini();
+free_key:
+	pthread_key_delete(arena_key);
 free_rules:
-	destroy_rules(_cfg.rules, _cfg.defrule);
+	rcu_destroy(&_cfg.rules_rcu);
+	ruleset_release(_cfg.rules);
 free_conf:
 	if (_cfg.providers && _cfg.providers != &internal_provider)
 		free(_cfg.providers);
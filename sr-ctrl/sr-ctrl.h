@@ -2,10 +2,12 @@
 #define _SRCTRL_H
 
 #include <arpa/inet.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <netinet/in.h>
 #include "graph.h"
+#include "bsid.h"
 
 struct prefix {
 	struct in6_addr addr;
@@ -34,6 +36,7 @@ struct router {
 	char name[SLEN + 1];
 	struct in6_addr addr;
 	struct prefix pbsid;
+	struct bsid_pool *bsids; /* NULL without pbsid */
 	struct llist_node *prefixes;
 	unsigned int node_id;
 	atomic_t refcount __refcount_aligned;
@@ -52,6 +55,7 @@ static inline void rt_release(struct router *rt)
 		llist_node_foreach(rt->prefixes, iter)
 			free(iter->data);
 		llist_node_destroy(rt->prefixes);
+		bsid_pool_destroy(rt->bsids);
 		free(rt);
 	}
 }
@@ -81,13 +85,57 @@ static inline void link_release(struct link *link)
 		free(link);
 }
 
+/* Addresses of the segments of a path, stored inline in one allocation.
+ * A list is immutable once filled, so that the source prefixes of a flow
+ * share it, and two lists are equal when their bytes are.
+ */
+struct seglist {
+	atomic_t refcount;
+	unsigned int count;
+	struct in6_addr segs[];
+};
+
+static inline struct seglist *seglist_new(unsigned int count)
+{
+	struct seglist *sl;
+
+	sl = malloc(sizeof(*sl) + count * sizeof(struct in6_addr));
+	if (!sl)
+		return NULL;
+
+	sl->refcount = 1;
+	sl->count = count;
+
+	return sl;
+}
+
+static inline struct seglist *seglist_hold(struct seglist *sl)
+{
+	atomic_inc(&sl->refcount);
+	return sl;
+}
+
+static inline void seglist_release(struct seglist *sl)
+{
+	if (sl && atomic_dec(&sl->refcount) == 0)
+		free(sl);
+}
+
+static inline bool seglist_equal(const struct seglist *sl1,
+				 const struct seglist *sl2)
+{
+	return sl1->count == sl2->count &&
+	       !memcmp(sl1->segs, sl2->segs,
+		       sl1->count * sizeof(struct in6_addr));
+}
+
 struct src_prefix {
 	char router[SLEN + 1];
 	char addr[SLEN + 1];
 	char prefix_len;
 	int priority;
 	struct in6_addr bsid;
-	struct llist_node *segs;
+	struct seglist *segs;
 	struct llist_node *epath;
 };
 
@@ -95,6 +143,7 @@ struct flow {
 	char uuid[SLEN + 1];
 	char src[SLEN + 1];
 	char dst[SLEN + 1];
+	char srcaddr[SLEN + 1];
 	struct in6_addr dstaddr;
 	struct src_prefix *src_prefixes;
 	unsigned int nb_prefixes;
@@ -122,7 +171,7 @@ static inline void flow_release(struct flow *fl)
 		unsigned int i;
 
 		for (i = 0; i < fl->nb_prefixes; i++)
-			free_segments(fl->src_prefixes[i].segs);
+			seglist_release(fl->src_prefixes[i].segs);
 
 		free(fl->src_prefixes);
 		free(fl);
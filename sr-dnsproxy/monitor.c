@@ -273,6 +273,9 @@ int init_monitor(void)
 		goto out_err;
 	}
 
+	if (srdb_stats_dump_on_signal(srdb, SIGUSR2, stderr) < 0)
+		zlog_warn(zc, "Cannot dump SRDB statistics on SIGUSR2\n");
+
 	if (srdb_monitor(srdb, "FlowReq", MON_UPDATE, NULL, read_flowreq, NULL,
 			 false, true) < 0) {
 		zlog_error(zc, "failed to start FlowReq monitor.\n");
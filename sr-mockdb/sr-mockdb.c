@@ -0,0 +1,644 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <jansson.h>
+
+#include "srdb.h"
+#include "srdb_mem.h"
+
+#define BUFLEN		4096
+#define BUFLEN_MAX	(8*1024*1024)
+#define MAX_LISTEN	8
+#define DEFAULT_LISTEN	"tcp:[::1]:6640"
+
+/* Mock of the ovsdb-server subset used by srdb: transact (insert, update
+ * and delete of rows selected by uuid), monitor, monitor_cond_since and
+ * echo. The tables of sr.ovsschema known by srdb live in memory.
+ */
+
+static struct {
+	struct srdb *srdb;
+	struct ovsdb_config conf;
+	unsigned int latency; /* us */
+	unsigned int jitter; /* us */
+	unsigned int drop; /* % */
+	unsigned int reset; /* % */
+	unsigned int echo; /* s */
+	unsigned long long txn_id;
+} _cfg;
+
+struct conn {
+	int fd;
+	pthread_mutex_t send_lock;
+	bool closed;
+
+	/* one monitored table per connection, as opened by srdb */
+	struct srdb_mem_monitor *mm;
+	pthread_t mon_thread;
+	json_t *mon_id;
+	char table[SLEN + 1];
+	bool legacy;
+	int select; /* MON_* of a legacy monitor */
+	json_t *rows; /* legacy monitor: uuid -> row */
+};
+
+static int print_err(const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+
+	return ret;
+}
+
+static bool chance(unsigned int percent)
+{
+	return percent && (unsigned int)(rand() % 100) < percent;
+}
+
+/* Send @msg after the injected latency, or lose it. The reference to
+ * @msg is stolen.
+ */
+static int conn_send(struct conn *c, json_t *msg)
+{
+	size_t len, off;
+	ssize_t ret;
+	char *buf;
+
+	buf = json_dumps(msg, JSON_COMPACT);
+	json_decref(msg);
+	if (!buf)
+		return -1;
+
+	if (_cfg.latency || _cfg.jitter)
+		usleep(_cfg.latency + (_cfg.jitter ? rand() % _cfg.jitter : 0));
+
+	pthread_mutex_lock(&c->send_lock);
+
+	if (c->closed)
+		goto out_err;
+
+	if (chance(_cfg.reset)) {
+		c->closed = true;
+		shutdown(c->fd, SHUT_RDWR);
+		goto out_err;
+	}
+
+	if (chance(_cfg.drop))
+		goto out;
+
+	len = strlen(buf);
+	for (off = 0; off < len; off += ret) {
+		ret = send(c->fd, buf + off, len - off, MSG_NOSIGNAL);
+		if (ret < 0)
+			goto out_err;
+	}
+
+out:
+	pthread_mutex_unlock(&c->send_lock);
+	free(buf);
+	return 0;
+
+out_err:
+	pthread_mutex_unlock(&c->send_lock);
+	free(buf);
+	return -1;
+}
+
+static json_t *reply(json_t *id, json_t *result, json_t *error)
+{
+	json_t *msg;
+
+	msg = json_object();
+	if (!msg)
+		return NULL;
+
+	json_object_set(msg, "id", id ? id : json_null());
+	json_object_set_new(msg, "result", result ? result : json_null());
+	json_object_set_new(msg, "error", error ? error : json_null());
+
+	return msg;
+}
+
+static json_t *notification(const char *method, json_t *params)
+{
+	json_t *msg;
+
+	msg = json_object();
+	if (!msg)
+		return NULL;
+
+	json_object_set_new(msg, "id", json_null());
+	json_object_set_new(msg, "method", json_string(method));
+	json_object_set_new(msg, "params", params);
+
+	return msg;
+}
+
+static json_t *table_updates(const char *table, json_t *updates)
+{
+	json_t *json;
+
+	json = json_object();
+	if (json)
+		json_object_set_new(json, table, updates);
+
+	return json;
+}
+
+static json_t *next_txn_id(void)
+{
+	char buf[SLEN + 1];
+
+	snprintf(buf, sizeof(buf), "00000000-0000-0000-0000-%012llx",
+		 __atomic_add_fetch(&_cfg.txn_id, 1, __ATOMIC_RELAXED));
+
+	return json_string(buf);
+}
+
+static bool selected(json_t *select, const char *op)
+{
+	json_t *flag;
+
+	flag = json_object_get(select, op);
+
+	return !flag || json_is_true(flag);
+}
+
+/* Convert <table-updates2> into the "new"/"old" <table-updates> of the
+ * legacy monitor, the connection keeps a copy of the rows for that.
+ */
+static json_t *legacy_updates(struct conn *c, json_t *updates2)
+{
+	json_t *updates, *row_update, *value, *row, *old, *new, *col_value;
+	const char *uuid, *op, *column;
+	int flag = 0;
+
+	updates = json_object();
+	if (!updates)
+		return NULL;
+
+	json_object_foreach(updates2, uuid, row_update) {
+		json_object_foreach(row_update, op, value) {
+			row = json_object_get(c->rows, uuid);
+			new = old = NULL;
+
+			if (!strcmp(op, "initial") || !strcmp(op, "insert")) {
+				flag = !strcmp(op, "initial") ? MON_INITIAL :
+								 MON_INSERT;
+				json_object_set(c->rows, uuid, value);
+				new = json_incref(value);
+			} else if (!strcmp(op, "modify") && row) {
+				flag = MON_UPDATE;
+				old = json_object();
+				json_object_foreach(value, column, col_value) {
+					json_object_set(old, column,
+							json_object_get(row,
+									column));
+					json_object_set(row, column, col_value);
+				}
+				new = json_deep_copy(row);
+			} else if (!strcmp(op, "delete") && row) {
+				flag = MON_DELETE;
+				old = json_incref(row);
+				json_object_del(c->rows, uuid);
+			} else {
+				continue;
+			}
+
+			if (c->select & flag) {
+				value = json_object();
+				if (new)
+					json_object_set(value, "new", new);
+				if (old)
+					json_object_set(value, "old", old);
+				json_object_set_new(updates, uuid, value);
+			}
+
+			json_decref(new);
+			json_decref(old);
+		}
+	}
+
+	return updates;
+}
+
+static void *monitor_worker(void *arg)
+{
+	struct conn *c = arg;
+	json_t *updates, *params, *msg;
+
+	while ((updates = srdb_mem_monitor_next(c->mm))) {
+		if (c->legacy) {
+			msg = legacy_updates(c, updates);
+			json_decref(updates);
+			if (!msg)
+				continue;
+
+			if (!json_object_size(msg)) {
+				json_decref(msg);
+				continue;
+			}
+
+			params = json_array();
+			json_array_append(params, c->mon_id);
+			json_array_append_new(params, table_updates(c->table,
+								    msg));
+			msg = notification("update", params);
+		} else {
+			params = json_array();
+			json_array_append(params, c->mon_id);
+			json_array_append_new(params, next_txn_id());
+			json_array_append_new(params, table_updates(c->table,
+								    updates));
+			msg = notification("update3", params);
+		}
+
+		if (msg && conn_send(c, msg) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+/* params: [<db-name>, <json-value>, <monitor-requests>, (<last-txn-id>)] */
+static json_t *handle_monitor(struct conn *c, json_t *msg, bool legacy)
+{
+	json_t *params, *requests, *req, *initial, *result;
+	const char *table;
+	void *iter;
+
+	if (c->mm)
+		return json_string("only one monitor per connection");
+
+	params = json_object_get(msg, "params");
+	requests = json_array_get(params, 2);
+	if (json_object_size(requests) != 1)
+		return json_string("only one table per monitor");
+
+	iter = json_object_iter(requests);
+	table = json_object_iter_key(iter);
+	req = json_object_iter_value(iter);
+
+	c->mm = srdb_mem_monitor_new(_cfg.srdb, table);
+	if (!c->mm)
+		return json_string("unknown table");
+
+	strncpy(c->table, table, SLEN);
+	c->mon_id = json_incref(json_array_get(params, 1));
+	c->legacy = legacy;
+
+	req = json_object_get(json_array_get(req, 0), "select");
+	c->select = (selected(req, "initial") ? MON_INITIAL : 0) |
+		    (selected(req, "insert") ? MON_INSERT : 0) |
+		    (selected(req, "modify") ? MON_UPDATE : 0) |
+		    (selected(req, "delete") ? MON_DELETE : 0);
+
+	/* the first update of a monitor holds the current rows */
+	initial = srdb_mem_monitor_next(c->mm);
+
+	if (legacy) {
+		c->rows = json_object();
+		result = table_updates(table, legacy_updates(c, initial));
+		json_decref(initial);
+	} else {
+		/* the transaction ids are not kept, always send the table */
+		result = json_array();
+		json_array_append_new(result, json_false());
+		json_array_append_new(result, next_txn_id());
+		json_array_append_new(result, table_updates(table, initial));
+	}
+
+	conn_send(c, reply(json_object_get(msg, "id"), result, NULL));
+
+	if (pthread_create(&c->mon_thread, NULL, monitor_worker, c)) {
+		srdb_mem_monitor_free(c->mm);
+		c->mm = NULL;
+	}
+
+	return NULL;
+}
+
+static void handle_message(struct conn *c, json_t *msg)
+{
+	json_t *id, *res, *error = NULL;
+	const char *method;
+
+	id = json_object_get(msg, "id");
+	method = json_string_value(json_object_get(msg, "method"));
+
+	/* reply to our echo */
+	if (!method)
+		return;
+
+	if (!strcmp(method, "transact")) {
+		res = srdb_mem_transact(_cfg.srdb, msg);
+		if (!res)
+			return;
+
+		json_object_set(res, "id", id);
+		conn_send(c, res);
+		return;
+	}
+
+	if (!strcmp(method, "monitor_cond_since"))
+		error = handle_monitor(c, msg, false);
+	else if (!strcmp(method, "monitor"))
+		error = handle_monitor(c, msg, true);
+	else if (!strcmp(method, "echo"))
+		conn_send(c, reply(id, json_incref(json_object_get(msg,
+								   "params")),
+				   NULL));
+	else
+		error = json_string("unknown method");
+
+	if (error)
+		conn_send(c, reply(id, NULL, error));
+}
+
+static void send_echo(struct conn *c)
+{
+	json_t *msg;
+
+	msg = json_object();
+	if (!msg)
+		return;
+
+	json_object_set_new(msg, "id", json_string("echo"));
+	json_object_set_new(msg, "method", json_string("echo"));
+	json_object_set_new(msg, "params", json_array());
+
+	conn_send(c, msg);
+}
+
+static void *conn_worker(void *arg)
+{
+	size_t buflen = BUFLEN, len = 0, pos;
+	json_error_t json_error;
+	struct conn *c = arg;
+	struct pollfd pfd;
+	json_t *msg;
+	ssize_t ret;
+	char *buf, *tmp;
+
+	buf = malloc(buflen);
+	if (!buf)
+		goto out_close;
+
+	pfd.fd = c->fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		ret = poll(&pfd, 1, _cfg.echo ? (int)_cfg.echo * 1000 : -1);
+		if (ret < 0 && errno != EINTR)
+			break;
+
+		/* keep alive the monitor connections */
+		if (!ret) {
+			if (c->mm)
+				send_echo(c);
+			continue;
+		}
+
+		if (len == buflen) {
+			if (buflen == BUFLEN_MAX)
+				break;
+
+			tmp = realloc(buf, buflen * 2);
+			if (!tmp)
+				break;
+
+			buf = tmp;
+			buflen *= 2;
+		}
+
+		ret = recv(c->fd, buf + len, buflen - len, 0);
+		if (ret <= 0)
+			break;
+
+		len += ret;
+
+		for (pos = 0; pos < len; pos += json_error.position) {
+			msg = json_loadb(buf + pos, len - pos,
+					 JSON_DISABLE_EOF_CHECK, &json_error);
+			if (!msg)
+				break;
+
+			handle_message(c, msg);
+			json_decref(msg);
+		}
+
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+	}
+
+	free(buf);
+
+out_close:
+	pthread_mutex_lock(&c->send_lock);
+	c->closed = true;
+	pthread_mutex_unlock(&c->send_lock);
+
+	if (c->mm) {
+		srdb_mem_monitor_stop(c->mm);
+		pthread_join(c->mon_thread, NULL);
+		srdb_mem_monitor_free(c->mm);
+		json_decref(c->mon_id);
+		json_decref(c->rows);
+	}
+
+	close(c->fd);
+	pthread_mutex_destroy(&c->send_lock);
+	free(c);
+
+	return NULL;
+}
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 64) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int listen_tcp(const char *spec)
+{
+	struct sockaddr_in6 addr;
+	char ip[SLEN + 1];
+	unsigned short port;
+	int fd, one = 1;
+
+	if (sscanf(spec, "tcp:[%127[^]]]:%hu", ip, &port) != 2)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port = htons(port);
+	if (inet_pton(AF_INET6, ip, &addr.sin6_addr) != 1)
+		return -1;
+
+	fd = socket(AF_INET6, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 64) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void accept_conn(int lfd)
+{
+	struct conn *c;
+	pthread_t thread;
+	int fd;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		close(fd);
+		return;
+	}
+
+	c->fd = fd;
+	pthread_mutex_init(&c->send_lock, NULL);
+
+	if (pthread_create(&thread, NULL, conn_worker, c)) {
+		pthread_mutex_destroy(&c->send_lock);
+		close(fd);
+		free(c);
+		return;
+	}
+
+	pthread_detach(thread);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-l latency_us] [-j jitter_us] [-p drop_%%] [-r reset_%%] [-e echo_s] [listen...]\n"
+		"  listen is tcp:[ip]:port or unix:path (default %s)\n",
+		prog, DEFAULT_LISTEN);
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd pfd[MAX_LISTEN];
+	const char *spec;
+	int c, i, n = 0;
+
+	while ((c = getopt(argc, argv, "l:j:p:r:e:h")) != -1) {
+		switch (c) {
+		case 'l':
+			_cfg.latency = atoi(optarg);
+			break;
+		case 'j':
+			_cfg.jitter = atoi(optarg);
+			break;
+		case 'p':
+			_cfg.drop = atoi(optarg);
+			break;
+		case 'r':
+			_cfg.reset = atoi(optarg);
+			break;
+		case 'e':
+			_cfg.echo = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (argc - optind > MAX_LISTEN) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	for (i = optind; i < argc || (!n && i == optind); i++) {
+		spec = i < argc ? argv[i] : DEFAULT_LISTEN;
+
+		if (!strncmp(spec, "unix:", 5))
+			pfd[n].fd = listen_unix(spec + 5);
+		else
+			pfd[n].fd = listen_tcp(spec);
+
+		if (pfd[n].fd < 0) {
+			fprintf(stderr, "cannot listen on %s (%s)\n", spec,
+				strerror(errno));
+			return -1;
+		}
+
+		pfd[n++].events = POLLIN;
+	}
+
+	strcpy(_cfg.conf.ovsdb_server, SRDB_MEM_PREFIX "sr-mockdb");
+	_cfg.conf.ntransacts = 1;
+
+	_cfg.srdb = srdb_new(&_cfg.conf, print_err);
+	if (!_cfg.srdb) {
+		fprintf(stderr, "cannot create the tables\n");
+		return -1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		if (poll(pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (pfd[i].revents & POLLIN)
+				accept_conn(pfd[i].fd);
+		}
+	}
+
+	srdb_destroy(_cfg.srdb);
+
+	return 0;
+}
@@ -110,7 +110,7 @@ static int lwt_encap(struct rtattr *rta, size_t len, const char *segs)
  * ip -6 route add <dst_str> encap seg6local action End.B6.Encaps srh segs <segs> dev <dev> table <tid>
  */
 int modify_route(struct rtnl_handle *rth, const char *dst_str, const char *dev,
-		 __u32 tid, const char *segs, bool new)
+		 __u32 tid, const char *segs, __u16 flags)
 {
 	// ip -6 route
 	struct {
@@ -128,11 +128,8 @@ int modify_route(struct rtnl_handle *rth, const char *dst_str, const char *dev,
 		.r.rtm_type = RTN_UNICAST
 	};
 
-	// add or change
-	if (new)
-		req.n.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
-	else
-		req.n.nlmsg_flags |= NLM_F_REPLACE;
+	// add, change or replace
+	req.n.nlmsg_flags |= flags;
 
 	// <segment>
 	struct in6_addr dst;
@@ -190,7 +187,8 @@ int modify_route(struct rtnl_handle *rth, const char *dst_str, const char *dev,
 int add_route(struct rtnl_handle *rth, const char *dst_str, const char *dev,
 	      __u32 tid, const char *segs)
 {
-	return modify_route(rth, dst_str, dev, tid, segs, true);
+	return modify_route(rth, dst_str, dev, tid, segs,
+			    NLM_F_CREATE | NLM_F_EXCL);
 }
 
 /**
@@ -200,6 +198,17 @@ int add_route(struct rtnl_handle *rth, const char *dst_str, const char *dev,
 int change_route(struct rtnl_handle *rth, const char *dst_str, const char *dev,
 		 __u32 tid, const char *segs)
 {
-	return modify_route(rth, dst_str, dev, tid, segs, false);
+	return modify_route(rth, dst_str, dev, tid, segs, NLM_F_REPLACE);
+}
+
+/**
+ * Same as executing
+ * ip -6 route replace <dst_str> encap seg6local action End.B6.Encaps srh segs <segs> dev <dev> table <tid>
+ */
+int replace_route(struct rtnl_handle *rth, const char *dst_str, const char *dev,
+		  __u32 tid, const char *segs)
+{
+	return modify_route(rth, dst_str, dev, tid, segs,
+			    NLM_F_CREATE | NLM_F_REPLACE);
 }
 
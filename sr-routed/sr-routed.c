@@ -7,13 +7,14 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <zlog.h>
 
 #include <jansson.h>
 
 #include "misc.h"
 #include "srdb.h"
-#include "hashmap.h"
+#include "srdb_cache.h"
 #include "atomic.h"
 #include "libnetlink.h"
 #include "seg6_netlink.h"
@@ -26,18 +27,13 @@ struct config {
 	char ingress_iface[SLEN + 1];
 
 	struct srdb *srdb;
-	struct hashmap *routes;
 	__u32 localsid;
 	struct rtnl_handle rth;
+	pthread_mutex_t rth_lock;
 
 	char zlog_conf_file[SLEN + 1];
 };
 
-struct route {
-	struct in6_addr bsid;
-	char *segs;
-};
-
 static struct config _cfg;
 static zlog_category_t *zc;
 
@@ -52,10 +48,10 @@ static int srdb_print(const char *fmt, ...)
 	return 0;
 }
 
-static int exec_route_add_encap(const char *route, const char *segments)
+static int exec_route_replace_encap(const char *route, const char *segments)
 {
-	int ret = add_route(&_cfg.rth, route, _cfg.ingress_iface, _cfg.localsid,
-			    segments);
+	int ret = replace_route(&_cfg.rth, route, _cfg.ingress_iface,
+				_cfg.localsid, segments);
 	if (ret) {
 		zlog_error(zc, "Cannot insert route %s mapping to %s\n", route,
 			segments);
@@ -74,24 +70,60 @@ static int exec_route_change_encap(const char *route, const char *segments)
 	return ret;
 }
 
-static void add_fib_entry(struct route *rt)
+/* route bsid -> encap seg6, for each BSID of a flow and the segment list
+ * at the same position. Called with rth_lock held.
+ */
+static int set_flow_routes(const char *bsid_list, const char *segments,
+			   int (*exec)(const char *, const char *))
 {
-	char bsid[INET6_ADDRSTRLEN];
+	json_t *segment_lists, *bsids, *segs, *segment;
+	char segs_str[SLEN + 1];
+	const char *bsid;
+	unsigned int j;
+	int i;
 
-	inet_ntop(AF_INET6, &rt->bsid, bsid, INET6_ADDRSTRLEN);
+	segment_lists = json_loads(segments, 0, NULL);
+	if (!segment_lists) {
+		zlog_error(zc, "Invalid json format for segment lists: %s\n", segments);
+		return -1;
+	}
 
-	exec_route_add_encap(bsid, rt->segs);
-}
+	bsids = json_loads(bsid_list, 0, NULL);
+	if (!bsids) {
+		zlog_error(zc, "Invalid json format for bsids: %s\n", bsid_list);
+		json_decref(segment_lists);
+		return -1;
+	}
 
-static void update_fib_entry(struct route *rt)
-{
-	char bsid[INET6_ADDRSTRLEN];
+	json_array_foreach(segment_lists, i, segs) {
+		unsigned int k = 0;
+
+		bsid = json_string_value(json_array_get(bsids, i));
+		if (!bsid)
+			continue;
 
-	inet_ntop(AF_INET6, &rt->bsid, bsid, INET6_ADDRSTRLEN);
+		json_array_foreach(segs, j, segment) {
+			k += snprintf(segs_str + k, SLEN + 1 - k, "%s%s",
+				      json_string_value(segment),
+				      j == json_array_size(segs) - 1 ? "" : ",");
+		}
 
-	exec_route_change_encap(bsid, rt->segs);
+		exec(bsid, segs_str);
+	}
+
+	json_decref(segment_lists);
+	json_decref(bsids);
+
+	return 0;
+}
+
+static void set_status_done(json_t *res, void *arg __unused__)
+{
+	if (srdb_result_count(res, NULL) < 0)
+		zlog_error(zc, "failed to update flow status.");
 }
 
+/* do not wait for the update, this runs in the FlowState monitor */
 static int set_status(struct srdb_flow_entry *flow_entry, enum flow_status st)
 {
 	struct srdb_table *tbl;
@@ -99,65 +131,32 @@ static int set_status(struct srdb_flow_entry *flow_entry, enum flow_status st)
 	tbl = srdb_table_by_name(_cfg.srdb->tables, "FlowState");
 	flow_entry->status = st;
 
-	return srdb_update_sync(_cfg.srdb, tbl, (struct srdb_entry *)flow_entry,
-			   FE_STATUS, NULL);
+	return srdb_update_async(_cfg.srdb, tbl, (struct srdb_entry *)flow_entry,
+				 FE_STATUS, set_status_done, NULL);
 }
 
 static int read_flowstate(struct srdb_entry *entry)
 {
 	struct srdb_flow_entry *flow_entry = (struct srdb_flow_entry *)entry;
-	json_t *segs = NULL;
-	json_t *segment = NULL;
-	char segs_str [SLEN + 1];
-	int i = 0;
-	unsigned int j = 0;
-	struct route *rt;
+	int ret;
 
 	if (strcmp(flow_entry->router, _cfg.router_name)) {
 		return 0; /* Do not consider irrelevant flows */
 	}
 
-	json_t *segment_lists = json_loads(flow_entry->segments, 0, NULL);
-	if (!segment_lists) {
-		zlog_error(zc, "Invalid json format for segment lists: %s\n", flow_entry->segments);
-		return 0;
-	}
-	json_t *bsids = json_loads(flow_entry->bsid, 0, NULL);
-	if (!bsids) {
-		zlog_error(zc, "Invalid json format for bsids: %s\n", flow_entry->bsid);
-		return 0;
-	}
+	/* the route may already be there, installed by sync_flows() */
+	pthread_mutex_lock(&_cfg.rth_lock);
+	ret = set_flow_routes(flow_entry->bsid, flow_entry->segments,
+			      exec_route_replace_encap);
+	pthread_mutex_unlock(&_cfg.rth_lock);
 
-	/* route bsid -> encap seg6 */
-
-	json_array_foreach(segment_lists, i, segs) {
-		unsigned int k = 0;
-
-		rt = malloc(sizeof(*rt));
-		inet_pton(AF_INET6, json_string_value(json_array_get(bsids, i)),
-			  &rt->bsid);
-
-		json_array_foreach(segs, j, segment) {
-			k += snprintf(segs_str + k, SLEN + 1 - k, "%s%s",
-				      json_string_value(segment),
-				      j == json_array_size(segs) - 1 ? "" : ",");
-		}
-
-		rt->segs = strdup(segs_str);
-
-		hmap_write_lock(_cfg.routes);
-		hmap_set(_cfg.routes, &rt->bsid, rt);
-		hmap_unlock(_cfg.routes);
-
-		add_fib_entry(rt);
-	}
+	if (ret < 0)
+		return 0;
 
 	/* Warn the DNS proxy */
 
-	set_status(flow_entry, FLOW_STATUS_RUNNING);
-
-	json_decref(segment_lists);
-	json_decref(bsids);
+	if (set_status(flow_entry, FLOW_STATUS_RUNNING) < 0)
+		zlog_error(zc, "failed to queue the flow status update.");
 
 	return 0;
 }
@@ -167,10 +166,6 @@ static int update_flowstate(struct srdb_entry *entry,
 			    unsigned int fmask)
 {
 	struct srdb_flow_entry *flow_entry = (struct srdb_flow_entry *)entry;
-	json_t *segment_lists, *bsids, *segs, *segment;
-	char segs_str[SLEN + 1];
-	unsigned int j;
-	int i;
 
 	if (strcmp(flow_entry->router, _cfg.router_name)) {
 		return 0; /* Do not consider irrelevant flows */
@@ -179,40 +174,44 @@ static int update_flowstate(struct srdb_entry *entry,
 	if (!(fmask & ENTRY_MASK(FE_SEGMENTS)))
 		return 0;
 
-	segment_lists = json_loads(flow_entry->segments, 0, NULL);
-	bsids = json_loads(flow_entry->bsid, 0, NULL);
-
-	json_array_foreach(segment_lists, i, segs) {
-		unsigned int k = 0;
-		struct in6_addr addr;
-		struct route *rt;
-
-		inet_pton(AF_INET6, json_string_value(json_array_get(bsids, i)),
-			  &addr);
+	pthread_mutex_lock(&_cfg.rth_lock);
+	set_flow_routes(flow_entry->bsid, flow_entry->segments,
+			exec_route_change_encap);
+	pthread_mutex_unlock(&_cfg.rth_lock);
 
-		hmap_read_lock(_cfg.routes);
-		rt = hmap_get(_cfg.routes, &addr);
-		hmap_unlock(_cfg.routes);
-
-		if (!rt)
-			continue;
-
-		json_array_foreach(segs, j, segment) {
-			k += snprintf(segs_str + k, SLEN + 1 - k, "%s%s",
-				      json_string_value(segment),
-				      j == json_array_size(segs) - 1 ? "" : ",");
-		}
+	return 0;
+}
 
-		free(rt->segs);
-		rt->segs = strdup(segs_str);
+/* Install the routes of the flows that this router already had in the
+ * FlowState cache when the monitor started. The monitor callbacks wait for
+ * rth_lock, so a concurrent update is applied after the routes set here.
+ */
+static void sync_flows(void)
+{
+	const char *bsids, *segments;
+	struct srdb_cache_entry *ce;
+	struct srdb_cache *cache;
+	struct srdb_table *tbl;
+	unsigned int epoch;
+	int idx;
 
-		update_fib_entry(rt);
+	tbl = srdb_table_by_name(_cfg.srdb->tables, "FlowState");
+	cache = tbl->cache;
+	idx = srdb_cache_index(cache, "router");
+
+	pthread_mutex_lock(&_cfg.rth_lock);
+	epoch = srdb_cache_read_lock(cache);
+
+	srdb_cache_foreach(cache, idx, _cfg.router_name, ce) {
+		bsids = srdb_compact_str(tbl, ce->row, FE_BSID);
+		segments = srdb_compact_str(tbl, ce->row, FE_SEGMENTS);
+		if (bsids && segments)
+			set_flow_routes(bsids, segments,
+					exec_route_replace_encap);
 	}
 
-	json_decref(segment_lists);
-	json_decref(bsids);
-
-	return 0;
+	srdb_cache_read_unlock(cache, epoch);
+	pthread_mutex_unlock(&_cfg.rth_lock);
 }
 
 #define READ_STRING(b, arg, dst) sscanf(b, #arg " \"%[^\"]\"", (dst)->arg)
@@ -336,13 +335,6 @@ int main(int argc, char **argv)
 		goto out_logs;
 	}
 
-	_cfg.routes = hmap_new(hash_in6, compare_in6);
-	if (!_cfg.routes) {
-		zlog_error(zc, "failed to initialize route map.");
-		ret = -1;
-		goto out_logs;
-	}
-
 	_cfg.srdb = srdb_new(&_cfg.ovsdb_conf, srdb_print);
 	if (!_cfg.srdb) {
 		zlog_error(zc, "failed to initialize SRDB.");
@@ -350,12 +342,25 @@ int main(int argc, char **argv)
 		goto out_logs;
 	}
 
+	if (srdb_stats_dump_on_signal(_cfg.srdb, SIGUSR2, stderr) < 0)
+		zlog_warn(zc, "cannot dump SRDB statistics on SIGUSR2.");
+
 	if (rtnl_open(&_cfg.rth, 0) < 0) {
 		zlog_error(zc, "Cannot open netlink socket.");
 		ret = -1;
 		goto out_srdb;
 	}
 
+	pthread_mutex_init(&_cfg.rth_lock, NULL);
+
+	/* local replica of the flows, looked up by router */
+	if (srdb_cache_enable(_cfg.srdb, "FlowState",
+			      (const char *const []){ "router", NULL }) < 0) {
+		zlog_error(zc, "failed to enable FlowState cache.");
+		ret = -1;
+		goto out_rtnl;
+	}
+
 	if (srdb_monitor(_cfg.srdb, "FlowState", MON_INSERT | MON_UPDATE,
 	                 read_flowstate, update_flowstate, NULL, false, true)
 	    != MON_STATUS_RUNNING) {
@@ -364,6 +369,8 @@ int main(int argc, char **argv)
 		goto out_rtnl;
 	}
 
+	sync_flows();
+
 	srdb_monitor_join_all(_cfg.srdb);
 out_rtnl:
 	rtnl_close(&_cfg.rth);